@@ -1,42 +1,150 @@
+#ifdef __linux__
+    #define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <errno.h>
+#include <math.h>
 
 #ifdef _WIN32
     #include <windows.h>
+    #include <direct.h>
     #define sleep(x) Sleep(x*1000)
+    #define mkdir(path, mode) _mkdir(path)
 #else
     #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/file.h>
+#endif
+
+#ifdef __linux__
+    #include <sys/epoll.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
 #endif
 
-#define MAX_ACCOUNTS 500
-#define MAX_TRANSACTIONS 2000
+#define CHUNK_SHIFT 12
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define MAX_CHUNKS 65536
+#define MAX_RECORDS (MAX_CHUNKS * CHUNK_SIZE)
+#define TIME_BLOCK_SHIFT 10
+#define TIME_BLOCKS (MAX_RECORDS >> TIME_BLOCK_SHIFT)
+#define LOCK_STRIPES 1024
+#define SHARED_SLOTS 64
+#define SESSION_BUFFER_SIZE 1024
+#define SERVER_MAX_EVENTS 256
+#define LOADGEN_BASE_ACCOUNT 900000000
+#define BENCH_DIR "bank_bench"
+#define BENCH_STAGES 3
+#define METRIC_SHARDS 16
+#define LATENCY_BUCKETS 304
 #define MAX_NAME_LENGTH 50
 #define INTEREST_RATE 0.015
+#define INTEREST_PERIOD (30 * 24 * 3600)
 #define DATA_FILE "bank_data.txt"
-
+#define SNAPSHOT_FILE "bank_data.bin"
+#define SNAPSHOT_MAGIC "BANKSNAP"
+#define SNAPSHOT_VERSION 5
+#define SNAPSHOT_V1_HEADER_SIZE 48
+#define SNAPSHOT_V2_HEADER_SIZE 64
+#define SNAPSHOT_V3_HEADER_SIZE 72
+#define SNAPSHOT_V4_HEADER_SIZE 104
+#define SHARD_SHIFT 10
+#define SHARD_SIZE (1 << SHARD_SHIFT)
+#define MAX_SHARDS (MAX_RECORDS >> SHARD_SHIFT)
+#define SHARD_FILE "bank_accounts_%06d.bin"
+#define SHARD_MAGIC "BANKSHRD"
+#define LEDGER_FILE "bank_ledger_%06d.bin"
+#define LEDGER_MAGIC "BANKLDGR"
+#define STRINGS_FILE "bank_strings.bin"
+#define STRINGS_MAGIC "BANKSTRS"
+#define HEADS_FILE "bank_heads_%06d.bin"
+#define HEADS_MAGIC "BANKHEAD"
+#define ROLLUP_FILE "bank_rollups_%06d.bin"
+#define ROLLUP_MAGIC "BANKROLL"
+#define ROLLUP_BLOCK_SHIFT 6
+#define ARCHIVE_FILE "bank_archive_%06d.bin"
+#define ARCHIVE_MAGIC "BANKARCH"
+#define ARCHIVE_MIN_CHUNKS 64
+#define ARCHIVE_ALIGN 65536
+#define LEDGER_WINDOW (1 << 20)
+#define MAX_DESCRIPTION_LENGTH 100
+#define JOURNAL_FILE "bank_journal.txt"
+#define JOURNAL_RECORD_SIZE 1024
+#define CHECKPOINT_LOCK_FILE "bank_checkpoint.lock"
+#define REPLICATION_MAX_FOLLOWERS 16
+#define REPLICATION_BUFFER_LIMIT (64 << 20)
+#define REPLICATION_INTERVAL_MS 10
+#define FOLLOW_BUFFER_SIZE (1 << 20)
+#define CHECKPOINT_INTERVAL 256
+#define HISTORY_PAGE_SIZE 10
+#define SEARCH_PAGE_SIZE 10
+#define EXPORT_BLOCK_ROWS 16384
+#define EXPORT_ROW_MAX 512
+#define COLUMNAR_MAGIC "BANKCOLS"
+#define VELOCITY_MAX_RULES 8
+#define VELOCITY_BUCKETS 8
+
+// The fields that balance operations and full-table scans read. Names and
+// credentials are kept apart in AccountProfile, at the same index, so a scan
+// over accounts touches about a fifth of the memory.
 typedef struct {
     int accountNumber;
-    char firstName[MAX_NAME_LENGTH];
-    char lastName[MAX_NAME_LENGTH];
-    double balance;
     int isActive;
     int isLocked;
     int isSavings;
+    double balance;
     time_t lastInterestDate;
-    char password[50];
+    int lastTransaction;
+    int olderBalance;
+    uint64_t balanceEpoch;
 } Account;
 
+typedef struct {
+    char firstName[MAX_NAME_LENGTH];
+    char lastName[MAX_NAME_LENGTH];
+    char password[50];
+} AccountProfile;
+
+typedef enum {
+    TXN_TYPE_ACCOUNT_OPEN,
+    TXN_TYPE_ACCOUNT_STATUS,
+    TXN_TYPE_ACCOUNT_UPDATE,
+    TXN_TYPE_ACCOUNT_CLOSE,
+    TXN_TYPE_SECURITY,
+    TXN_TYPE_DEPOSIT,
+    TXN_TYPE_WITHDRAWAL,
+    TXN_TYPE_TRANSFER,
+    TXN_TYPE_INTEREST,
+    TXN_TYPE_BALANCE_CHECK,
+    TXN_TYPE_OTHER,
+    TXN_TYPE_COUNT
+} TransactionType;
+
+// Descriptions are ids into the string pool, which stores each distinct
+// text once; see internString().
 typedef struct {
     int transactionId;
     int accountNumber;
-    char type[20];
     double amount;
     time_t timestamp;
     int relatedAccount;
-    char description[100];
+    int previousForAccount;
+    int description;
+    unsigned char type;
 } Transaction;
 
 typedef struct {
@@ -44,18 +152,761 @@ typedef struct {
     char password[50];
 } Admin;
 
-Account accounts[MAX_ACCOUNTS];
-Transaction transactions[MAX_TRANSACTIONS];
+typedef struct {
+    long operations;
+    uint64_t seed;
+    double deposited;
+    double withdrawn;
+    long applied;
+    long rejected;
+} StressWorker;
+
+// Pins snapshots while the stress workers run and checks each one against the
+// ledger it pinned: transfers move money without changing the total, so the
+// total must equal the opening total plus the deposits less the withdrawals.
+typedef struct {
+    int running;
+    int ledgerStart;
+    double opening;
+    long snapshots;
+    long torn;
+} StressAuditor;
+
+typedef enum {
+    BENCH_DEPOSIT,
+    BENCH_WITHDRAW,
+    BENCH_TRANSFER,
+    BENCH_HISTORY,
+    BENCH_SEARCH,
+    BENCH_OP_COUNT
+} BenchOperation;
+
+typedef struct {
+    int accounts;
+    int transactions;
+    long snapshotBytes;
+    double saveSeconds;
+    double loadSeconds;
+} BenchStage;
+
+typedef struct {
+    int fd;
+    int accountIndex;
+    int closing;
+    int wantsWrite;
+    char input[SESSION_BUFFER_SIZE];
+    size_t inputLength;
+    char *output;
+    size_t outputLength;
+    size_t outputSent;
+    size_t outputCapacity;
+} ServerSession;
+
+// A follower attached to the primary's replication socket, with the part of
+// the stream it has not taken yet.
+typedef struct {
+    int fd;
+    char *data;
+    size_t length;
+    size_t sent;
+    size_t capacity;
+} ReplicationFollower;
+
+typedef struct {
+    int fd;
+    int accountNumber;
+    int completed;
+    int awaitingStatus;
+    int pendingLines;
+    int lastWasHistory;
+    uint64_t seed;
+    double sentAt;
+    char input[4096];
+    size_t inputLength;
+} LoadConnection;
+
+typedef struct {
+    const char *address;
+    int firstConnection;
+    int connectionCount;
+    int totalConnections;
+    int requestsPerConnection;
+    long completed;
+    long rejected;
+    long failures;
+    double totalLatency;
+    double maxLatency;
+} LoadWorker;
+
+typedef enum {
+    TXN_OK = 0,
+    TXN_NOT_FOUND,
+    TXN_INACTIVE,
+    TXN_LOCKED,
+    TXN_INSUFFICIENT_FUNDS,
+    TXN_INVALID_AMOUNT,
+    TXN_SAME_ACCOUNT,
+    TXN_NOT_ELIGIBLE,
+    TXN_BAD_COMMAND,
+    TXN_SKIPPED,
+    TXN_BAD_PASSWORD,
+    TXN_VELOCITY_LIMIT,
+    TXN_SAVE_FAILED,
+    TXN_RESULT_COUNT
+} TransactionResult;
+
+typedef enum {
+    METRIC_LOGIN,
+    METRIC_DEPOSIT,
+    METRIC_WITHDRAW,
+    METRIC_TRANSFER,
+    METRIC_INTEREST,
+    METRIC_BALANCE,
+    METRIC_HISTORY,
+    METRIC_STATEMENT,
+    METRIC_SAVE,
+    METRIC_CHECKPOINT,
+    METRIC_LOAD,
+    METRIC_OPERATION_COUNT
+} MetricOperation;
+
+// Outcome counts and log-linear latency histograms (8 sub-buckets per power of
+// two nanoseconds, so within 12.5%). Threads are spread over METRIC_SHARDS
+// copies and a reader sums them.
+typedef struct {
+    _Alignas(64) uint64_t outcomes[METRIC_OPERATION_COUNT][TXN_RESULT_COUNT];
+    uint64_t latency[METRIC_OPERATION_COUNT][LATENCY_BUCKETS];
+    uint64_t latencySum[METRIC_OPERATION_COUNT];
+} MetricShard;
+
+// On-disk snapshot layout. Every record is a multiple of 8 bytes so the
+// payload checksum can run a word at a time.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t accountCount;
+    uint64_t transactionCount;
+    uint64_t adminCount;
+    uint64_t checksum;
+    uint64_t stringCount;
+    uint64_t stringBytes;
+    uint64_t archivedTransactions;
+    uint64_t ledgerFirst;
+    uint64_t ledgerChecksum;
+    uint64_t stringChecksum;
+    uint64_t shardSize;
+    uint64_t rollupCount;
+    uint64_t rollupFile;
+    uint64_t rollupRecords;
+    uint64_t rollupChecksum;
+} SnapshotHeader;
+
+// Version 4 snapshots are split into parts, each starting with this header.
+// Account shards hold count records from slot first, the archived history
+// heads hold count int32 heads as of first archived rows, and the append-only
+// ledger and string files hold rows from row first and padded texts; their
+// length and checksum are kept in the manifest instead.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t first;
+    uint64_t count;
+    uint64_t checksum;
+} PartHeader;
+
+// Archive segments hold whole ledger chunks in their in-memory layout, so the
+// chunks can be replaced in place by a read-only mapping of the file. The
+// header is followed by the lowest and highest timestamp of each time block,
+// and the rows start at dataOffset, a multiple of ARCHIVE_ALIGN.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t firstChunk;
+    uint32_t chunkCount;
+    uint64_t dataOffset;
+} ArchiveHeader;
+
+typedef struct {
+    int64_t lastInterestDate;
+    double balance;
+    int32_t accountNumber;
+    int32_t isActive;
+    int32_t isLocked;
+    int32_t isSavings;
+    char firstName[MAX_NAME_LENGTH];
+    char lastName[MAX_NAME_LENGTH];
+    char password[50];
+    char reserved[2];
+} DiskAccount;
+
+// Version 2 stores the type as its enum value and the description as an index
+// into the string section, which follows the admins as NUL-terminated texts
+// padded to a multiple of 8 bytes.
+typedef struct {
+    int64_t timestamp;
+    double amount;
+    int32_t transactionId;
+    int32_t accountNumber;
+    int32_t relatedAccount;
+    int32_t type;
+    int32_t description;
+    char reserved[4];
+} DiskTransaction;
+
+typedef struct {
+    int64_t timestamp;
+    double amount;
+    int32_t transactionId;
+    int32_t accountNumber;
+    int32_t relatedAccount;
+    char type[20];
+    char description[100];
+    char reserved[4];
+} DiskTransactionV1;
+
+typedef struct {
+    char username[50];
+    char password[50];
+    char reserved[4];
+} DiskAdmin;
+
+// Version 5 appends the statement rollups changed since the last checkpoint
+// to a log, each tagged with its slot in the pool; see Rollup.
+typedef struct {
+    int32_t slot;
+    int32_t account;
+    int32_t period;
+    int32_t previous;
+    double opening;
+    double deposits;
+    double withdrawals;
+    double transfersIn;
+    double transfersOut;
+    double interest;
+    int32_t entries;
+    int32_t depositCount;
+    int32_t withdrawalCount;
+    int32_t transferInCount;
+    int32_t transferOutCount;
+    int32_t interestCount;
+} DiskRollup;
+
+// The rollups one checkpoint appends to the log, copied while no operation
+// runs: every slot when fresh starts a new log, else those of dirty blocks.
+typedef struct {
+    DiskRollup *records;
+    int count;
+    int slots;
+    int fresh;
+} RollupBatch;
+
+// Inverted index from case-folded name trigrams to the accounts whose first
+// or last name contains them, so a name search only verifies candidates.
+// Each posting list holds an account at most once.
+typedef struct {
+    uint32_t trigram;
+    int count;
+    int capacity;
+    int *accounts;
+} NameIndexEntry;
+
+typedef struct {
+    NameIndexEntry *entries;
+    size_t capacity;
+    size_t size;
+} NameIndex;
+
+typedef struct {
+    int slot;
+    int score;
+    int accountNumber;
+} NameMatch;
+
+typedef enum {
+    EXPORT_ACCOUNTS,
+    EXPORT_TRANSACTIONS
+} ExportTable;
+
+// Balances are multi-versioned for readers that pin a snapshot. Every change
+// is stamped with a new commit epoch, and while any snapshot is pinned the
+// value it replaces is pushed onto the account's olderBalance chain, newest
+// first. A transfer stamps both accounts with one epoch.
+typedef struct {
+    double balance;
+    uint64_t epoch;
+    int older;
+} BalanceVersion;
+
+typedef struct {
+    uint64_t epoch;
+    int accounts;
+    int transactions;
+    int incomplete;
+} BalanceSnapshot;
+
+// A block of formatted CSV rows. block is the block it holds, or -1 while the
+// buffer is free for its worker to fill.
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+    int rows;
+    int block;
+} ExportBuffer;
+
+// localtime() is only called when a row's minute differs from the last one.
+typedef struct {
+    time_t minute;
+    int valid;
+    size_t length;
+    char prefix[32];
+} TimestampCache;
+
+// Rows are formatted in blocks of EXPORT_BLOCK_ROWS. Worker w formats blocks
+// w, w + threads, ... into its two buffers in turn, while the calling thread
+// writes the blocks out in order.
+typedef struct {
+    ExportTable table;
+    BalanceSnapshot snapshot;
+    int rows;
+    int blocks;
+    int threads;
+    ExportBuffer *buffers;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int failed;
+} CsvExport;
+
+typedef struct {
+    CsvExport *job;
+    int index;
+} CsvExportWorker;
+
+// Columnar ledger files start with this header and a directory of columns.
+// Each column is a packed array padded to 8 bytes; the type and description
+// columns hold ids into the dictionary columns, which are NUL-separated text.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t columnCount;
+    uint64_t rowCount;
+} ColumnarHeader;
+
+typedef struct {
+    char name[24];
+    uint32_t width;
+    uint32_t kind;
+    uint64_t offset;
+    uint64_t length;
+} ColumnarColumn;
+
+// Open-addressing table over the string pool. Slots hold a string id plus one,
+// or zero when empty.
+typedef struct {
+    int *slots;
+    size_t capacity;
+} StringTable;
+
+// Running totals over active accounts for the statistics dashboard. There is
+// one set per lock stripe, updated under that stripe's lock, so mutations
+// never contend on a shared counter.
+typedef struct {
+    _Alignas(64) int active;
+    int locked;
+    int savings;
+    double balance;
+} StripeAggregates;
+
+// Active accounts ordered by balance, then by slot. Each lock stripe keeps a
+// sorted array of its own accounts, maintained alongside its aggregates, so a
+// balance change only shifts entries within one stripe under a lock it
+// already holds. Queries merge the stripes.
+// Taking an account out leaves its entry in place as the stripe's hole (held
+// as its position plus one, or zero when there is none), so that putting it
+// back slides it to its new position instead of closing the gap and opening
+// another; see balanceIndexRemove().
+typedef struct {
+    double balance;
+    int slot;
+} BalanceEntry;
+
+typedef struct {
+    _Alignas(64) BalanceEntry *entries;
+    int size;
+    int capacity;
+    int hole;
+} BalanceStripe;
+
+// A position in one stripe during a merge of the balance index.
+typedef struct {
+    int stripe;
+    int position;
+} BalanceCursor;
+
+// Mutexes are padded to a cache line so neighbouring stripes don't contend.
+typedef struct {
+    _Alignas(64) pthread_mutex_t mutex;
+} PaddedMutex;
+
+// Open-addressing hash index from account number to its account slot.
+// Accounts are never removed (deletion only deactivates), so no tombstones.
+typedef struct {
+    int accountNumber;
+    int slot;
+} AccountIndexEntry;
+
+typedef struct {
+    AccountIndexEntry *entries;
+    size_t capacity;
+    size_t size;
+} AccountIndex;
+
+// Savings accounts waiting for their next interest date, as a binary min-heap
+// on the due time. Entries are never removed early: one that no longer fits
+// its account (interest already paid, account locked or closed) is found not
+// eligible when it comes up, and whatever makes the account eligible again
+// schedules it anew.
+typedef struct {
+    time_t due;
+    int slot;
+} InterestEntry;
+
+typedef struct {
+    InterestEntry *entries;
+    size_t capacity;
+    size_t size;
+} InterestQueue;
+
+// One account's activity over a day (period YYYYMMDD) or a month (YYYYMM).
+// The closing balance is the opening plus the flows; see rollupClosing().
+// Opening deposits count as deposits. previous is the account's rollup for
+// the period before, or -1, and account the index of the owner.
+typedef struct {
+    int account;
+    int period;
+    int previous;
+    double opening;
+    double deposits;
+    double withdrawals;
+    double transfersIn;
+    double transfersOut;
+    double interest;
+    int entries;
+    int depositCount;
+    int withdrawalCount;
+    int transferInCount;
+    int transferOutCount;
+    int interestCount;
+} Rollup;
+
+// An account's newest daily and monthly rollup, and in rollupBase the opening
+// balance of its first period, which is zero for an account opened in this
+// ledger. Only statements and ledger appends use them, so they are kept apart
+// from Account at the same index, like AccountProfile.
+typedef struct {
+    int dailyRollup;
+    int monthlyRollup;
+    double rollupBase;
+} RollupHeads;
+
+typedef enum {
+    VELOCITY_WITHDRAWALS = 1,
+    VELOCITY_TRANSFERS = 2
+} VelocityScope;
+
+// Caps what may leave an account within a sliding window: the amount, or
+// with countsOperations the number of withdrawals and transfers out that
+// scope covers.
+typedef struct {
+    int scope;
+    int countsOperations;
+    double limit;
+    int window;
+    int bucketSeconds;
+} VelocityRule;
+
+// One rule's counter for one account: a ring of buckets of bucketSeconds
+// each, newest being the bucket the latest charge fell in. The buckets span
+// the rule's window and at most one bucket more, so a limit is never applied
+// over less than its window. A zeroed ring is empty.
+typedef struct {
+    int64_t newest;
+    double buckets[VELOCITY_BUCKETS];
+} VelocityWindow;
+
+_Static_assert(sizeof(DiskAccount) % 8 == 0, "DiskAccount must be word aligned");
+_Static_assert(sizeof(DiskTransaction) % 8 == 0, "DiskTransaction must be word aligned");
+_Static_assert(sizeof(DiskTransactionV1) % 8 == 0, "DiskTransactionV1 must be word aligned");
+_Static_assert(sizeof(DiskAdmin) % 8 == 0, "DiskAdmin must be word aligned");
+_Static_assert(sizeof(PartHeader) % 8 == 0, "PartHeader must be word aligned");
+_Static_assert(sizeof(DiskRollup) % 8 == 0, "DiskRollup must be word aligned");
+_Static_assert(sizeof(SnapshotHeader) == SNAPSHOT_V4_HEADER_SIZE + 32, "SnapshotHeader must extend version 4");
+_Static_assert(SHARD_SHIFT <= CHUNK_SHIFT, "An account shard must not straddle chunks");
+
+// Accounts and transactions live in fixed-size chunks that are allocated on
+// demand and never move, so a record's index (and address) stays valid for
+// the life of the process. Unused directory entries cost no resident memory.
+void *accountChunks[MAX_CHUNKS];
+void *profileChunks[MAX_CHUNKS];
+void *transactionChunks[MAX_CHUNKS];
+int accountChunkCount = 0;
+int profileChunkCount = 0;
+int transactionChunkCount = 0;
+
+// Ledger rows below archivedTransactions live in sealed archive segments and
+// are mapped from disk; only the newest ledgerWindow or so rows stay in memory.
+int archivedTransactions = 0;
+int ledgerWindow = LEDGER_WINDOW;
+pthread_mutex_t archiveLock = PTHREAD_MUTEX_INITIALIZER;
 Admin admins[5];
 int accountCount = 0;
 int transactionCount = 0;
+
+static inline Account* accountAt(int index) {
+    return (Account*)accountChunks[index >> CHUNK_SHIFT] + (index & (CHUNK_SIZE - 1));
+}
+
+static inline AccountProfile* profileAt(int index) {
+    return (AccountProfile*)profileChunks[index >> CHUNK_SHIFT] + (index & (CHUNK_SIZE - 1));
+}
+
+// The string pool interns transaction descriptions. Texts are copied into an
+// append-only arena and addressed by id through a chunked pointer table, so a
+// string never moves once interned. Lookups probe stringTable without a lock;
+// inserts take stringPoolLock and publish the slot last. A table that is
+// outgrown is left allocated because readers may still be probing it.
+void *stringChunks[MAX_CHUNKS];
+int stringChunkCount = 0;
+int stringCount = 0;
+StringTable *stringTable = NULL;
+char *stringArena = NULL;
+size_t stringArenaFree = 0;
+pthread_mutex_t stringPoolLock = PTHREAD_MUTEX_INITIALIZER;
+
+const char *transactionTypeNames[TXN_TYPE_COUNT] = {
+    "Account Open", "Account Status", "Account Update", "Account Close", "Security",
+    "Deposit", "Withdrawal", "Transfer", "Interest", "Balance Check", "Other"
+};
+
+// Sparse time index over the ledger. Each block of 1024 rows records its
+// smallest and largest timestamp; queries fold these into prefix maxima and
+// suffix minima, which are monotone and so can be binary searched even though
+// concurrent appends leave the ledger only roughly in time order. Appends
+// that land in a block the derived arrays already cover mark it dirty.
+int64_t timeBlockMin[TIME_BLOCKS];
+int64_t timeBlockMax[TIME_BLOCKS];
+int64_t timePrefixMax[TIME_BLOCKS];
+int64_t timeSuffixMin[TIME_BLOCKS];
+int timeIndexedBlocks = 0;
+int timeDirtyBlock = INT32_MAX;
+pthread_mutex_t timeIndexLock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline const char* stringAt(int id) {
+    return ((const char**)stringChunks[id >> CHUNK_SHIFT])[id & (CHUNK_SIZE - 1)];
+}
+
+static inline Transaction* transactionAt(int index) {
+    return (Transaction*)transactionChunks[index >> CHUNK_SHIFT] + (index & (CHUNK_SIZE - 1));
+}
+// Pinning takes exclusive access just long enough to read the epoch, so every
+// operation stamped at or below it has finished. Versions are only reclaimed
+// when a snapshot is pinned with no other reader left, by starting the pool
+// over: a reader never follows a chain past the first version pushed after
+// its own pin.
+void *versionChunks[MAX_CHUNKS];
+int versionChunkCount = 0;
+int versionCount = 0;
+int pinnedSnapshots = 0;
+uint64_t balanceEpoch = 0;
+
+static inline BalanceVersion* versionAt(int index) {
+    return (BalanceVersion*)versionChunks[index >> CHUNK_SHIFT] + (index & (CHUNK_SIZE - 1));
+}
+
+// Statement rollups, filled in by createTransaction() under the lock of each
+// account they belong to, and on load restored from the checkpoint or
+// rebuilt from the ledger. Records are claimed from a shared pool and never
+// freed until the next rebuild.
+void *rollupChunks[MAX_CHUNKS];
+void *rollupHeadChunks[MAX_CHUNKS];
+int rollupChunkCount = 0;
+int rollupHeadChunkCount = 0;
+int rollupCount = 0;
+
+static inline Rollup* rollupAt(int index) {
+    return (Rollup*)rollupChunks[index >> CHUNK_SHIFT] + (index & (CHUNK_SIZE - 1));
+}
+
+static inline RollupHeads* rollupHeadsAt(int index) {
+    return (RollupHeads*)rollupHeadChunks[index >> CHUNK_SHIFT] + (index & (CHUNK_SIZE - 1));
+}
+
+// Velocity rules are fixed by the command line before any account exists.
+// Each account has velocityRuleCount counters at its own index, allocated
+// with the account chunks and guarded by the account's stripe lock.
+VelocityRule velocityRules[VELOCITY_MAX_RULES];
+int velocityRuleCount = 0;
+void *velocityChunks[MAX_CHUNKS];
+int velocityChunkCount = 0;
+
+static inline VelocityWindow* velocityAt(int index) {
+    return (VelocityWindow*)velocityChunks[index >> CHUNK_SHIFT] + (index & (CHUNK_SIZE - 1)) * velocityRuleCount;
+}
+
 int adminCount = 0;
 int currentUserAccount = -1;
 int isAdminLoggedIn = 0;
+AccountIndex accountIndex = {NULL, 0, 0};
+InterestQueue interestQueue = {NULL, 0, 0};
+pthread_mutex_t interestLock = PTHREAD_MUTEX_INITIALIZER;
+NameIndex nameIndex = {NULL, 0, 0};
+
+// Balances are guarded by per-account stripe locks. Structural changes
+// (registering accounts, checkpoints) need every shared slot, so ordinary
+// operations only ever touch their own slot's cache line.
+PaddedMutex accountLocks[LOCK_STRIPES];
+StripeAggregates stripeAggregates[LOCK_STRIPES];
+BalanceStripe balanceStripes[LOCK_STRIPES];
+int balanceIndexIncomplete = 0;
+MetricShard metricShards[METRIC_SHARDS];
+int nextMetricShard = 0;
+_Thread_local int metricShard = -1;
+PaddedMutex sharedLocks[SHARED_SLOTS];
+pthread_mutex_t chunkLock = PTHREAD_MUTEX_INITIALIZER;
+int nextSharedSlot = 0;
+_Thread_local int sharedSlot = -1;
+_Thread_local int sharedDepth = 0;
+FILE *journalFile = NULL;
+int journalRecords = 0;
+int journalMode = 1;
+int journalTrimmed = 0;
+
+// Journal records are appended to an in-memory buffer and written out by the
+// persistence thread every persistIntervalMs, which bounds how much acknowledged
+// work a crash can lose. With durableAck set, commitChanges() instead waits for
+// the operation's records to reach disk. Log sequence numbers count bytes.
+// A failed write or fsync leaves the journal with a gap, so journalFailedLsn
+// holds the end of the lost buffer and nothing counts as durable again until
+// a checkpoint covering it has landed.
+pthread_mutex_t journalLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t journalWriteLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t journalFlushed = PTHREAD_COND_INITIALIZER;
+pthread_cond_t persistWake = PTHREAD_COND_INITIALIZER;
+char *journalPending = NULL;
+size_t journalPendingLength = 0;
+size_t journalPendingCapacity = 0;
+char *journalWriting = NULL;
+size_t journalWritingCapacity = 0;
+uint64_t journalAppendedLsn = 0;
+uint64_t journalDurableLsn = 0;
+uint64_t journalFailedLsn = 0;
+_Thread_local uint64_t threadJournalLsn = 0;
+int durableWaiters = 0;
+int persistIntervalMs = 200;
+int durableAck = 0;
+int persistenceRunning = 0;
+pthread_t persistenceThread;
+
+// With --replicate, every journal record is also copied to replicationPending
+// while followers are attached, and the replication thread ships it to them
+// every REPLICATION_INTERVAL_MS, followed by a heartbeat, or sooner while a
+// follower has a backlog its socket can take. The follower count and pending
+// buffer are guarded by journalLock; the rest belongs to the replication
+// thread.
+// checkpointLockFd is locked exclusively while a checkpoint replaces files and
+// shared while a follower loads them.
+const char *replicationAddress = NULL;
+int replicationFd = -1;
+int replicationRunning = 0;
+pthread_t replicationThread;
+int checkpointLockFd = -1;
+ReplicationFollower replicationFollowers[REPLICATION_MAX_FOLLOWERS];
+int replicationFollowerCount = 0;
+int replicationLost = 0;
+char *replicationPending = NULL;
+size_t replicationPendingLength = 0;
+size_t replicationPendingCapacity = 0;
+char *replicationShipping = NULL;
+size_t replicationShippingCapacity = 0;
+
+// A follower (--follow) applies the primary's stream and serves reads only.
+// followHeartbeat is the primary's wall clock, in microseconds, as of the
+// newest state applied here.
+int followerMode = 0;
+int followConnected = 0;
+int64_t followHeartbeat = 0;
+uint64_t followAppliedRecords = 0;
+
+// Background checkpoints copy the mutable account table here under exclusive
+// access and write it out after releasing it. The ledger is append-only, so
+// only its length is captured.
+void* snapshotAccountChunks[MAX_CHUNKS];
+void* snapshotProfileChunks[MAX_CHUNKS];
+int snapshotAccountChunkCount = 0;
+int snapshotProfileChunkCount = 0;
+
+// Checkpoints rewrite only the account shards marked dirty since the last one.
+// checkpointState is the manifest that last committed, which tells how much of
+// the append-only ledger and string files is already on disk.
+unsigned char shardDirty[MAX_SHARDS];
+SnapshotHeader checkpointState = {.ledgerFirst = UINT64_MAX, .stringChecksum = 0xcbf29ce484222325ULL};
+
+static inline void markShardDirty(int accountIndex) {
+    __atomic_store_n(&shardDirty[accountIndex >> SHARD_SHIFT], 1, __ATOMIC_RELAXED);
+}
+
+// Rollups are marked in blocks of 1 << ROLLUP_BLOCK_SHIFT slots, and the
+// dirty blocks appended to the rollup log at each checkpoint. A load that
+// restores them sets restoredRollups to the slots it read and leaves only the
+// journal's rows to fold; otherwise it is -1 and the ledger is replayed.
+unsigned char rollupDirty[MAX_RECORDS >> ROLLUP_BLOCK_SHIFT];
+int restoredRollups = -1;
+int restoredRollupRows = 0;
+
+static inline void markRollupDirty(int slot) {
+    __atomic_store_n(&rollupDirty[slot >> ROLLUP_BLOCK_SHIFT], 1, __ATOMIC_RELAXED);
+}
 
 void initializeSystem();
 void loadData();
+void loadSnapshot();
+int loadBinarySnapshot(const char* path);
+int loadSnapshotParts(const SnapshotHeader* header);
+int loadRollupLog(const SnapshotHeader* header);
+const PartHeader* mapPart(const char* path, const char* magic, uint32_t recordSize, uint64_t first, uint64_t bytes, size_t* size);
+void readDiskAccount(int index, const DiskAccount* record);
+void fillDiskAccount(DiskAccount* record, const Account* a, const AccountProfile* profile);
+int readDiskTransaction(int index, const DiskTransaction* record, const int* stringIds, uint64_t strings);
+int mapFile(const char* path, const unsigned char** data, size_t* size);
+void unmapFile(const unsigned char* data, size_t size);
+void resetCheckpointState();
+int importTextData(const char* path);
+int exportTextData(const char* path);
+uint64_t snapshotChecksum(uint64_t hash, const void* data, size_t length);
 void saveData();
+int writeCheckpoint();
+int writeSnapshot(void* const* accountChunkDir, void* const* profileChunkDir, int accounts, int transactions, int strings, const Admin* adminRows, int admins, int archived, const int* shards, int shardTotal, const RollupBatch* rollups);
+int writeShard(void* const* accountChunkDir, void* const* profileChunkDir, int shard, int accounts);
+int appendLedger(int transactions, int archived, SnapshotHeader* next);
+int appendRollups(const RollupBatch* rollups, SnapshotHeader* next);
+int appendStrings(int strings, SnapshotHeader* next);
+int writeArchiveHeads(int accounts, int archived);
+int syncDataDirectory();
+int finishPartFile(FILE* file, int ok, const char* written, const char* path);
+int checkpointFileName(int index, char* path, size_t size);
+int collectDirtyShards(int accounts, int* shards);
+void restoreDirtyShards(const int* shards, int count);
+int collectDirtyRollups(RollupBatch* batch);
+void restoreDirtyRollups(const RollupBatch* batch);
+long long checkpointBytes();
+void removeCheckpointFiles();
+int sealArchiveSegment(int transactions);
+int mapArchiveSegment(int firstChunk, int endChunk);
+int mapArchive(int archived);
+void commitArchive(int archived);
 void mainMenu();
 void adminMenu();
 void customerMenu();
@@ -69,13 +920,150 @@ void balanceInquiry();
 void lockUnlockAccount();
 void calculateInterest();
 int findAccountByNumber(int accountNumber);
+int appendAccount(const Account* account, const AccountProfile* profile);
+int appendTransaction(const Transaction* transaction);
+int ensureChunkCapacity(void* chunks[], int* chunkCount, size_t recordSize, long long count);
+int ensureAccountCapacity(long long count);
+int ensureTransactionCapacity(long long count);
+size_t accountIndexBucket(int accountNumber, size_t capacity);
+void accountIndexInsert(AccountIndex* index, int accountNumber, int slot);
+int accountIndexFind(const AccountIndex* index, int accountNumber);
+void accountIndexClear(AccountIndex* index);
+void rebuildAccountIndex();
+uint64_t nextBalanceEpoch();
+void setBalance(int accountIndex, double balance, uint64_t epoch);
+void pinBalanceSnapshot(BalanceSnapshot* snapshot);
+void releaseBalanceSnapshot(BalanceSnapshot* snapshot);
+double snapshotBalance(BalanceSnapshot* snapshot, int accountIndex);
+void adjustAggregates(int accountIndex, int sign);
+void countAggregates(int accountIndex, int sign);
+int compareBalanceEntries(const void* a, const void* b);
+int balanceEntryBefore(const BalanceEntry* a, const BalanceEntry* b);
+int balanceStripeFind(const BalanceStripe* stripe, const BalanceEntry* key);
+void balanceIndexInsert(int accountIndex);
+void balanceIndexRemove(int accountIndex);
+void closeBalanceHole(BalanceStripe* stripe);
+int queryBalanceIndex(double low, double high, int descending, int limit, BalanceEntry** out);
+void balanceCursorSiftDown(BalanceCursor* heap, int size, int i, int descending);
+void balanceRankingReport();
+void rebuildAggregates();
+int interestQueueReserve(InterestQueue* queue, size_t size);
+void interestQueueSiftDown(InterestQueue* queue, size_t i);
+int interestQueuePush(InterestQueue* queue, time_t due, int slot);
+void scheduleInterest(int accountIndex);
+void rebuildInterestSchedule();
+int runDueInterest(time_t now, int verbose);
+void foldName(char* out, const char* name, size_t size);
+NameIndexEntry* nameIndexEntry(NameIndex* index, uint32_t trigram, int create);
+void nameIndexAdd(int accountIndex);
+void nameIndexRemove(int accountIndex);
+void rebuildNameIndex();
+int findAccountsByName(const char* query, NameMatch** matches);
+int compareNameMatches(const void* a, const void* b);
+void initializeLocks();
+void beginSharedAccess();
+void endSharedAccess();
+void beginExclusiveAccess();
+void endExclusiveAccess();
+void lockAccount(int accountIndex);
+void unlockAccount(int accountIndex);
+void lockAccountPair(int firstIndex, int secondIndex);
+void unlockAccountPair(int firstIndex, int secondIndex);
+void* stressWorker(void* arg);
+void* stressAuditor(void* arg);
+void runStressTest(int maxThreads, long operations, int accounts);
+int parseBenchMix(const char* text, int weights[BENCH_OP_COUNT]);
+int runBenchOperation(BenchOperation op, uint64_t* rng);
+void addBenchAccounts(int target);
+int runBenchmark(int accounts, long operations, const char* mix, const char* jsonPath);
+int compareFloats(const void* a, const void* b);
+int runServer(const char* address, int threads);
+void runLoadGenerator(const char* address, int connections, int requests, int threads);
+#ifdef __linux__
+void handleServerSignal(int sig);
+int resolveServerAddress(const char* address, struct sockaddr_storage* storage, socklen_t* length);
+void sessionReply(ServerSession* session, const char* format, ...);
+void handleSessionCommand(ServerSession* session, char* line);
+void closeSession(int epollFd, ServerSession* session);
+int flushSession(int epollFd, ServerSession* session);
+int readSession(ServerSession* session);
+void* serverLoop(void* arg);
+int connectToServer(const char* address);
+int loadRequest(int fd, const char* request, char* reply, size_t size);
+void* loadWorker(void* arg);
+void loadSendNext(LoadWorker* w, LoadConnection* c);
+void* replicationMain(void* arg);
+int sendReplication(ReplicationFollower* follower);
+void dropFollower(int index, const char* reason);
+void* followMain(void* arg);
+void applyFollowBatch(char* data, size_t length);
+int applyReplicatedRecord(const char* line, uint64_t epoch);
+void advanceFollowedLedger();
+void trimFollowedLedger();
+#endif
+int startReplication(const char* address);
+void shipReplication();
+void stopReplication();
+int runFollower(const char* primary, const char* address, int threads);
+int replicationAppend(char** data, size_t* length, size_t* capacity, const char* bytes, size_t count);
+void lockCheckpointFiles();
+void unlockCheckpointFiles();
+double nowSeconds();
+uint64_t nowNanoseconds();
+int64_t wallMicroseconds();
+int latencyBucket(uint64_t nanoseconds);
+uint64_t latencyBucketLimit(int bucket);
+int recordOperation(MetricOperation op, int result, uint64_t start);
+void collectMetrics(MetricShard* total);
+double metricQuantile(const uint64_t* buckets, uint64_t count, double q);
+void writeMetrics(FILE* out);
+void showMetrics();
+uint64_t nextRandom(uint64_t* state);
+void benchmarkLookup();
 int authenticateAdmin();
 void displayTransactionHistory(int accountNumber);
+int displayTransactionHistoryPage(int accountNumber, int cursor, int pageSize);
+int formatHistoryEntry(char* out, size_t size, const Transaction* t);
+void rebuildTransactionChains();
+int archivedChainHead(int head, int archived);
+void noteTransactionTime(int slot, time_t timestamp);
+void rebuildTimeIndex();
+int findTransactionRange(time_t from, time_t to, int* first, int* last);
+int rollupDay(time_t timestamp);
+int rollupTransaction(int accountIndex, const Transaction* t, int sign);
+int foldRollup(int account, int* head, double base, int period, int type, double amount, int incoming, int sign);
+double rollupClosing(const Rollup* r);
+void rebuildRollups();
+void restoreRollupHeads();
+Rollup* collectRollups(int accountIndex, int monthly, int from, int to, int limit, int* count, double* opening);
+int formatRollupPeriod(char* out, size_t size, int period, int monthly);
+int parseReportDate(const char* text, int endOfDay, time_t* out);
+void printTransactionReport(int accountNumber, time_t from, time_t to);
+int printReportRow(int slot, time_t from, time_t to);
+void accountStatement(int accountNumber);
+void printStatement(int accountNumber, int monthly, time_t from, time_t to);
 void clearInputBuffer();
 void printAccountDetails(int accountIndex);
+int formatFullName(char* out, size_t size, int accountIndex);
 void listAllAccounts();
 void generateReports();
-void createTransaction(int accountNumber, const char* type, double amount, int relatedAccount, const char* description);
+int exportCsv(ExportTable table, const char* path, int threads);
+void* csvExportWorker(void* arg);
+int formatCsvBlock(CsvExport* job, int first, int last, ExportBuffer* out, TimestampCache* cache);
+char* formatInteger(char* out, long long value);
+char* formatMoney(char* out, double value);
+char* formatTimestamp(char* out, time_t value, TimestampCache* cache);
+char* formatCsvText(char* out, const char* text);
+int exportColumnar(const char* path);
+size_t fillLedgerColumn(int column, int first, int count, unsigned char* out);
+int defaultExportThreads();
+void createTransaction(int accountNumber, TransactionType type, double amount, int relatedAccount, const char* description);
+int internString(const char* text);
+int stringTableFind(const StringTable* table, const char* text, uint64_t hash);
+void stringTableInsert(StringTable* table, int id, uint64_t hash);
+uint64_t hashString(const char* text);
+const char* transactionTypeName(int type);
+int transactionTypeFromName(const char* name);
 void printWelcomeScreen();
 void changePassword();
 int validatePassword(const char* password);
@@ -84,15 +1072,176 @@ void searchAccount();
 void accountStatistics();
 void printHelp();
 int validateTransaction(int accountIndex, double amount);
+int checkTransaction(int accountIndex, double amount);
+int parseVelocityRule(const char* text);
+void advanceVelocityWindow(VelocityWindow* window, int64_t bucket);
+void addVelocity(int accountIndex, int scope, double amount, time_t when);
+int chargeVelocity(int accountIndex, int scope, double amount);
+void rebuildVelocity();
+const char* transactionResultMessage(int result);
+int applyDeposit(int accountIndex, double amount);
+int applyWithdrawal(int accountIndex, double amount);
+int applyTransfer(int fromIndex, int toIndex, double amount);
+int applyInterest(int accountIndex, time_t now, double* interestOut);
+char* nextBatchToken(char** cursor);
+int parseBatchAccount(const char* token, int* accountIndex);
+int parseBatchAmount(const char* token, double* amount);
+int applyBatchLine(char* line);
+int applyBatchFile(const char* path);
+void openJournal();
+void journalAccount(int accountIndex);
+void journalTransaction(const Transaction* t);
+void journalAppend(const char* record, int length);
+int writeJournalBuffer(const char* data, size_t length);
+int flushJournal();
+void noteJournalWritten(uint64_t lsn, int written);
+int waitForDurable(uint64_t lsn);
+int rotateJournal();
+void backgroundCheckpoint();
+void* persistenceMain(void* arg);
+void startPersistence();
+void stopPersistence();
+int replayJournalFile(const char* path, int checkpointTransactions);
+int parseAccountRecord(const char* line, Account* a, AccountProfile* profile);
+int parseTransactionRecord(const char* line, Transaction* t, char* description);
+int parseGlobalOptions(int argc, char* argv[]);
+int commitChanges();
+int checkpointDue();
+void replayJournal();
+
+const char* benchOperationNames[BENCH_OP_COUNT] = {"deposit", "withdraw", "transfer", "history", "search"};
+const char* metricOperationNames[METRIC_OPERATION_COUNT] = {
+    "login", "deposit", "withdraw", "transfer", "interest", "balance", "history", "statement", "save", "checkpoint", "load"
+};
+const char* metricReasonNames[TXN_RESULT_COUNT] = {
+    "ok", "not_found", "inactive", "locked", "insufficient_funds", "invalid_amount",
+    "same_account", "not_eligible", "bad_command", "skipped", "bad_password", "velocity_limit",
+    "save_failed"
+};
+
+int main(int argc, char *argv[]) {
+    initializeLocks();
+    argc = parseGlobalOptions(argc, argv);
+
+    if (argc == 3 && strcmp(argv[1], "--import-text") == 0) {
+        createAdminAccounts();
+        if (importTextData(argv[2]) != 1) {
+            printf(" Import of '%s' failed.\n", argv[2]);
+            return 1;
+        }
+        rebuildAccountIndex();
+        rebuildTransactionChains();
+        // The checkpoint stores the rollups, which loads then trust.
+        rebuildRollups();
+        openJournal();
+        saveData();
+        return 0;
+    }
+    if (argc == 3 && strcmp(argv[1], "--export-text") == 0) {
+        createAdminAccounts();
+        loadData();
+        return exportTextData(argv[2]) ? 0 : 1;
+    }
+    if (argc == 3 && strcmp(argv[1], "--apply") == 0) {
+        createAdminAccounts();
+        loadData();
+        return applyBatchFile(argv[2]) ? 0 : 1;
+    }
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "--stress") == 0) {
+        runStressTest(atoi(argv[2]), atol(argv[3]), argc == 5 ? atoi(argv[4]) : 100000);
+        return 0;
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--serve") == 0) {
+        createAdminAccounts();
+        loadData();
+        openJournal();
+        if (replicationAddress != NULL) startReplication(replicationAddress);
+        startPersistence();
+        int ok = runServer(argv[2], argc == 4 ? atoi(argv[3]) : 2);
+        stopPersistence();
+        stopReplication();
+        saveData();
+        return ok ? 0 : 1;
+    }
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "--follow") == 0) {
+        createAdminAccounts();
+        return runFollower(argv[2], argv[3], argc == 5 ? atoi(argv[4]) : 2) ? 0 : 1;
+    }
+    if ((argc == 5 || argc == 6) && strcmp(argv[1], "--loadgen") == 0) {
+        runLoadGenerator(argv[2], atoi(argv[3]), atoi(argv[4]), argc == 6 ? atoi(argv[5]) : 2);
+        return 0;
+    }
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "--export-csv") == 0 &&
+        (strcmp(argv[2], "accounts") == 0 || strcmp(argv[2], "transactions") == 0)) {
+        createAdminAccounts();
+        loadData();
+        return exportCsv(argv[2][0] == 'a' ? EXPORT_ACCOUNTS : EXPORT_TRANSACTIONS, argv[3],
+                         argc == 5 ? atoi(argv[4]) : defaultExportThreads()) ? 0 : 1;
+    }
+    if (argc == 3 && strcmp(argv[1], "--export-columns") == 0) {
+        createAdminAccounts();
+        loadData();
+        return exportColumnar(argv[2]) ? 0 : 1;
+    }
+    if (argc >= 4 && argc <= 6 && strcmp(argv[1], "--bench") == 0) {
+        createAdminAccounts();
+        return runBenchmark(atoi(argv[2]), atol(argv[3]), argc >= 5 ? argv[4] : NULL,
+                            argc == 6 ? argv[5] : BENCH_DIR ".json") ? 0 : 1;
+    }
+    if (argc == 2 && strcmp(argv[1], "--bench-lookup") == 0) {
+        benchmarkLookup();
+        return 0;
+    }
+    if (argc != 1) {
+        printf("Usage: %s [--loss-window MS] [--durable-ack] [--ledger-window ROWS] [--replicate ADDRESS]\n"
+               "        [--velocity [withdraw-|transfer-]amount|count:LIMIT/WINDOW[s|m|h|d]]...\n"
+               "        [--apply FILE | --import-text FILE | --export-text FILE |\n"
+               "        --export-csv accounts|transactions FILE [THREADS] | --export-columns FILE |\n"
+               "        --serve ADDRESS [THREADS] | --follow PRIMARY ADDRESS [THREADS] |\n"
+               "        --loadgen ADDRESS CONNECTIONS REQUESTS [THREADS] |\n"
+               "        --bench ACCOUNTS OPS [MIX] [JSON_FILE] | --bench-lookup |\n"
+               "        --stress THREADS OPS [ACCOUNTS]]\n", argv[0]);
+        return 1;
+    }
 
-int main() {
     printWelcomeScreen();
     initializeSystem();
     loadData();
+    openJournal();
+    if (replicationAddress != NULL) startReplication(replicationAddress);
+    startPersistence();
     mainMenu();
+    stopPersistence();
+    stopReplication();
+    saveData();
     return 0;
 }
 
+// Strips the persistence options, which apply to every mode, and returns the
+// remaining argument count.
+int parseGlobalOptions(int argc, char* argv[]) {
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--loss-window") == 0 && i + 1 < argc) {
+            persistIntervalMs = atoi(argv[++i]);
+            if (persistIntervalMs < 1) persistIntervalMs = 1;
+        } else if (strcmp(argv[i], "--durable-ack") == 0) {
+            durableAck = 1;
+        } else if (strcmp(argv[i], "--ledger-window") == 0 && i + 1 < argc) {
+            ledgerWindow = atoi(argv[++i]);
+            if (ledgerWindow < 0) ledgerWindow = 0;
+        } else if (strcmp(argv[i], "--replicate") == 0 && i + 1 < argc) {
+            replicationAddress = argv[++i];
+        } else if (strcmp(argv[i], "--velocity") == 0 && i + 1 < argc && parseVelocityRule(argv[i + 1])) {
+            i++;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argv[kept] = NULL;
+    return kept;
+}
+
 void printWelcomeScreen() {
     printf("\n\n");
     printf("\n");
@@ -136,12 +1285,13 @@ void createAdminAccounts() {
 }
 
 void registerAccount() {
-    if (accountCount >= MAX_ACCOUNTS) {
+    if (accountCount >= MAX_RECORDS) {
         printf(" Maximum account limit reached.\n");
         return;
     }
 
     Account newAccount;
+    AccountProfile newProfile;
     printf("\n--- Register New Account ---\n");
 
     printf("Enter desired account number: ");
@@ -157,21 +1307,21 @@ void registerAccount() {
     }
 
     printf("First Name: ");
-    fgets(newAccount.firstName, sizeof(newAccount.firstName), stdin);
-    newAccount.firstName[strcspn(newAccount.firstName, "\n")] = 0;
-    while (strlen(newAccount.firstName) == 0) {
+    fgets(newProfile.firstName, sizeof(newProfile.firstName), stdin);
+    newProfile.firstName[strcspn(newProfile.firstName, "\n")] = 0;
+    while (strlen(newProfile.firstName) == 0) {
         printf(" First name cannot be empty! Please enter first name: ");
-        fgets(newAccount.firstName, sizeof(newAccount.firstName), stdin);
-        newAccount.firstName[strcspn(newAccount.firstName, "\n")] = 0;
+        fgets(newProfile.firstName, sizeof(newProfile.firstName), stdin);
+        newProfile.firstName[strcspn(newProfile.firstName, "\n")] = 0;
     }
 
     printf("Last Name: ");
-    fgets(newAccount.lastName, sizeof(newAccount.lastName), stdin);
-    newAccount.lastName[strcspn(newAccount.lastName, "\n")] = 0;
-    while (strlen(newAccount.lastName) == 0) {
+    fgets(newProfile.lastName, sizeof(newProfile.lastName), stdin);
+    newProfile.lastName[strcspn(newProfile.lastName, "\n")] = 0;
+    while (strlen(newProfile.lastName) == 0) {
         printf(" Last name cannot be empty! Please enter last name: ");
-        fgets(newAccount.lastName, sizeof(newAccount.lastName), stdin);
-        newAccount.lastName[strcspn(newAccount.lastName, "\n")] = 0;
+        fgets(newProfile.lastName, sizeof(newProfile.lastName), stdin);
+        newProfile.lastName[strcspn(newProfile.lastName, "\n")] = 0;
     }
 
     printf("Initial Deposit: ");
@@ -189,60 +1339,99 @@ void registerAccount() {
     clearInputBuffer();
 
     printf("Set Password: ");
-    fgets(newAccount.password, sizeof(newAccount.password), stdin);
-    newAccount.password[strcspn(newAccount.password, "\n")] = 0;
-    while (!validatePassword(newAccount.password)) {
+    fgets(newProfile.password, sizeof(newProfile.password), stdin);
+    newProfile.password[strcspn(newProfile.password, "\n")] = 0;
+    while (!validatePassword(newProfile.password)) {
         printf(" Password must be at least 6 characters with at least one number.\n");
         printf("Set Password: ");
-        fgets(newAccount.password, sizeof(newAccount.password), stdin);
-        newAccount.password[strcspn(newAccount.password, "\n")] = 0;
+        fgets(newProfile.password, sizeof(newProfile.password), stdin);
+        newProfile.password[strcspn(newProfile.password, "\n")] = 0;
     }
 
     newAccount.isActive = 1;
     newAccount.isLocked = 0;
     newAccount.lastInterestDate = time(NULL);
 
-    accounts[accountCount++] = newAccount;
+    // Registration changes the account tables, so it runs with exclusive access.
+    beginExclusiveAccess();
+    int accIndex = -1;
+    if (findAccountByNumber(newAccount.accountNumber) == -1) {
+        accIndex = appendAccount(&newAccount, &newProfile);
+    }
+    if (accIndex != -1) {
+        journalAccount(accIndex);
+        createTransaction(newAccount.accountNumber, TXN_TYPE_ACCOUNT_OPEN, newAccount.balance, 0, "Initial deposit");
+    }
+    endExclusiveAccess();
+
+    if (accIndex == -1) {
+        printf(" Error: Account %d could not be created.\n", newAccount.accountNumber);
+        return;
+    }
 
     printf("\n Account created successfully!\n");
     printf("==========================================\n");
     printf("Account Number: %d\n", newAccount.accountNumber);
-    printf("Account Holder: %s %s\n", newAccount.firstName, newAccount.lastName);
+    printf("Account Holder: %s %s\n", newProfile.firstName, newProfile.lastName);
     printf("Account Type: %s\n", newAccount.isSavings ? "Savings" : "Current");
     printf("Current Balance: %.2f\n", newAccount.balance);
     printf("==========================================\n");
     printf(" Please save your account number and password for future login!\n");
-
-    createTransaction(newAccount.accountNumber, "Account Open", newAccount.balance, 0, "Initial deposit");
-    saveData();
+    commitChanges();
 }
 
 void displayTransactionHistory(int accountNumber) {
     printf("\n--- Transaction History for Account %d ---\n", accountNumber);
 
-    int found = 0;
-    for (int i = transactionCount - 1; i >= 0; i--) {
-        if (transactions[i].accountNumber == accountNumber) {
-            char dateStr[50];
-            strftime(dateStr, sizeof(dateStr), "%Y-%m-%d %H:%M:%S", localtime(&transactions[i].timestamp));
-
-            printf("[%s] %s: %.2f", dateStr, transactions[i].type, transactions[i].amount);
-            if (transactions[i].relatedAccount != 0) {
-                printf(" (Account %d)", transactions[i].relatedAccount);
-            }
-            if (strlen(transactions[i].description) > 0) {
-                printf(" - %s", transactions[i].description);
-            }
-            printf("\n");
-            found = 1;
+    int accIndex = findAccountByNumber(accountNumber);
+    int cursor = accIndex != -1 ? accountAt(accIndex)->lastTransaction : -1;
+    if (cursor == -1) {
+        printf("No transactions found.\n");
+        return;
+    }
+
+    while ((cursor = displayTransactionHistoryPage(accountNumber, cursor, HISTORY_PAGE_SIZE)) != -1) {
+        printf("\n Show older transactions? (y/n): ");
+        char more;
+        if (scanf("%c", &more) != 1) more = 'n';
+        clearInputBuffer();
+        if (more != 'y' && more != 'Y') break;
+    }
+}
 
-            if (found >= 10) break;
+// Prints up to pageSize entries walking the account's history chain from
+// cursor, and returns the cursor for the next (older) page or -1 at the end.
+int displayTransactionHistoryPage(int accountNumber, int cursor, int pageSize) {
+    uint64_t start = nowNanoseconds();
+    for (int shown = 0; cursor != -1 && shown < pageSize; shown++) {
+        Transaction *t = transactionAt(cursor);
+        if (t->accountNumber != accountNumber) {
+            cursor = -1;
+            break;
         }
+
+        char line[256];
+        formatHistoryEntry(line, sizeof(line), t);
+        printf("%s\n", line);
+
+        cursor = t->previousForAccount;
     }
+    recordOperation(METRIC_HISTORY, TXN_OK, start);
+    return cursor;
+}
 
-    if (!found) {
-        printf("No transactions found.\n");
+int formatHistoryEntry(char* out, size_t size, const Transaction* t) {
+    char dateStr[50];
+    strftime(dateStr, sizeof(dateStr), "%Y-%m-%d %H:%M:%S", localtime(&t->timestamp));
+
+    int length = snprintf(out, size, "[%s] %s: %.2f", dateStr, transactionTypeName(t->type), t->amount);
+    if (t->relatedAccount != 0 && length < (int)size) {
+        length += snprintf(out + length, size - length, " (Account %d)", t->relatedAccount);
     }
+    if (stringAt(t->description)[0] != '\0' && length < (int)size) {
+        length += snprintf(out + length, size - length, " - %s", stringAt(t->description));
+    }
+    return length;
 }
 
 void lockUnlockAccount() {
@@ -264,40 +1453,158 @@ void lockUnlockAccount() {
 
     printAccountDetails(accIndex);
     printf("\n Do you want to %s this account? (y/n): ",
-          accounts[accIndex].isLocked ? "unlock" : "lock");
+          accountAt(accIndex)->isLocked ? "unlock" : "lock");
 
     char confirm;
     if (scanf("%c", &confirm) != 1) confirm = 'n';
     clearInputBuffer();
 
     if (confirm == 'y' || confirm == 'Y') {
-        accounts[accIndex].isLocked = !accounts[accIndex].isLocked;
-        printf(" Account %s successfully.\n", accounts[accIndex].isLocked ? "locked" : "unlocked");
+        beginSharedAccess();
+        lockAccount(accIndex);
+        adjustAggregates(accIndex, -1);
+        accountAt(accIndex)->isLocked = !accountAt(accIndex)->isLocked;
+        adjustAggregates(accIndex, 1);
+        int isLocked = accountAt(accIndex)->isLocked;
 
         char desc[100];
-        snprintf(desc, sizeof(desc), "Account %s by admin", accounts[accIndex].isLocked ? "locked" : "unlocked");
-        createTransaction(accNum, "Account Status", 0, 0, desc);
-        saveData();
+        snprintf(desc, sizeof(desc), "Account %s by admin", isLocked ? "locked" : "unlocked");
+        journalAccount(accIndex);
+        createTransaction(accNum, TXN_TYPE_ACCOUNT_STATUS, 0, 0, desc);
+        scheduleInterest(accIndex);
+        unlockAccount(accIndex);
+        endSharedAccess();
+
+        printf(" Account %s successfully.\n", isLocked ? "locked" : "unlocked");
+        commitChanges();
     }
 }
 
-void createTransaction(int accountNumber, const char* type, double amount, int relatedAccount, const char* description) {
-    if (transactionCount >= MAX_TRANSACTIONS) return;
-
+void createTransaction(int accountNumber, TransactionType type, double amount, int relatedAccount, const char* description) {
     Transaction t;
-    t.transactionId = transactionCount + 1;
+    t.transactionId = 0;
     t.accountNumber = accountNumber;
-    strncpy(t.type, type, sizeof(t.type) - 1);
-    t.type[sizeof(t.type) - 1] = '\0';
+    t.type = type;
     t.amount = amount;
     t.timestamp = time(NULL);
     t.relatedAccount = relatedAccount;
-    strncpy(t.description, description, sizeof(t.description) - 1);
-    t.description[sizeof(t.description) - 1] = '\0';
+    t.description = internString(description);
+    if (t.description == -1) {
+        printf(" CRITICAL ERROR: Cannot record transaction (out of memory)!\n");
+        return;
+    }
+
+    int slot = appendTransaction(&t);
+    if (slot == -1) {
+        printf(" CRITICAL ERROR: Cannot record transaction (out of memory)!\n");
+        return;
+    }
+    journalTransaction(transactionAt(slot));
+}
+
+// Returns the pool id of text, adding it if it is new, or -1 when out of
+// memory. Texts longer than a description are truncated first so the pool
+// holds exactly what the journal and text formats can carry.
+int internString(const char* text) {
+    char truncated[MAX_DESCRIPTION_LENGTH];
+    if (strlen(text) >= sizeof(truncated)) {
+        snprintf(truncated, sizeof(truncated), "%.*s", MAX_DESCRIPTION_LENGTH - 1, text);
+        text = truncated;
+    }
+    uint64_t hash = hashString(text);
+
+    StringTable *table = __atomic_load_n(&stringTable, __ATOMIC_ACQUIRE);
+    int id = table != NULL ? stringTableFind(table, text, hash) : -1;
+    if (id != -1) return id;
+
+    pthread_mutex_lock(&stringPoolLock);
+    table = stringTable;
+    id = table != NULL ? stringTableFind(table, text, hash) : -1;
+    if (id != -1) {
+        pthread_mutex_unlock(&stringPoolLock);
+        return id;
+    }
+
+    if (table == NULL || (size_t)(stringCount + 1) * 2 > table->capacity) {
+        StringTable *grown = malloc(sizeof(StringTable));
+        size_t capacity = table != NULL ? table->capacity * 2 : 1024;
+        int *slots = calloc(capacity, sizeof(int));
+        if (grown == NULL || slots == NULL) {
+            free(grown);
+            free(slots);
+            pthread_mutex_unlock(&stringPoolLock);
+            return -1;
+        }
+        grown->slots = slots;
+        grown->capacity = capacity;
+        for (int i = 0; i < stringCount; i++) stringTableInsert(grown, i, hashString(stringAt(i)));
+        __atomic_store_n(&stringTable, grown, __ATOMIC_RELEASE);
+        table = grown;
+    }
+
+    size_t length = strlen(text) + 1;
+    if (length > stringArenaFree) {
+        stringArena = malloc(1 << 16);
+        stringArenaFree = stringArena != NULL ? 1 << 16 : 0;
+    }
+    if (stringArena == NULL || !ensureChunkCapacity(stringChunks, &stringChunkCount, sizeof(char*), stringCount + 1LL)) {
+        pthread_mutex_unlock(&stringPoolLock);
+        return -1;
+    }
+    memcpy(stringArena, text, length);
+    ((const char**)stringChunks[stringCount >> CHUNK_SHIFT])[stringCount & (CHUNK_SIZE - 1)] = stringArena;
+    stringArena += length;
+    stringArenaFree -= length;
+
+    id = stringCount;
+    stringTableInsert(table, id, hash);
+    __atomic_store_n(&stringCount, id + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&stringPoolLock);
+    return id;
+}
+
+int stringTableFind(const StringTable* table, const char* text, uint64_t hash) {
+    size_t mask = table->capacity - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        int slot = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+        if (slot == 0) return -1;
+        if (strcmp(stringAt(slot - 1), text) == 0) return slot - 1;
+    }
+}
+
+void stringTableInsert(StringTable* table, int id, uint64_t hash) {
+    size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+    while (table->slots[i] != 0) i = (i + 1) & mask;
+    __atomic_store_n(&table->slots[i], id + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t hashString(const char* text) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char *c = (const unsigned char*)text; *c; c++) {
+        hash = (hash ^ *c) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+const char* transactionTypeName(int type) {
+    return type >= 0 && type < TXN_TYPE_COUNT ? transactionTypeNames[type] : transactionTypeNames[TXN_TYPE_OTHER];
+}
+
+int transactionTypeFromName(const char* name) {
+    for (int i = 0; i < TXN_TYPE_COUNT; i++) {
+        if (strcmp(transactionTypeNames[i], name) == 0) return i;
+    }
+    return TXN_TYPE_OTHER;
+}
 
-    transactions[transactionCount++] = t;
+// Both names fit a buffer of MAX_NAME_LENGTH * 2 whole.
+int formatFullName(char* out, size_t size, int accountIndex) {
+    return snprintf(out, size, "%s %s", profileAt(accountIndex)->firstName, profileAt(accountIndex)->lastName);
 }
 
+// Balances come from a pinned snapshot, so the listing never shows a transfer
+// half done and customers are not held up while it prints.
 void listAllAccounts() {
     printf("\n--- All Accounts ---\n");
     if (accountCount == 0) {
@@ -308,18 +1615,21 @@ void listAllAccounts() {
     printf("%-10s %-20s %-10s %-10s %-8s\n", "Account", "Name", "Balance", "Type", "Status");
     printf("----------------------------------------------------------------\n");
 
-    for (int i = 0; i < accountCount; i++) {
-        if (accounts[i].isActive) {
-            char fullName[50];
-            snprintf(fullName, sizeof(fullName), "%s %s", accounts[i].firstName, accounts[i].lastName);
+    BalanceSnapshot snapshot;
+    pinBalanceSnapshot(&snapshot);
+    for (int i = 0; i < snapshot.accounts; i++) {
+        if (accountAt(i)->isActive) {
+            char fullName[MAX_NAME_LENGTH * 2];
+            formatFullName(fullName, sizeof(fullName), i);
             printf("%-10d %-20s %-10.2f %-10s %-8s\n",
-                  accounts[i].accountNumber,
+                  accountAt(i)->accountNumber,
                   fullName,
-                  accounts[i].balance,
-                  accounts[i].isSavings ? "Savings" : "Current",
-                  accounts[i].isLocked ? "Locked" : "Active");
+                  snapshotBalance(&snapshot, i),
+                  accountAt(i)->isSavings ? "Savings" : "Current",
+                  accountAt(i)->isLocked ? "Locked" : "Active");
         }
     }
+    releaseBalanceSnapshot(&snapshot);
 }
 
 void changePassword() {
@@ -330,7 +1640,7 @@ void changePassword() {
     fgets(current, sizeof(current), stdin);
     current[strcspn(current, "\n")] = 0;
 
-    if (strcmp(accounts[currentUserAccount].password, current) != 0) {
+    if (strcmp(profileAt(currentUserAccount)->password, current) != 0) {
         printf(" Incorrect current password.\n");
         return;
     }
@@ -357,10 +1667,16 @@ void changePassword() {
         return;
     }
 
-    strcpy(accounts[currentUserAccount].password, newPass);
+    beginSharedAccess();
+    lockAccount(currentUserAccount);
+    strcpy(profileAt(currentUserAccount)->password, newPass);
+    journalAccount(currentUserAccount);
+    createTransaction(accountAt(currentUserAccount)->accountNumber, TXN_TYPE_SECURITY, 0, 0, "Password changed");
+    unlockAccount(currentUserAccount);
+    endSharedAccess();
+
     printf(" Password changed successfully.\n");
-    createTransaction(accounts[currentUserAccount].accountNumber, "Security", 0, 0, "Password changed");
-    saveData();
+    commitChanges();
 }
 
 void accountStatistics() {
@@ -369,14 +1685,58 @@ void accountStatistics() {
     int activeCount = 0, lockedCount = 0, savingsCount = 0;
     double totalBalance = 0;
 
+    // Exclusive access gives a consistent view across stripes, since a
+    // transfer may be updating two of them.
+    beginExclusiveAccess();
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        activeCount += stripeAggregates[i].active;
+        lockedCount += stripeAggregates[i].locked;
+        savingsCount += stripeAggregates[i].savings;
+        totalBalance += stripeAggregates[i].balance;
+    }
+
+#ifdef BANK_DEBUG_STATS
+    int checkActive = 0, checkLocked = 0, checkSavings = 0;
+    double checkBalance = 0;
     for (int i = 0; i < accountCount; i++) {
-        if (accounts[i].isActive) {
-            activeCount++;
-            totalBalance += accounts[i].balance;
-            if (accounts[i].isLocked) lockedCount++;
-            if (accounts[i].isSavings) savingsCount++;
+        if (accountAt(i)->isActive) {
+            checkActive++;
+            checkBalance += accountAt(i)->balance;
+            if (accountAt(i)->isLocked) checkLocked++;
+            if (accountAt(i)->isSavings) checkSavings++;
+        }
+    }
+    double drift = checkBalance - totalBalance;
+    if (checkActive != activeCount || checkLocked != lockedCount || checkSavings != savingsCount ||
+        drift > 0.005 || drift < -0.005) {
+        printf(" DEBUG: statistics drifted! Counters: %d/%d/%d %.2f, recomputed: %d/%d/%d %.2f\n",
+               activeCount, lockedCount, savingsCount, totalBalance,
+               checkActive, checkLocked, checkSavings, checkBalance);
+    } else {
+        printf(" DEBUG: statistics counters match a full recompute.\n");
+    }
+
+    int indexed = 0, misplaced = 0;
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        BalanceStripe *stripe = &balanceStripes[i];
+        closeBalanceHole(stripe);
+        indexed += stripe->size;
+        for (int j = 0; j < stripe->size; j++) {
+            const BalanceEntry *e = &stripe->entries[j];
+            if (e->balance != accountAt(e->slot)->balance || !accountAt(e->slot)->isActive ||
+                (j > 0 && !balanceEntryBefore(&stripe->entries[j - 1], e))) {
+                misplaced++;
+            }
         }
     }
+    if (indexed != checkActive || misplaced > 0) {
+        printf(" DEBUG: balance index drifted! %d entries for %d active accounts, %d misplaced\n",
+               indexed, checkActive, misplaced);
+    } else {
+        printf(" DEBUG: balance index matches the accounts.\n");
+    }
+#endif
+    endExclusiveAccess();
 
     printf("==========================================\n");
     printf(" SYSTEM STATISTICS\n");
@@ -408,6 +1768,7 @@ void printHelp() {
     printf("• Transfer: Send money to another account\n");
     printf("• Balance Inquiry: Check your current balance\n");
     printf("• Transaction History: View your recent transactions\n");
+    printf("• Account Statement: Daily or monthly totals and balances\n");
     printf("• Change Password: Update your account password\n");
 
     printf("\n ADMIN FEATURES:\n");
@@ -415,8 +1776,8 @@ void printHelp() {
     printf("• Update Account: Modify existing account details\n");
     printf("• Delete Account: Deactivate customer accounts\n");
     printf("• Lock/Unlock: Restrict or restore account access\n");
-    printf("• Reports: Generate account and transaction reports\n");
-    printf("• Interest: Calculate monthly interest for savings\n");
+    printf("• Reports: Account, balance ranking, transaction and statement reports\n");
+    printf("• Interest: Pay monthly interest on savings now (also paid automatically)\n");
     printf("• Statistics: View comprehensive system statistics\n");
 
     printf("\n SECURITY FEATURES:\n");
@@ -430,8 +1791,11 @@ void printHelp() {
     printf("• Username: manager, Password: bank456\n");
 
     printf("\n DATA PERSISTENCE:\n");
-    printf("• All data is automatically saved to '%s'\n", DATA_FILE);
-    printf("• Automatic backups are created on exit\n");
+    printf("• Every change is written to '%s' within %d ms\n", JOURNAL_FILE, persistIntervalMs);
+    printf("• Use --loss-window MS to change this, or --durable-ack to wait for the disk\n");
+    printf("• The journal is folded into '%s' in the background and on exit\n", SNAPSHOT_FILE);
+    printf("• Ledger entries older than the newest %d are sealed into 'bank_archive_*.bin'\n", ledgerWindow);
+    printf("• Use --export-text/--import-text to convert to/from '%s'\n", DATA_FILE);
     printf("• Data persists between program runs\n");
 
     printf("\n SUPPORT:\n");
@@ -482,29 +1846,34 @@ void searchAccount() {
                 fgets(name, sizeof(name), stdin);
                 name[strcspn(name, "\n")] = 0;
 
-                printf("\nSearch Results:\n");
-                int found = 0;
-                for (int i = 0; i < accountCount; i++) {
-                    char firstName[MAX_NAME_LENGTH], lastName[MAX_NAME_LENGTH], searchName[MAX_NAME_LENGTH];
-                    strcpy(firstName, accounts[i].firstName);
-                    strcpy(lastName, accounts[i].lastName);
-                    strcpy(searchName, name);
-
-
-                    for (int j = 0; firstName[j]; j++) firstName[j] = tolower(firstName[j]);
-                    for (int j = 0; lastName[j]; j++) lastName[j] = tolower(lastName[j]);
-                    for (int j = 0; searchName[j]; j++) searchName[j] = tolower(searchName[j]);
-
-                    if (strstr(firstName, searchName) || strstr(lastName, searchName)) {
-                        printAccountDetails(i);
-                        printf("------------------------\n");
-                        found = 1;
-                    }
+                NameMatch *matches = NULL;
+                beginSharedAccess();
+                int found = findAccountsByName(name, &matches);
+                endSharedAccess();
+                if (found == -1) {
+                    printf(" Not enough memory to search.\n");
+                    break;
                 }
-
-                if (!found) {
+                if (found == 0) {
                     printf(" No accounts found matching '%s'\n", name);
+                    free(matches);
+                    break;
+                }
+
+                // Exact name matches come first, then prefix matches, then the rest.
+                printf("\nSearch Results (%d found):\n", found);
+                for (int shown = 0; shown < found; shown++) {
+                    printAccountDetails(matches[shown].slot);
+                    printf("------------------------\n");
+                    if ((shown + 1) % SEARCH_PAGE_SIZE == 0 && shown + 1 < found) {
+                        printf("Showing %d of %d. Show more results? (y/n): ", shown + 1, found);
+                        char more;
+                        if (scanf("%c", &more) != 1) more = 'n';
+                        clearInputBuffer();
+                        if (more != 'y' && more != 'Y') break;
+                    }
                 }
+                free(matches);
                 break;
             }
             case 3:
@@ -518,54 +1887,577 @@ void searchAccount() {
 
 
 void loadData() {
-    FILE *file = fopen(DATA_FILE, "r");
-    if (file == NULL) {
-        printf(" No existing data file found. Starting fresh...\n");
-        return;
-    }
+    uint64_t start = nowNanoseconds();
+    loadSnapshot();
+    rebuildAccountIndex();
+    rebuildTransactionChains();
+    replayJournal();
+    rebuildNameIndex();
+    rebuildTimeIndex();
+    rebuildVelocity();
+    rebuildRollups();
+    rebuildAggregates();
+    rebuildInterestSchedule();
+    recordOperation(METRIC_LOAD, TXN_OK, start);
+}
 
+void loadSnapshot() {
+    int result = loadBinarySnapshot(SNAPSHOT_FILE);
+    if (result == 1) return;
 
-    if (fscanf(file, "%d %d %d\n", &accountCount, &transactionCount, &adminCount) != 3) {
-        printf(" Error reading data header. Starting fresh...\n");
-        fclose(file);
-        accountCount = transactionCount = 0;
-        return;
+    // The text file may be far older than the journal, which only covers the
+    // time since the last checkpoint, so it is no substitute for a damaged
+    // snapshot. The snapshot is left in place for repair.
+    if (result == -1) {
+        printf(" CRITICAL ERROR: Snapshot '%s' could not be loaded; refusing to start from older data.\n", SNAPSHOT_FILE);
+        exit(1);
     }
 
-
-    for (int i = 0; i < accountCount; i++) {
-        if (fscanf(file, "%d|%49[^|]|%49[^|]|%lf|%d|%d|%d|%ld|%49[^\n]\n",
-                   &accounts[i].accountNumber,
-                   accounts[i].firstName,
-                   accounts[i].lastName,
-                   &accounts[i].balance,
-                   &accounts[i].isActive,
-                   &accounts[i].isLocked,
-                   &accounts[i].isSavings,
-                   &accounts[i].lastInterestDate,
-                   accounts[i].password) != 9) {
-            printf(" Error loading account %d. Stopping load...\n", i+1);
-            accountCount = i;
-            break;
-        }
+    // No binary snapshot yet: fall back to the legacy text format.
+    if (importTextData(DATA_FILE) == 0) {
+        printf(" No existing data file found. Starting fresh...\n");
     }
+}
 
-
-    for (int i = 0; i < transactionCount; i++) {
-        char description[100];
-        if (fscanf(file, "%d|%d|%19[^|]|%lf|%ld|%d|%99[^\n]\n",
-                   &transactions[i].transactionId,
-                   &transactions[i].accountNumber,
-                   transactions[i].type,
-                   &transactions[i].amount,
-                   &transactions[i].timestamp,
-                   &transactions[i].relatedAccount,
-                   description) != 7) {
-            printf(" Error loading transaction %d. Stopping load...\n", i+1);
-            transactionCount = i;
-            break;
-        }
-        strcpy(transactions[i].description, description);
+uint64_t snapshotChecksum(uint64_t hash, const void* data, size_t length) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Maps a whole file read-only; Windows reads it into memory instead. Returns 1
+// on success, 0 when the file does not exist and -1 when it cannot be read.
+int mapFile(const char* path, const unsigned char** data, size_t* size) {
+#ifdef _WIN32
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return 0;
+    fseek(file, 0, SEEK_END);
+    *size = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char *buffer = malloc(*size ? *size : 1);
+    if (buffer == NULL || fread(buffer, 1, *size, file) != *size) {
+        printf(" Error reading '%s'.\n", path);
+        free(buffer);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    *data = buffer;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    *size = (size_t)st.st_size;
+    void *mapping = *size > 0 ? mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        printf(" Error mapping '%s'.\n", path);
+        return -1;
+    }
+    madvise(mapping, *size, MADV_SEQUENTIAL);
+    *data = mapping;
+#endif
+    return 1;
+}
+
+void unmapFile(const unsigned char* data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    free((void*)data);
+#else
+    munmap((void*)data, size);
+#endif
+}
+
+void readDiskAccount(int index, const DiskAccount* record) {
+    Account *a = accountAt(index);
+    AccountProfile *profile = profileAt(index);
+    a->accountNumber = record->accountNumber;
+    a->balance = record->balance;
+    a->isActive = record->isActive;
+    a->isLocked = record->isLocked;
+    a->isSavings = record->isSavings;
+    a->lastInterestDate = (time_t)record->lastInterestDate;
+    snprintf(profile->firstName, sizeof(profile->firstName), "%.*s", MAX_NAME_LENGTH - 1, record->firstName);
+    snprintf(profile->lastName, sizeof(profile->lastName), "%.*s", MAX_NAME_LENGTH - 1, record->lastName);
+    snprintf(profile->password, sizeof(profile->password), "%.*s", 49, record->password);
+}
+
+void fillDiskAccount(DiskAccount* record, const Account* a, const AccountProfile* profile) {
+    memset(record, 0, sizeof(*record));
+    record->accountNumber = a->accountNumber;
+    record->balance = a->balance;
+    record->isActive = a->isActive;
+    record->isLocked = a->isLocked;
+    record->isSavings = a->isSavings;
+    record->lastInterestDate = a->lastInterestDate;
+    snprintf(record->firstName, sizeof(record->firstName), "%s", profile->firstName);
+    snprintf(record->lastName, sizeof(record->lastName), "%s", profile->lastName);
+    snprintf(record->password, sizeof(record->password), "%s", profile->password);
+}
+
+// Decodes a version 2 or later ledger row into slot index. Returns 0 when its
+// description is not one of the strings loaded with it.
+int readDiskTransaction(int index, const DiskTransaction* record, const int* stringIds, uint64_t strings) {
+    if (record->description < 0 || (uint64_t)record->description >= strings) return 0;
+    Transaction *t = transactionAt(index);
+    t->transactionId = record->transactionId;
+    t->accountNumber = record->accountNumber;
+    t->amount = record->amount;
+    t->timestamp = (time_t)record->timestamp;
+    t->relatedAccount = record->relatedAccount;
+    t->type = record->type >= 0 && record->type < TXN_TYPE_COUNT ? record->type : TXN_TYPE_OTHER;
+    t->description = stringIds[record->description];
+    return 1;
+}
+
+// Returns 1 when the snapshot was loaded, 0 when there is none and -1 when it
+// exists but fails validation.
+int loadBinarySnapshot(const char* path) {
+    const unsigned char *data;
+    size_t size;
+    int mapped = mapFile(path, &data, &size);
+    if (mapped != 1) return mapped;
+
+    int result = -1;
+    int *stringIds = NULL;
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    if (size < SNAPSHOT_V1_HEADER_SIZE) {
+        printf(" Error: snapshot '%s' is truncated.\n", path);
+        goto done;
+    }
+    memcpy(&header, data, SNAPSHOT_V1_HEADER_SIZE);
+
+    // Version 1 snapshots kept type and description text inline in each row;
+    // they are still accepted and interned on load.
+    int version = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 ? (int)header.version : 0;
+    if (version == SNAPSHOT_VERSION && header.headerSize == sizeof(header) && size >= sizeof(header)) {
+        memcpy(&header, data, sizeof(header));
+    } else if (version == 4 && header.headerSize == SNAPSHOT_V4_HEADER_SIZE && size >= SNAPSHOT_V4_HEADER_SIZE) {
+        memcpy(&header, data, SNAPSHOT_V4_HEADER_SIZE);
+    } else if (version == 3 && header.headerSize == SNAPSHOT_V3_HEADER_SIZE && size >= SNAPSHOT_V3_HEADER_SIZE) {
+        memcpy(&header, data, SNAPSHOT_V3_HEADER_SIZE);
+    } else if (version == 2 && header.headerSize == SNAPSHOT_V2_HEADER_SIZE && size >= SNAPSHOT_V2_HEADER_SIZE) {
+        memcpy(&header, data, SNAPSHOT_V2_HEADER_SIZE);
+    } else if (version != 1 || header.headerSize != SNAPSHOT_V1_HEADER_SIZE) {
+        printf(" Error: '%s' is not a version %d snapshot.\n", path, SNAPSHOT_VERSION);
+        goto done;
+    }
+    if (header.accountCount > MAX_RECORDS || header.transactionCount > MAX_RECORDS ||
+        header.adminCount > 5 || header.stringCount > MAX_RECORDS ||
+        header.stringBytes > (uint64_t)MAX_RECORDS * MAX_DESCRIPTION_LENGTH || header.stringBytes % 8 != 0 ||
+        header.archivedTransactions > header.transactionCount || header.archivedTransactions % CHUNK_SIZE != 0 ||
+        (version >= 4 && (header.shardSize != SHARD_SIZE ||
+         header.ledgerFirst > header.archivedTransactions || header.ledgerFirst % CHUNK_SIZE != 0)) ||
+        header.rollupCount > MAX_RECORDS || header.rollupRecords > 2ULL * MAX_RECORDS) {
+        printf(" Error: snapshot '%s' exceeds system limits.\n", path);
+        goto done;
+    }
+
+    // Version 3 stores only the rows after the archive, and ends with each
+    // account's newest archived row, padded to a multiple of 8 bytes. Version
+    // 4 keeps only the admins here and the rest in separate parts, to which
+    // version 5 adds the statement rollups.
+    size_t archived = header.archivedTransactions;
+    size_t transactionSize = version == 1 ? sizeof(DiskTransactionV1) : sizeof(DiskTransaction);
+    size_t headBytes = version == 3 ? ((header.accountCount + 1) & ~1ULL) * sizeof(int32_t) : 0;
+    size_t inlineAccounts = version >= 4 ? 0 : header.accountCount;
+    size_t inlineRows = version >= 4 ? 0 : header.transactionCount - archived;
+    size_t inlineStrings = version >= 4 ? 0 : header.stringBytes;
+    size_t payloadSize = inlineAccounts * sizeof(DiskAccount) + inlineRows * transactionSize +
+                         header.adminCount * sizeof(DiskAdmin) + inlineStrings + headBytes;
+    if (size != header.headerSize + payloadSize) {
+        printf(" Error: snapshot '%s' has the wrong size.\n", path);
+        goto done;
+    }
+
+    const unsigned char *payload = data + header.headerSize;
+    if (snapshotChecksum(0xcbf29ce484222325ULL, payload, payloadSize) != header.checksum) {
+        printf(" Error: snapshot '%s' failed checksum validation.\n", path);
+        goto done;
+    }
+
+    if (!ensureAccountCapacity(header.accountCount) || !ensureTransactionCapacity(header.transactionCount)) {
+        printf(" Error: Not enough memory to load snapshot '%s'.\n", path);
+        goto done;
+    }
+
+    const DiskAccount *diskAccounts = (const DiskAccount*)payload;
+    const unsigned char *diskTransactions = (const unsigned char*)(diskAccounts + inlineAccounts);
+    const DiskAdmin *diskAdmins = (const DiskAdmin*)(diskTransactions + inlineRows * transactionSize);
+    if (version >= 4) {
+        if (loadSnapshotParts(&header) != 1) goto done;
+    } else {
+        // The string section is interned first; ids are remapped in case the
+        // pool already holds some of the texts.
+        const unsigned char *strings = (const unsigned char*)(diskAdmins + header.adminCount);
+        stringIds = malloc((header.stringCount ? header.stringCount : 1) * sizeof(int));
+        if (stringIds == NULL) {
+            printf(" Error: Not enough memory to load snapshot '%s'.\n", path);
+            goto done;
+        }
+        size_t offset = 0;
+        for (size_t i = 0; i < header.stringCount; i++) {
+            const unsigned char *end = memchr(strings + offset, '\0', header.stringBytes - offset);
+            if (end == NULL) {
+                printf(" Error: snapshot '%s' has a malformed string section.\n", path);
+                goto done;
+            }
+            stringIds[i] = internString((const char*)strings + offset);
+            if (stringIds[i] == -1) {
+                printf(" Error: Not enough memory to load snapshot '%s'.\n", path);
+                goto done;
+            }
+            offset = end - strings + 1;
+        }
+
+        for (size_t i = 0; i < header.accountCount; i++) readDiskAccount(i, diskAccounts + i);
+
+        if (archived > 0 && !mapArchive((int)archived)) {
+            printf(" CRITICAL ERROR: The ledger archive is incomplete; refusing to start without it.\n");
+            exit(1);
+        }
+        if (headBytes > 0) {
+            const int32_t *heads = (const int32_t*)(strings + header.stringBytes);
+            for (size_t i = 0; i < header.accountCount; i++) {
+                if (heads[i] < -1 || heads[i] >= (int64_t)archived) {
+                    printf(" Error: snapshot '%s' has a bad history reference.\n", path);
+                    goto done;
+                }
+                accountAt(i)->lastTransaction = heads[i];
+            }
+        }
+
+        for (size_t i = 0; i < header.transactionCount - archived; i++) {
+            Transaction *t = transactionAt(archived + i);
+            if (version == 1) {
+                const DiskTransactionV1 *record = (const DiskTransactionV1*)diskTransactions + i;
+                char text[MAX_DESCRIPTION_LENGTH];
+                t->transactionId = record->transactionId;
+                t->accountNumber = record->accountNumber;
+                t->amount = record->amount;
+                t->timestamp = (time_t)record->timestamp;
+                t->relatedAccount = record->relatedAccount;
+                snprintf(text, sizeof(text), "%.*s", 19, record->type);
+                t->type = transactionTypeFromName(text);
+                snprintf(text, sizeof(text), "%.*s", 99, record->description);
+                t->description = internString(text);
+                if (t->description == -1) {
+                    printf(" Error: Not enough memory to load snapshot '%s'.\n", path);
+                    goto done;
+                }
+            } else if (!readDiskTransaction(archived + i, (const DiskTransaction*)diskTransactions + i,
+                                            stringIds, header.stringCount)) {
+                printf(" Error: snapshot '%s' has a bad description reference.\n", path);
+                goto done;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < header.adminCount; i++) {
+        snprintf(admins[i].username, sizeof(admins[i].username), "%.*s", 49, diskAdmins[i].username);
+        snprintf(admins[i].password, sizeof(admins[i].password), "%.*s", 49, diskAdmins[i].password);
+    }
+
+    accountCount = (int)header.accountCount;
+    transactionCount = (int)header.transactionCount;
+    archivedTransactions = (int)archived;
+    if (header.adminCount > 0) adminCount = (int)header.adminCount;
+    if (version >= 4) {
+        memset(shardDirty, 0, (accountCount + SHARD_SIZE - 1) >> SHARD_SHIFT);
+    } else {
+        resetCheckpointState();
+    }
+    printf(" Data loaded successfully. Accounts: %d, Transactions: %d\n", accountCount, transactionCount);
+    result = 1;
+
+done:
+    free(stringIds);
+    unmapFile(data, size);
+    return result;
+}
+
+// Maps a snapshot part and checks that its header matches and that
+// at least bytes of records follow it. Returns NULL, after saying why, if not.
+const PartHeader* mapPart(const char* path, const char* magic, uint32_t recordSize, uint64_t first, uint64_t bytes, size_t* size) {
+    const unsigned char *data;
+    int mapped = mapFile(path, &data, size);
+    if (mapped != 1) {
+        printf(" Error: Snapshot part '%s' is missing.\n", path);
+        return NULL;
+    }
+    const PartHeader *part = (const PartHeader*)data;
+    if (*size < sizeof(PartHeader) || *size - sizeof(PartHeader) < bytes ||
+        memcmp(part->magic, magic, sizeof(part->magic)) != 0 || part->version != 1 ||
+        part->recordSize != recordSize || part->first != first) {
+        printf(" Error: Snapshot part '%s' is damaged.\n", path);
+        unmapFile(data, *size);
+        return NULL;
+    }
+    return part;
+}
+
+// Loads the account shards, string pool, archived history heads and ledger
+// rows that a version 4 or 5 manifest commits, and the rollups of version 5.
+// Shards rewritten after the manifest may hold accounts it does not count
+// yet; those come back from the journal. Returns 1, or -1 when a part other
+// than the rollups is missing or fails validation.
+int loadSnapshotParts(const SnapshotHeader* header) {
+    const PartHeader *part = NULL;
+    size_t size = 0;
+    int *stringIds = NULL;
+    int result = -1;
+    char path[64];
+    size_t archived = header->archivedTransactions;
+
+    part = mapPart(STRINGS_FILE, STRINGS_MAGIC, 1, 0, header->stringBytes, &size);
+    if (part == NULL) return -1;
+    const unsigned char *strings = (const unsigned char*)(part + 1);
+    if (snapshotChecksum(0xcbf29ce484222325ULL, strings, header->stringBytes) != header->stringChecksum) {
+        printf(" Error: Snapshot part '%s' failed checksum validation.\n", STRINGS_FILE);
+        goto done;
+    }
+    stringIds = malloc((header->stringCount ? header->stringCount : 1) * sizeof(int));
+    if (stringIds == NULL) {
+        printf(" Error: Not enough memory to load snapshot part '%s'.\n", STRINGS_FILE);
+        goto done;
+    }
+    // Each text starts on an 8-byte boundary, so appends keep the checksum
+    // running a word at a time.
+    int pooled = 1;
+    size_t offset = 0;
+    for (size_t i = 0; i < header->stringCount; i++) {
+        const unsigned char *end = offset < header->stringBytes ?
+                                   memchr(strings + offset, '\0', header->stringBytes - offset) : NULL;
+        if (end == NULL) {
+            printf(" Error: Snapshot part '%s' is malformed.\n", STRINGS_FILE);
+            goto done;
+        }
+        stringIds[i] = internString((const char*)strings + offset);
+        if (stringIds[i] == -1) {
+            printf(" Error: Not enough memory to load snapshot part '%s'.\n", STRINGS_FILE);
+            goto done;
+        }
+        if (stringIds[i] != (int)i) pooled = 0;
+        offset = ((size_t)(end - strings) + 8) & ~(size_t)7;
+    }
+    unmapFile((const unsigned char*)part, size);
+
+    for (size_t first = 0; first < header->accountCount; first += SHARD_SIZE) {
+        size_t rows = header->accountCount - first < SHARD_SIZE ? header->accountCount - first : SHARD_SIZE;
+        snprintf(path, sizeof(path), SHARD_FILE, (int)(first >> SHARD_SHIFT));
+        part = mapPart(path, SHARD_MAGIC, sizeof(DiskAccount), first, rows * sizeof(DiskAccount), &size);
+        if (part == NULL) goto done;
+        const DiskAccount *records = (const DiskAccount*)(part + 1);
+        if (part->count < rows || part->count > SHARD_SIZE ||
+            size - sizeof(PartHeader) < part->count * sizeof(DiskAccount) ||
+            snapshotChecksum(0xcbf29ce484222325ULL, records, part->count * sizeof(DiskAccount)) != part->checksum) {
+            printf(" Error: Snapshot part '%s' failed checksum validation.\n", path);
+            goto done;
+        }
+        for (size_t i = 0; i < rows; i++) readDiskAccount(first + i, records + i);
+        unmapFile((const unsigned char*)part, size);
+    }
+    part = NULL;
+
+    if (archived > 0 && !mapArchive((int)archived)) {
+        printf(" CRITICAL ERROR: The ledger archive is incomplete; refusing to start without it.\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < header->accountCount; i++) accountAt(i)->lastTransaction = -1;
+    if (archived > 0) {
+        snprintf(path, sizeof(path), HEADS_FILE, (int)(archived >> CHUNK_SHIFT));
+        part = mapPart(path, HEADS_MAGIC, sizeof(int32_t), archived, 0, &size);
+        if (part == NULL) goto done;
+        const int32_t *heads = (const int32_t*)(part + 1);
+        size_t padded = (part->count + 1) & ~1ULL;
+        if (part->count > header->accountCount || size - sizeof(PartHeader) < padded * sizeof(int32_t) ||
+            snapshotChecksum(0xcbf29ce484222325ULL, heads, padded * sizeof(int32_t)) != part->checksum) {
+            printf(" Error: Snapshot part '%s' failed checksum validation.\n", path);
+            goto done;
+        }
+        for (size_t i = 0; i < part->count; i++) {
+            if (heads[i] < -1 || heads[i] >= (int64_t)archived) {
+                printf(" Error: Snapshot part '%s' has a bad history reference.\n", path);
+                goto done;
+            }
+            accountAt(i)->lastTransaction = heads[i];
+        }
+        unmapFile((const unsigned char*)part, size);
+        part = NULL;
+    }
+
+    size_t rows = header->transactionCount - header->ledgerFirst;
+    snprintf(path, sizeof(path), LEDGER_FILE, (int)(header->ledgerFirst >> CHUNK_SHIFT));
+    part = mapPart(path, LEDGER_MAGIC, sizeof(DiskTransaction), header->ledgerFirst, rows * sizeof(DiskTransaction), &size);
+    if (part == NULL) goto done;
+    const DiskTransaction *records = (const DiskTransaction*)(part + 1);
+    if (snapshotChecksum(0xcbf29ce484222325ULL, records, rows * sizeof(DiskTransaction)) != header->ledgerChecksum) {
+        printf(" Error: Snapshot part '%s' failed checksum validation.\n", path);
+        goto done;
+    }
+    for (size_t i = archived; i < header->transactionCount; i++) {
+        if (!readDiskTransaction(i, records + (i - header->ledgerFirst), stringIds, header->stringCount)) {
+            printf(" Error: Snapshot part '%s' has a bad description reference.\n", path);
+            goto done;
+        }
+    }
+
+    // Rollups only save replaying the ledger, so without them it is replayed.
+    if (header->version >= 5 && !loadRollupLog(header)) {
+        printf(" WARNING: Rebuilding statement rollups from the ledger.\n");
+    }
+
+    // If the pool already held other texts the ids no longer match the files,
+    // so the next checkpoint writes the strings and ledger afresh.
+    checkpointState = *header;
+    if (!pooled) {
+        checkpointState.stringCount = 0;
+        checkpointState.stringBytes = 0;
+        checkpointState.stringChecksum = 0xcbf29ce484222325ULL;
+        checkpointState.ledgerFirst = UINT64_MAX;
+    }
+    result = 1;
+
+done:
+    free(stringIds);
+    if (part != NULL) unmapFile((const unsigned char*)part, size);
+    return result;
+}
+
+// Restores the rollup pool from the log a version 5 manifest commits; a later
+// copy of a slot replaces an earlier one. Returns 0, after saying why, if the
+// log is missing or damaged.
+int loadRollupLog(const SnapshotHeader* header) {
+    char path[64];
+    size_t size = 0;
+    snprintf(path, sizeof(path), ROLLUP_FILE, (int)header->rollupFile);
+    const PartHeader *part = mapPart(path, ROLLUP_MAGIC, sizeof(DiskRollup), header->rollupFile,
+                                     header->rollupRecords * sizeof(DiskRollup), &size);
+    if (part == NULL) return 0;
+    const DiskRollup *records = (const DiskRollup*)(part + 1);
+    int ok = snapshotChecksum(0xcbf29ce484222325ULL, records, header->rollupRecords * sizeof(DiskRollup)) ==
+             header->rollupChecksum;
+    if (!ok) printf(" Error: Snapshot part '%s' failed checksum validation.\n", path);
+    if (ok && !ensureChunkCapacity(rollupChunks, &rollupChunkCount, sizeof(Rollup), header->rollupCount)) {
+        printf(" Error: Not enough memory to load snapshot part '%s'.\n", path);
+        ok = 0;
+    }
+    // A ledger always leaves rollups behind; a log without any was written
+    // by a checkpoint that never built them.
+    if (ok && header->rollupCount == 0 && header->transactionCount > 0) {
+        printf(" Error: Snapshot part '%s' has no rollups for the ledger.\n", path);
+        ok = 0;
+    }
+    int64_t slots = (int64_t)header->rollupCount;
+    for (uint64_t i = 0; ok && i < header->rollupRecords; i++) {
+        const DiskRollup *record = records + i;
+        if (record->slot < 0 || record->slot >= slots || record->previous < -1 || record->previous >= slots ||
+            record->account < 0 || (uint64_t)record->account >= header->accountCount) {
+            printf(" Error: Snapshot part '%s' has a bad rollup reference.\n", path);
+            ok = 0;
+            break;
+        }
+        Rollup *r = rollupAt(record->slot);
+        r->account = record->account;
+        r->period = record->period;
+        r->previous = record->previous;
+        r->opening = record->opening;
+        r->deposits = record->deposits;
+        r->withdrawals = record->withdrawals;
+        r->transfersIn = record->transfersIn;
+        r->transfersOut = record->transfersOut;
+        r->interest = record->interest;
+        r->entries = record->entries;
+        r->depositCount = record->depositCount;
+        r->withdrawalCount = record->withdrawalCount;
+        r->transferInCount = record->transferInCount;
+        r->transferOutCount = record->transferOutCount;
+        r->interestCount = record->interestCount;
+    }
+    unmapFile((const unsigned char*)part, size);
+    if (!ok) return 0;
+
+    rollupCount = (int)header->rollupCount;
+    restoredRollups = rollupCount;
+    restoredRollupRows = (int)header->transactionCount;
+    return 1;
+}
+
+// Forgets what the last checkpoint wrote, so the next one writes every part
+// afresh. Used whenever the tables did not come from a version 4 or 5
+// snapshot.
+void resetCheckpointState() {
+    memset(&checkpointState, 0, sizeof(checkpointState));
+    checkpointState.ledgerFirst = UINT64_MAX;
+    checkpointState.stringChecksum = 0xcbf29ce484222325ULL;
+    memset(shardDirty, 1, sizeof(shardDirty));
+}
+
+// Returns 1 when the file was imported, 0 when it does not exist and -1 on a
+// malformed header.
+int importTextData(const char* path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+
+
+    if (fscanf(file, "%d %d %d\n", &accountCount, &transactionCount, &adminCount) != 3 ||
+        accountCount < 0 || transactionCount < 0 || adminCount < 0 || adminCount > 5 ||
+        !ensureAccountCapacity(accountCount) || !ensureTransactionCapacity(transactionCount)) {
+        printf(" Error reading data header. Starting fresh...\n");
+        fclose(file);
+        accountCount = transactionCount = 0;
+        createAdminAccounts();
+        return -1;
+    }
+
+
+    for (int i = 0; i < accountCount; i++) {
+        accountAt(i)->lastTransaction = -1;
+        if (fscanf(file, "%d|%49[^|]|%49[^|]|%lf|%d|%d|%d|%ld|%49[^\n]\n",
+                   &accountAt(i)->accountNumber,
+                   profileAt(i)->firstName,
+                   profileAt(i)->lastName,
+                   &accountAt(i)->balance,
+                   &accountAt(i)->isActive,
+                   &accountAt(i)->isLocked,
+                   &accountAt(i)->isSavings,
+                   &accountAt(i)->lastInterestDate,
+                   profileAt(i)->password) != 9) {
+            printf(" Error loading account %d. Stopping load...\n", i+1);
+            accountCount = i;
+            break;
+        }
+    }
+
+
+    for (int i = 0; i < transactionCount; i++) {
+        char type[20], description[MAX_DESCRIPTION_LENGTH];
+        if (fscanf(file, "%d|%d|%19[^|]|%lf|%ld|%d|%99[^\n]\n",
+                   &transactionAt(i)->transactionId,
+                   &transactionAt(i)->accountNumber,
+                   type,
+                   &transactionAt(i)->amount,
+                   &transactionAt(i)->timestamp,
+                   &transactionAt(i)->relatedAccount,
+                   description) != 7 ||
+            (transactionAt(i)->description = internString(description)) == -1) {
+            printf(" Error loading transaction %d. Stopping load...\n", i+1);
+            transactionCount = i;
+            break;
+        }
+        transactionAt(i)->type = transactionTypeFromName(type);
     }
 
 
@@ -578,7 +2470,9 @@ void loadData() {
     }
 
     fclose(file);
+    resetCheckpointState();
     printf(" Data loaded successfully. Accounts: %d, Transactions: %d\n", accountCount, transactionCount);
+    return 1;
 }
 
 
@@ -617,13 +2511,16 @@ void mainMenu() {
                 }
                 clearInputBuffer();
 
+                uint64_t start = nowNanoseconds();
                 int accIndex = findAccountByNumber(accNum);
                 if (accIndex != -1) {
-                    if (!accounts[accIndex].isActive) {
+                    if (!accountAt(accIndex)->isActive) {
+                        recordOperation(METRIC_LOGIN, TXN_INACTIVE, start);
                         printf(" Account is inactive. Please contact administrator.\n");
                         break;
                     }
-                    if (accounts[accIndex].isLocked) {
+                    if (accountAt(accIndex)->isLocked) {
+                        recordOperation(METRIC_LOGIN, TXN_LOCKED, start);
                         printf(" Account is locked. Please contact administrator.\n");
                         break;
                     }
@@ -633,15 +2530,20 @@ void mainMenu() {
                     fgets(password, sizeof(password), stdin);
                     password[strcspn(password, "\n")] = 0;
 
-                    if (strcmp(accounts[accIndex].password, password) == 0) {
+                    // The clock restarts so the time spent typing is not counted.
+                    start = nowNanoseconds();
+                    int matched = strcmp(profileAt(accIndex)->password, password) == 0;
+                    recordOperation(METRIC_LOGIN, matched ? TXN_OK : TXN_BAD_PASSWORD, start);
+                    if (matched) {
                         currentUserAccount = accIndex;
                         printf(" Login successful! Welcome, %s %s!\n",
-                               accounts[accIndex].firstName, accounts[accIndex].lastName);
+                               profileAt(accIndex)->firstName, profileAt(accIndex)->lastName);
                         customerMenu();
                     } else {
                         printf(" Invalid password.\n");
                     }
                 } else {
+                    recordOperation(METRIC_LOGIN, TXN_NOT_FOUND, start);
                     printf(" Account not found.\n");
                     printf(" Tip: Make sure you have registered an account first.\n");
                 }
@@ -684,7 +2586,8 @@ void adminMenu() {
         printf("7. View All Accounts\n");
         printf("8. Search Accounts\n");
         printf("9. Account Statistics\n");
-        printf("10. Back to Main Menu\n");
+        printf("10. Metrics\n");
+        printf("11. Back to Main Menu\n");
         printf("Enter your choice: ");
 
         if (scanf("%d", &choice) != 1) {
@@ -704,27 +2607,29 @@ void adminMenu() {
             case 7: listAllAccounts(); break;
             case 8: searchAccount(); break;
             case 9: accountStatistics(); break;
-            case 10: isAdminLoggedIn = 0; break;
+            case 10: showMetrics(); break;
+            case 11: isAdminLoggedIn = 0; break;
             default: printf(" Invalid choice. Please try again.\n");
         }
-    } while (choice != 10);
+    } while (choice != 11);
 }
 
 void customerMenu() {
     int choice;
     do {
         printf("\n===== Customer Menu =====\n");
-        printf("Welcome, %s %s!\n", accounts[currentUserAccount].firstName, accounts[currentUserAccount].lastName);
-        printf("Account Number: %d\n", accounts[currentUserAccount].accountNumber);
-        printf("Current Balance: %.2f\n\n", accounts[currentUserAccount].balance);
+        printf("Welcome, %s %s!\n", profileAt(currentUserAccount)->firstName, profileAt(currentUserAccount)->lastName);
+        printf("Account Number: %d\n", accountAt(currentUserAccount)->accountNumber);
+        printf("Current Balance: %.2f\n\n", accountAt(currentUserAccount)->balance);
 
         printf("1. Deposit\n");
         printf("2. Withdraw\n");
         printf("3. Transfer\n");
         printf("4. Balance Inquiry\n");
         printf("5. Transaction History\n");
-        printf("6. Change Password\n");
-        printf("7. Back to Main Menu\n");
+        printf("6. Account Statement\n");
+        printf("7. Change Password\n");
+        printf("8. Back to Main Menu\n");
         printf("Enter your choice: ");
 
         if (scanf("%d", &choice) != 1) {
@@ -739,12 +2644,13 @@ void customerMenu() {
             case 2: withdraw(); break;
             case 3: transfer(); break;
             case 4: balanceInquiry(); break;
-            case 5: displayTransactionHistory(accounts[currentUserAccount].accountNumber); break;
-            case 6: changePassword(); break;
-            case 7: currentUserAccount = -1; break;
+            case 5: displayTransactionHistory(accountAt(currentUserAccount)->accountNumber); break;
+            case 6: accountStatement(accountAt(currentUserAccount)->accountNumber); break;
+            case 7: changePassword(); break;
+            case 8: currentUserAccount = -1; break;
             default: printf(" Invalid choice. Please try again.\n");
         }
-    } while (choice != 7);
+    } while (choice != 8);
 }
 
 int authenticateAdmin() {
@@ -772,381 +2678,5202 @@ void clearInputBuffer() {
 }
 
 int findAccountByNumber(int accountNumber) {
-    for (int i = 0; i < accountCount; i++) {
-        if (accounts[i].accountNumber == accountNumber) {
-            return i;
-        }
-    }
-    return -1;
+    return accountIndexFind(&accountIndex, accountNumber);
 }
 
+int appendAccount(const Account* account, const AccountProfile* profile) {
+    if (!ensureAccountCapacity(accountCount + 1LL)) return -1;
+
+    *accountAt(accountCount) = *account;
+    *profileAt(accountCount) = *profile;
+    accountAt(accountCount)->lastTransaction = -1;
+    accountAt(accountCount)->olderBalance = -1;
+    accountAt(accountCount)->balanceEpoch = 0;
+    rollupHeadsAt(accountCount)->dailyRollup = -1;
+    rollupHeadsAt(accountCount)->monthlyRollup = -1;
+    rollupHeadsAt(accountCount)->rollupBase = 0;
+    accountIndexInsert(&accountIndex, account->accountNumber, accountCount);
+    nameIndexAdd(accountCount);
+    adjustAggregates(accountCount, 1);
+    markShardDirty(accountCount);
+    scheduleInterest(accountCount);
+    return accountCount++;
+}
 
-
-int validatePassword(const char* password) {
-    if (strlen(password) < 6) return 0;
-    for (int i = 0; password[i]; i++) {
-        if (isdigit(password[i])) return 1;
+// Claims the next ledger slot with a compare-and-swap, so concurrent callers
+// get distinct, gap-free transaction ids without a ledger-wide lock. The
+// caller must hold the lock of the transaction's account, which guards the
+// account's history chain.
+int appendTransaction(const Transaction* transaction) {
+    int slot = __atomic_load_n(&transactionCount, __ATOMIC_RELAXED);
+    do {
+        if (!ensureTransactionCapacity(slot + 1LL)) return -1;
+    } while (!__atomic_compare_exchange_n(&transactionCount, &slot, slot + 1, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    Transaction *t = transactionAt(slot);
+    *t = *transaction;
+    t->transactionId = slot + 1;
+    t->previousForAccount = -1;
+
+    // Thread the entry onto its account's history chain, newest first.
+    int accIndex = findAccountByNumber(t->accountNumber);
+    if (accIndex != -1) {
+        t->previousForAccount = accountAt(accIndex)->lastTransaction;
+        accountAt(accIndex)->lastTransaction = slot;
     }
-    return 0;
+    if (!rollupTransaction(accIndex, t, 1)) printf(" WARNING: Out of memory for statement rollups.\n");
+    noteTransactionTime(slot, t->timestamp);
+    return slot;
 }
-void saveData() {
-    if (accountCount == 0 && transactionCount == 0) {
-        printf("No data to save (no accounts or transactions created).\n");
-        return;
-    }
 
-    printf("💾 Saving data to '%s'...\n", DATA_FILE);
+void noteTransactionTime(int slot, time_t timestamp) {
+    int block = slot >> TIME_BLOCK_SHIFT;
+    int64_t value = timestamp;
+    int64_t seen = __atomic_load_n(&timeBlockMin[block], __ATOMIC_SEQ_CST);
+    int changed = 0;
+    while (value < seen && !(changed = __atomic_compare_exchange_n(&timeBlockMin[block], &seen, value, 0,
+                                                                   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)));
+    seen = __atomic_load_n(&timeBlockMax[block], __ATOMIC_SEQ_CST);
+    int raised = 0;
+    while (value > seen && !(raised = __atomic_compare_exchange_n(&timeBlockMax[block], &seen, value, 0,
+                                                                  __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)));
+    if ((changed || raised) && block < __atomic_load_n(&timeIndexedBlocks, __ATOMIC_SEQ_CST)) {
+        int dirty = __atomic_load_n(&timeDirtyBlock, __ATOMIC_SEQ_CST);
+        while (block < dirty && !__atomic_compare_exchange_n(&timeDirtyBlock, &dirty, block, 0,
+                                                             __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    }
+}
 
-    FILE *file = fopen(DATA_FILE, "w");
-    if (file == NULL) {
-        printf(" CRITICAL ERROR: Cannot create/write to '%s'!\n", DATA_FILE);
-        printf(" Possible solutions:\n");
-        printf(" 1. Run as administrator/sudo\n");
-        printf(" 2. Check folder write permissions\n");
-        printf(" 3. Try running from a different directory\n");
-        printf(" 4. Check if antivirus is blocking file creation\n");
-        return;
+// Archived blocks were filled in from their segment headers when mapped.
+void rebuildTimeIndex() {
+    for (int b = archivedTransactions >> TIME_BLOCK_SHIFT; b < TIME_BLOCKS; b++) {
+        timeBlockMin[b] = INT64_MAX;
+        timeBlockMax[b] = INT64_MIN;
     }
+    timeIndexedBlocks = 0;
+    timeDirtyBlock = INT32_MAX;
+    for (int i = archivedTransactions; i < transactionCount; i++) noteTransactionTime(i, transactionAt(i)->timestamp);
+}
 
+// Narrows the ledger to the rows that can be stamped within [from, to]: every
+// such row lies in [*first, *last), though rows inside still need checking.
+// Brings the derived arrays up to date first, which only touches blocks that
+// are new or changed since the last query. Returns the number of rows in the
+// slice.
+int findTransactionRange(time_t from, time_t to, int* first, int* last) {
+    int rows = __atomic_load_n(&transactionCount, __ATOMIC_ACQUIRE);
+    int blocks = (rows + (1 << TIME_BLOCK_SHIFT) - 1) >> TIME_BLOCK_SHIFT;
+
+    pthread_mutex_lock(&timeIndexLock);
+    // Publish the new coverage before reading the blocks, so an append either
+    // lands before the read or sees the coverage and marks its block dirty.
+    int covered = timeIndexedBlocks;
+    if (blocks < covered) blocks = covered;
+    __atomic_store_n(&timeIndexedBlocks, blocks, __ATOMIC_SEQ_CST);
+    int dirty = __atomic_exchange_n(&timeDirtyBlock, INT32_MAX, __ATOMIC_SEQ_CST);
+    int start = dirty < covered ? dirty : covered;
+
+    for (int b = start; b < blocks; b++) {
+        int64_t high = __atomic_load_n(&timeBlockMax[b], __ATOMIC_SEQ_CST);
+        timePrefixMax[b] = b > 0 && timePrefixMax[b - 1] > high ? timePrefixMax[b - 1] : high;
+    }
+    for (int b = blocks - 1; b >= 0; b--) {
+        int64_t low = __atomic_load_n(&timeBlockMin[b], __ATOMIC_SEQ_CST);
+        if (b + 1 < blocks && timeSuffixMin[b + 1] < low) low = timeSuffixMin[b + 1];
+        if (b < start && timeSuffixMin[b] == low) break;
+        timeSuffixMin[b] = low;
+    }
 
-    fprintf(file, "%d %d %d\n", accountCount, transactionCount, adminCount);
+    // First block whose prefix reaches from, last block whose suffix starts by to.
+    int lo = 0, hi = blocks;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (timePrefixMax[mid] >= (int64_t)from) hi = mid;
+        else lo = mid + 1;
+    }
+    int firstBlock = lo;
+    lo = firstBlock;
+    hi = blocks;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (timeSuffixMin[mid] <= (int64_t)to) lo = mid + 1;
+        else hi = mid;
+    }
+    pthread_mutex_unlock(&timeIndexLock);
 
+    *first = firstBlock << TIME_BLOCK_SHIFT;
+    *last = lo << TIME_BLOCK_SHIFT;
+    if (*last > rows) *last = rows;
+    if (*first > *last) *first = *last;
+    return *last - *first;
+}
 
+// Chains through archived rows were final when they were sealed, so each
+// account keeps its newest archived row and only the rows after the archive
+// are threaded again.
+void rebuildTransactionChains() {
     for (int i = 0; i < accountCount; i++) {
-        fprintf(file, "%d|%s|%s|%.2f|%d|%d|%d|%ld|%s\n",
-                accounts[i].accountNumber,
-                accounts[i].firstName,
-                accounts[i].lastName,
-                accounts[i].balance,
-                accounts[i].isActive,
-                accounts[i].isLocked,
-                accounts[i].isSavings,
-                accounts[i].lastInterestDate,
-                accounts[i].password);
+        accountAt(i)->lastTransaction = archivedChainHead(accountAt(i)->lastTransaction, archivedTransactions);
     }
+    for (int i = archivedTransactions; i < transactionCount; i++) {
+        Transaction *t = transactionAt(i);
+        int accIndex = findAccountByNumber(t->accountNumber);
+        t->previousForAccount = -1;
+        if (accIndex != -1) {
+            t->previousForAccount = accountAt(accIndex)->lastTransaction;
+            accountAt(accIndex)->lastTransaction = i;
+        }
+    }
+}
 
-
-    for (int i = 0; i < transactionCount; i++) {
-        fprintf(file, "%d|%d|%s|%.2f|%ld|%d|%s\n",
-                transactions[i].transactionId,
-                transactions[i].accountNumber,
-                transactions[i].type,
-                transactions[i].amount,
-                transactions[i].timestamp,
-                transactions[i].relatedAccount,
-                transactions[i].description);
+// Follows a history chain from head to its newest row below archived, or -1.
+// Links always point to older rows; anything else ends the walk.
+int archivedChainHead(int head, int archived) {
+    while (head >= archived) {
+        int previous = transactionAt(head)->previousForAccount;
+        head = previous < head ? previous : -1;
     }
+    return head;
+}
 
+// Returns the local calendar day of timestamp as YYYYMMDD. Each thread keeps
+// the bounds of the last day it looked up, so localtime() runs about once a
+// day per thread.
+int rollupDay(time_t timestamp) {
+    static _Thread_local time_t dayStart = 1, dayEnd = 0;
+    static _Thread_local int day = 0;
+    if (timestamp < dayStart || timestamp >= dayEnd) {
+        struct tm tm;
+#ifdef _WIN32
+        localtime_s(&tm, &timestamp);
+#else
+        localtime_r(&timestamp, &tm);
+#endif
+        day = (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+        tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+        tm.tm_isdst = -1;
+        dayStart = mktime(&tm);
+        tm.tm_mday++;
+        tm.tm_isdst = -1;
+        dayEnd = mktime(&tm);
+        if (dayStart > timestamp || dayEnd <= timestamp) dayStart = 1, dayEnd = 0;
+    }
+    return day;
+}
 
-    for (int i = 0; i < adminCount; i++) {
-        fprintf(file, "%s|%s\n", admins[i].username, admins[i].password);
+// Adds a ledger row to the daily and monthly rollups of its account, at
+// accountIndex, and of the receiving account for a transfer; a sign of -1
+// takes it out again. The caller holds the lock of every account involved.
+// Returns 0 when out of memory.
+int rollupTransaction(int accountIndex, const Transaction* t, int sign) {
+    int day = rollupDay(t->timestamp), ok = 1;
+    if (accountIndex != -1) {
+        RollupHeads *a = rollupHeadsAt(accountIndex);
+        ok &= foldRollup(accountIndex, &a->dailyRollup, a->rollupBase, day, t->type, t->amount, 0, sign);
+        ok &= foldRollup(accountIndex, &a->monthlyRollup, a->rollupBase, day / 100, t->type, t->amount, 0, sign);
     }
 
-    fclose(file);
-    printf(" SUCCESS: All data saved to '%s'\n", DATA_FILE);
-    printf(" Saved: %d accounts, %d transactions\n", accountCount, transactionCount);
+    int toIndex = t->type == TXN_TYPE_TRANSFER ? findAccountByNumber(t->relatedAccount) : -1;
+    if (toIndex != -1) {
+        RollupHeads *to = rollupHeadsAt(toIndex);
+        ok &= foldRollup(toIndex, &to->dailyRollup, to->rollupBase, day, t->type, t->amount, 1, sign);
+        ok &= foldRollup(toIndex, &to->monthlyRollup, to->rollupBase, day / 100, t->type, t->amount, 1, sign);
+    }
+    return ok;
 }
 
-void updateAccount() {
-    printf("\n--- Update Account ---\n");
-    printf("Enter account number to update: ");
-    int accNum;
-    if (scanf("%d", &accNum) != 1) {
-        printf(" Invalid account number!\n");
-        clearInputBuffer();
-        return;
+// Folds one row into the rollup for period on the chain at head, adding the
+// rollup if the account had no activity then. Rows nearly always land in the
+// newest period; one stamped earlier (the clock was set back) is filed under
+// its own period and carried into the openings of the periods after it.
+// Every slot changed is marked for the next checkpoint.
+int foldRollup(int account, int* head, double base, int period, int type, double amount, int incoming, int sign) {
+    int slot = *head, newer = -1;
+    while (slot != -1 && rollupAt(slot)->period > period) {
+        newer = slot;
+        slot = rollupAt(slot)->previous;
+    }
+    if (slot == -1 || rollupAt(slot)->period != period) {
+        int fresh = __atomic_fetch_add(&rollupCount, 1, __ATOMIC_RELAXED);
+        if (!ensureChunkCapacity(rollupChunks, &rollupChunkCount, sizeof(Rollup), fresh + 1LL)) return 0;
+        Rollup *r = rollupAt(fresh);
+        memset(r, 0, sizeof(*r));
+        r->account = account;
+        r->period = period;
+        r->previous = slot;
+        r->opening = slot != -1 ? rollupClosing(rollupAt(slot)) : base;
+        if (newer == -1) *head = fresh;
+        else rollupAt(newer)->previous = fresh;
+        slot = fresh;
     }
-    clearInputBuffer();
 
-    int accIndex = findAccountByNumber(accNum);
-    if (accIndex == -1) {
-        printf(" Account not found.\n");
-        return;
+    markRollupDirty(slot);
+    Rollup *r = rollupAt(slot);
+    double net = 0;
+    if (!incoming) r->entries += sign;
+    switch (type) {
+        case TXN_TYPE_ACCOUNT_OPEN:
+        case TXN_TYPE_DEPOSIT:
+            r->deposits += sign * amount;
+            r->depositCount += sign;
+            net = amount;
+            break;
+        case TXN_TYPE_WITHDRAWAL:
+            r->withdrawals += sign * amount;
+            r->withdrawalCount += sign;
+            net = -amount;
+            break;
+        case TXN_TYPE_TRANSFER:
+            if (incoming) {
+                r->transfersIn += sign * amount;
+                r->transferInCount += sign;
+                net = amount;
+            } else {
+                r->transfersOut += sign * amount;
+                r->transferOutCount += sign;
+                net = -amount;
+            }
+            break;
+        case TXN_TYPE_INTEREST:
+            r->interest += sign * amount;
+            r->interestCount += sign;
+            net = amount;
+            break;
+    }
+    for (int later = *head; later != slot; later = rollupAt(later)->previous) {
+        rollupAt(later)->opening += sign * net;
+        markRollupDirty(later);
     }
+    return 1;
+}
 
-    printf("\nCurrent Account Details:\n");
-    printAccountDetails(accIndex);
+double rollupClosing(const Rollup* r) {
+    return r->opening + r->deposits - r->withdrawals + r->transfersIn - r->transfersOut + r->interest;
+}
 
-    printf("\n Enter new first name (or press Enter to keep current): ");
-    char firstName[MAX_NAME_LENGTH];
-    fgets(firstName, sizeof(firstName), stdin);
-    if (strlen(firstName) > 1) {
-        firstName[strcspn(firstName, "\n")] = 0;
-        strcpy(accounts[accIndex].firstName, firstName);
+// Brings the rollups up to date with the loaded ledger. If the checkpoint
+// restored them only the rows after it are folded in; otherwise the whole
+// ledger, archived rows included, is replayed into fresh rollups. Accounts
+// whose rollups all start here are then shifted so the newest closing
+// matches the balance, which covers history from before this ledger.
+void rebuildRollups() {
+    int first = restoredRollupRows;
+    if (restoredRollups != -1) {
+        restoreRollupHeads();
+    } else {
+        rollupCount = 0;
+        restoredRollups = 0;
+        first = 0;
+        for (int i = 0; i < accountCount; i++) {
+            RollupHeads *a = rollupHeadsAt(i);
+            a->dailyRollup = a->monthlyRollup = -1;
+            a->rollupBase = 0;
+        }
+        // The slots are handed out afresh, so the next checkpoint starts a
+        // new rollup log.
+        checkpointState.rollupRecords = 0;
     }
-
-    printf(" Enter new last name (or press Enter to keep current): ");
-    char lastName[MAX_NAME_LENGTH];
-    fgets(lastName, sizeof(lastName), stdin);
-    if (strlen(lastName) > 1) {
-        lastName[strcspn(lastName, "\n")] = 0;
-        strcpy(accounts[accIndex].lastName, lastName);
+    for (int i = first; i < transactionCount; i++) {
+        Transaction *t = transactionAt(i);
+        if (t->transactionId == i + 1 && !rollupTransaction(findAccountByNumber(t->accountNumber), t, 1)) {
+            printf(" WARNING: Out of memory for statement rollups. Statements will be incomplete.\n");
+            break;
+        }
     }
-
-    printf(" Account updated successfully!\n");
-    createTransaction(accNum, "Account Update", 0, 0, "Account information modified");
-    saveData();
+    for (int i = 0; i < accountCount; i++) {
+        RollupHeads *a = rollupHeadsAt(i);
+        int slot = a->monthlyRollup;
+        while (slot >= restoredRollups) slot = rollupAt(slot)->previous;
+        if (slot != -1) continue;
+        a->rollupBase = accountAt(i)->balance - (a->monthlyRollup != -1 ? rollupClosing(rollupAt(a->monthlyRollup)) : 0);
+        if (a->rollupBase == 0) continue;
+        for (int slot = a->dailyRollup; slot != -1; slot = rollupAt(slot)->previous) rollupAt(slot)->opening += a->rollupBase;
+        for (int slot = a->monthlyRollup; slot != -1; slot = rollupAt(slot)->previous) rollupAt(slot)->opening += a->rollupBase;
+    }
+    restoredRollups = -1;
 }
 
-void deleteAccount() {
-    printf("\n--- Delete Account ---\n");
-    printf("Enter account number to delete: ");
-    int accNum;
-    if (scanf("%d", &accNum) != 1) {
-        printf(" Invalid account number!\n");
-        clearInputBuffer();
-        return;
+// Points each account's heads at the newest of its restored daily and
+// monthly rollups, and takes its base from the opening of the oldest.
+// loadSnapshotParts() has checked every slot's references.
+void restoreRollupHeads() {
+    for (int i = 0; i < accountCount; i++) {
+        RollupHeads *a = rollupHeadsAt(i);
+        a->dailyRollup = a->monthlyRollup = -1;
+        a->rollupBase = 0;
     }
-    clearInputBuffer();
+    for (int slot = 0; slot < restoredRollups; slot++) {
+        Rollup *r = rollupAt(slot);
+        RollupHeads *a = rollupHeadsAt(r->account);
+        // Days are numbered YYYYMMDD and months YYYYMM.
+        int *head = r->period > 999999 ? &a->dailyRollup : &a->monthlyRollup;
+        if (*head == -1 || rollupAt(*head)->period < r->period) *head = slot;
+        if (r->previous == -1) a->rollupBase = r->opening;
+    }
+}
 
-    int accIndex = findAccountByNumber(accNum);
-    if (accIndex == -1) {
-        printf(" Account not found.\n");
-        return;
+// Copies up to limit of the account's daily or monthly rollups for periods
+// within [from, to], newest first, into a new array the caller frees. Only
+// the periods from the newest back to from are visited. *opening is the
+// balance at the start of the range. Returns NULL when out of memory.
+Rollup* collectRollups(int accountIndex, int monthly, int from, int to, int limit, int* count, double* opening) {
+    int capacity = 16;
+    Rollup *rows = malloc(capacity * sizeof(Rollup));
+    if (rows == NULL) return NULL;
+
+    *count = 0;
+    lockAccount(accountIndex);
+    RollupHeads *a = rollupHeadsAt(accountIndex);
+    *opening = a->rollupBase;
+    for (int slot = monthly ? a->monthlyRollup : a->dailyRollup; slot != -1; slot = rollupAt(slot)->previous) {
+        Rollup *r = rollupAt(slot);
+        if (r->period > to) continue;
+        if (r->period < from || *count == limit) {
+            *opening = rollupClosing(r);
+            break;
+        }
+        if (*count == capacity) {
+            Rollup *grown = realloc(rows, capacity * 2 * sizeof(Rollup));
+            if (grown == NULL) {
+                unlockAccount(accountIndex);
+                free(rows);
+                return NULL;
+            }
+            rows = grown;
+            capacity *= 2;
+        }
+        rows[(*count)++] = *r;
+        *opening = r->opening;
     }
+    unlockAccount(accountIndex);
+    return rows;
+}
 
-    printAccountDetails(accIndex);
-    printf("\n Are you sure you want to delete this account? (y/n): ");
-    char confirm;
-    if (scanf("%c", &confirm) != 1) confirm = 'n';
-    clearInputBuffer();
+int formatRollupPeriod(char* out, size_t size, int period, int monthly) {
+    if (monthly) return snprintf(out, size, "%04d-%02d", period / 100, period % 100);
+    return snprintf(out, size, "%04d-%02d-%02d", period / 10000, period / 100 % 100, period % 100);
+}
 
-    if (confirm == 'y' || confirm == 'Y') {
-        accounts[accIndex].isActive = 0;
-        printf(" Account marked as inactive.\n");
-        createTransaction(accNum, "Account Close", 0, 0, "Account deactivated");
-        saveData();
-    } else {
-        printf(" Account deletion cancelled.\n");
+// Allocates chunks until the directory can hold count records. Existing
+// chunks are never touched, so growth copies nothing.
+int ensureChunkCapacity(void* chunks[], int* chunkCount, size_t recordSize, long long count) {
+    if (count > MAX_RECORDS) return 0;
+    if ((long long)__atomic_load_n(chunkCount, __ATOMIC_ACQUIRE) * CHUNK_SIZE >= count) return 1;
+
+    int ok = 1;
+    pthread_mutex_lock(&chunkLock);
+    while ((long long)*chunkCount * CHUNK_SIZE < count) {
+#ifdef _WIN32
+        void *chunk = calloc(CHUNK_SIZE, recordSize);
+#else
+        // Chunks are whole pages, so a ledger chunk can later be swapped in
+        // place for a mapping of its archive segment.
+        void *chunk = mmap(NULL, CHUNK_SIZE * recordSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED) chunk = NULL;
+#endif
+        if (chunk == NULL) {
+            ok = 0;
+            break;
+        }
+        chunks[*chunkCount] = chunk;
+        __atomic_store_n(chunkCount, *chunkCount + 1, __ATOMIC_RELEASE);
     }
+    pthread_mutex_unlock(&chunkLock);
+    return ok;
 }
 
-void deposit() {
-    printf("\n--- Deposit ---\n");
-    printf("Current Balance: %.2f\n", accounts[currentUserAccount].balance);
+int ensureAccountCapacity(long long count) {
+    return ensureChunkCapacity(accountChunks, &accountChunkCount, sizeof(Account), count) &&
+           ensureChunkCapacity(profileChunks, &profileChunkCount, sizeof(AccountProfile), count) &&
+           ensureChunkCapacity(rollupHeadChunks, &rollupHeadChunkCount, sizeof(RollupHeads), count) &&
+           (velocityRuleCount == 0 ||
+            ensureChunkCapacity(velocityChunks, &velocityChunkCount, velocityRuleCount * sizeof(VelocityWindow), count));
+}
+
+int ensureTransactionCapacity(long long count) {
+    return ensureChunkCapacity(transactionChunks, &transactionChunkCount, sizeof(Transaction), count);
+}
+
+size_t accountIndexBucket(int accountNumber, size_t capacity) {
+    return (size_t)(((uint32_t)accountNumber * 2654435769u) & (uint32_t)(capacity - 1));
+}
+
+void accountIndexInsert(AccountIndex* index, int accountNumber, int slot) {
+    // Keep the load factor at or below one half so probe chains stay short.
+    if ((index->size + 1) * 2 > index->capacity) {
+        size_t newCapacity = index->capacity ? index->capacity * 2 : 1024;
+        AccountIndexEntry *newEntries = malloc(newCapacity * sizeof(AccountIndexEntry));
+        if (newEntries == NULL) {
+            printf(" CRITICAL ERROR: Out of memory growing account index!\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < newCapacity; i++) newEntries[i].slot = -1;
+
+        for (size_t i = 0; i < index->capacity; i++) {
+            if (index->entries[i].slot == -1) continue;
+            size_t b = accountIndexBucket(index->entries[i].accountNumber, newCapacity);
+            while (newEntries[b].slot != -1) b = (b + 1) & (newCapacity - 1);
+            newEntries[b] = index->entries[i];
+        }
+        free(index->entries);
+        index->entries = newEntries;
+        index->capacity = newCapacity;
+    }
+
+    size_t b = accountIndexBucket(accountNumber, index->capacity);
+    while (index->entries[b].slot != -1) {
+        // Like the old linear scan, the first slot with a given number wins.
+        if (index->entries[b].accountNumber == accountNumber) return;
+        b = (b + 1) & (index->capacity - 1);
+    }
+    index->entries[b].accountNumber = accountNumber;
+    index->entries[b].slot = slot;
+    index->size++;
+}
+
+int accountIndexFind(const AccountIndex* index, int accountNumber) {
+    if (index->capacity == 0) return -1;
+
+    size_t b = accountIndexBucket(accountNumber, index->capacity);
+    while (index->entries[b].slot != -1) {
+        if (index->entries[b].accountNumber == accountNumber) {
+            return index->entries[b].slot;
+        }
+        b = (b + 1) & (index->capacity - 1);
+    }
+    return -1;
+}
+
+void accountIndexClear(AccountIndex* index) {
+    free(index->entries);
+    index->entries = NULL;
+    index->capacity = 0;
+    index->size = 0;
+}
+
+void initializeLocks() {
+    for (int i = 0; i < LOCK_STRIPES; i++) pthread_mutex_init(&accountLocks[i].mutex, NULL);
+    for (int i = 0; i < SHARED_SLOTS; i++) pthread_mutex_init(&sharedLocks[i].mutex, NULL);
+}
+
+// Shared access may nest; only the outermost call takes the slot lock.
+void beginSharedAccess() {
+    if (sharedDepth++ > 0) return;
+    if (sharedSlot == -1) {
+        sharedSlot = __atomic_fetch_add(&nextSharedSlot, 1, __ATOMIC_RELAXED) % SHARED_SLOTS;
+    }
+    pthread_mutex_lock(&sharedLocks[sharedSlot].mutex);
+}
+
+void endSharedAccess() {
+    if (--sharedDepth > 0) return;
+    pthread_mutex_unlock(&sharedLocks[sharedSlot].mutex);
+}
+
+void beginExclusiveAccess() {
+    for (int i = 0; i < SHARED_SLOTS; i++) pthread_mutex_lock(&sharedLocks[i].mutex);
+}
+
+void endExclusiveAccess() {
+    for (int i = SHARED_SLOTS - 1; i >= 0; i--) pthread_mutex_unlock(&sharedLocks[i].mutex);
+}
+
+void lockAccount(int accountIndex) {
+    pthread_mutex_lock(&accountLocks[accountIndex % LOCK_STRIPES].mutex);
+}
+
+void unlockAccount(int accountIndex) {
+    pthread_mutex_unlock(&accountLocks[accountIndex % LOCK_STRIPES].mutex);
+}
+
+// Stripes are always taken in ascending order, so two transfers running in
+// opposite directions cannot deadlock.
+void lockAccountPair(int firstIndex, int secondIndex) {
+    int a = firstIndex % LOCK_STRIPES, b = secondIndex % LOCK_STRIPES;
+    if (a == b) {
+        pthread_mutex_lock(&accountLocks[a].mutex);
+        return;
+    }
+    pthread_mutex_lock(&accountLocks[a < b ? a : b].mutex);
+    pthread_mutex_lock(&accountLocks[a < b ? b : a].mutex);
+}
+
+void unlockAccountPair(int firstIndex, int secondIndex) {
+    int a = firstIndex % LOCK_STRIPES, b = secondIndex % LOCK_STRIPES;
+    pthread_mutex_unlock(&accountLocks[a].mutex);
+    if (a != b) pthread_mutex_unlock(&accountLocks[b].mutex);
+}
+
+uint64_t nextBalanceEpoch() {
+    return __atomic_add_fetch(&balanceEpoch, 1, __ATOMIC_RELAXED);
+}
+
+// Stores a new balance committed at epoch. The caller holds the account's
+// stripe lock within shared access, so no snapshot is pinned meanwhile. The
+// epoch is published before the balance, which lets a reader that raced the
+// store notice the epoch moved and take the kept version instead.
+void setBalance(int accountIndex, double balance, uint64_t epoch) {
+    Account *a = accountAt(accountIndex);
+    if (__atomic_load_n(&pinnedSnapshots, __ATOMIC_RELAXED) > 0) {
+        int slot = __atomic_fetch_add(&versionCount, 1, __ATOMIC_RELAXED);
+        int older = -1;
+        if (ensureChunkCapacity(versionChunks, &versionChunkCount, sizeof(BalanceVersion), slot + 1LL)) {
+            BalanceVersion *v = versionAt(slot);
+            v->balance = a->balance;
+            v->epoch = a->balanceEpoch;
+            v->older = a->olderBalance;
+            older = slot;
+        }
+        __atomic_store_n(&a->olderBalance, older, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&a->balanceEpoch, epoch, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store(&a->balance, &balance, __ATOMIC_RELAXED);
+}
+
+void pinBalanceSnapshot(BalanceSnapshot* snapshot) {
+    beginExclusiveAccess();
+    if (__atomic_load_n(&pinnedSnapshots, __ATOMIC_ACQUIRE) == 0) versionCount = 0;
+    __atomic_add_fetch(&pinnedSnapshots, 1, __ATOMIC_RELAXED);
+    snapshot->epoch = balanceEpoch;
+    snapshot->accounts = accountCount;
+    snapshot->transactions = transactionCount;
+    snapshot->incomplete = 0;
+    endExclusiveAccess();
+}
+
+void releaseBalanceSnapshot(BalanceSnapshot* snapshot) {
+    __atomic_sub_fetch(&pinnedSnapshots, 1, __ATOMIC_RELEASE);
+    if (snapshot->incomplete) {
+        printf(" WARNING: Ran out of memory for balance versions; some balances are newer than the snapshot.\n");
+    }
+}
+
+// Reads an account's balance as of the snapshot, without its lock. A version
+// that could not be kept ends the chain early, and the current balance is
+// used in its place.
+double snapshotBalance(BalanceSnapshot* snapshot, int accountIndex) {
+    Account *a = accountAt(accountIndex);
+    double balance;
+    uint64_t epoch = __atomic_load_n(&a->balanceEpoch, __ATOMIC_ACQUIRE);
+    if (epoch <= snapshot->epoch) {
+        __atomic_load(&a->balance, &balance, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&a->balanceEpoch, __ATOMIC_ACQUIRE) == epoch) return balance;
+    }
+    for (int v = __atomic_load_n(&a->olderBalance, __ATOMIC_ACQUIRE); v != -1; v = versionAt(v)->older) {
+        if (versionAt(v)->epoch <= snapshot->epoch) return versionAt(v)->balance;
+    }
+    __atomic_store_n(&snapshot->incomplete, 1, __ATOMIC_RELAXED);
+    __atomic_load(&a->balance, &balance, __ATOMIC_RELAXED);
+    return balance;
+}
+
+// Adds (sign 1) or removes (sign -1) an account's share of the running
+// totals. Callers hold the account's stripe lock or exclusive access, and
+// bracket each change with a removal before and an addition after.
+void adjustAggregates(int accountIndex, int sign) {
+    if (!accountAt(accountIndex)->isActive) return;
+    countAggregates(accountIndex, sign);
+    if (sign > 0) balanceIndexInsert(accountIndex);
+    else balanceIndexRemove(accountIndex);
+}
+
+void countAggregates(int accountIndex, int sign) {
+    const Account *a = accountAt(accountIndex);
+    StripeAggregates *totals = &stripeAggregates[accountIndex % LOCK_STRIPES];
+    totals->active += sign;
+    if (a->isLocked) totals->locked += sign;
+    if (a->isSavings) totals->savings += sign;
+    totals->balance += sign * a->balance;
+}
+
+// The balance index is filled unsorted and each stripe sorted once, rather
+// than inserting account by account.
+void rebuildAggregates() {
+    memset(stripeAggregates, 0, sizeof(stripeAggregates));
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        balanceStripes[i].size = 0;
+        balanceStripes[i].hole = 0;
+    }
+    balanceIndexIncomplete = 0;
+    for (int i = 0; i < accountCount; i++) {
+        if (!accountAt(i)->isActive) continue;
+        countAggregates(i, 1);
+        BalanceStripe *stripe = &balanceStripes[i % LOCK_STRIPES];
+        if (stripe->size == stripe->capacity) {
+            int capacity = stripe->capacity ? stripe->capacity * 2 : 16;
+            BalanceEntry *grown = realloc(stripe->entries, capacity * sizeof(BalanceEntry));
+            if (grown == NULL) {
+                balanceIndexIncomplete = 1;
+                continue;
+            }
+            stripe->entries = grown;
+            stripe->capacity = capacity;
+        }
+        stripe->entries[stripe->size].balance = accountAt(i)->balance;
+        stripe->entries[stripe->size++].slot = i;
+    }
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        qsort(balanceStripes[i].entries, balanceStripes[i].size, sizeof(BalanceEntry), compareBalanceEntries);
+    }
+}
+
+int compareBalanceEntries(const void* a, const void* b) {
+    return balanceEntryBefore(a, b) ? -1 : balanceEntryBefore(b, a) ? 1 : 0;
+}
+
+int balanceEntryBefore(const BalanceEntry* a, const BalanceEntry* b) {
+    return a->balance < b->balance || (a->balance == b->balance && a->slot < b->slot);
+}
+
+// Returns the position of the first entry not before key.
+int balanceStripeFind(const BalanceStripe* stripe, const BalanceEntry* key) {
+    int lo = 0, hi = stripe->size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (balanceEntryBefore(&stripe->entries[mid], key)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Both run under the account's stripe lock, with the entry keyed by the
+// balance the account has at the time: adjustAggregates() takes the account
+// out before a change and puts it back after. Balances mostly move a little,
+// so the entry is usually slid only a few places.
+void balanceIndexInsert(int accountIndex) {
+    BalanceStripe *stripe = &balanceStripes[accountIndex % LOCK_STRIPES];
+    BalanceEntry key = {accountAt(accountIndex)->balance, accountIndex};
+    if (stripe->hole != 0 && stripe->entries[stripe->hole - 1].slot == accountIndex) {
+        BalanceEntry *e = stripe->entries;
+        int position = stripe->hole - 1;
+        for (; position > 0 && balanceEntryBefore(&key, &e[position - 1]); position--) e[position] = e[position - 1];
+        for (; position + 1 < stripe->size && balanceEntryBefore(&e[position + 1], &key); position++) e[position] = e[position + 1];
+        e[position] = key;
+        stripe->hole = 0;
+        return;
+    }
+
+    closeBalanceHole(stripe);
+    if (stripe->size == stripe->capacity) {
+        int capacity = stripe->capacity ? stripe->capacity * 2 : 16;
+        BalanceEntry *grown = realloc(stripe->entries, capacity * sizeof(BalanceEntry));
+        if (grown == NULL) {
+            __atomic_store_n(&balanceIndexIncomplete, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        stripe->entries = grown;
+        stripe->capacity = capacity;
+    }
+
+    int position = balanceStripeFind(stripe, &key);
+    memmove(&stripe->entries[position + 1], &stripe->entries[position],
+            (stripe->size - position) * sizeof(BalanceEntry));
+    stripe->entries[position] = key;
+    stripe->size++;
+}
+
+// The entry stays where it is, still in order by its old balance, until it is
+// put back or the hole is closed by the next change in the stripe or by a
+// query.
+void balanceIndexRemove(int accountIndex) {
+    BalanceStripe *stripe = &balanceStripes[accountIndex % LOCK_STRIPES];
+    closeBalanceHole(stripe);
+    BalanceEntry key = {accountAt(accountIndex)->balance, accountIndex};
+    int position = balanceStripeFind(stripe, &key);
+    if (position < stripe->size && stripe->entries[position].slot == accountIndex) stripe->hole = position + 1;
+}
+
+void closeBalanceHole(BalanceStripe* stripe) {
+    if (stripe->hole == 0) return;
+    stripe->size--;
+    memmove(&stripe->entries[stripe->hole - 1], &stripe->entries[stripe->hole],
+            (stripe->size - stripe->hole + 1) * sizeof(BalanceEntry));
+    stripe->hole = 0;
+}
+
+// Collects up to limit active accounts with a balance within [low, high],
+// lowest first or highest first, into a new array the caller frees. Each
+// stripe is searched for where the range starts and the stripes are merged
+// through a heap, so the cost grows with the number of stripes and of rows
+// returned, not with the number of accounts. Returns the row count, or -1
+// when out of memory.
+int queryBalanceIndex(double low, double high, int descending, int limit, BalanceEntry** out) {
+    BalanceCursor *heap = malloc(LOCK_STRIPES * sizeof(BalanceCursor));
+    int capacity = limit < 1024 ? limit : 1024;
+    *out = malloc((capacity > 0 ? capacity : 1) * sizeof(BalanceEntry));
+    if (heap == NULL || *out == NULL) {
+        free(heap);
+        free(*out);
+        return -1;
+    }
+
+    // Exclusive access stops every balance change, so the stripes can be read
+    // together without their locks, and holes left by closed accounts are
+    // cleared first.
+    beginExclusiveAccess();
+    int size = 0;
+    for (int s = 0; s < LOCK_STRIPES; s++) {
+        BalanceStripe *stripe = &balanceStripes[s];
+        closeBalanceHole(stripe);
+        BalanceEntry bound = {descending ? high : low, descending ? INT32_MAX : -1};
+        int position = balanceStripeFind(stripe, &bound) - descending;
+        if (position < 0 || position >= stripe->size) continue;
+        double first = stripe->entries[position].balance;
+        if (first < low || first > high) continue;
+        heap[size].stripe = s;
+        heap[size++].position = position;
+    }
+    for (int i = size / 2 - 1; i >= 0; i--) balanceCursorSiftDown(heap, size, i, descending);
+
+    int count = 0;
+    while (size > 0 && count < limit) {
+        BalanceStripe *stripe = &balanceStripes[heap[0].stripe];
+        BalanceEntry entry = stripe->entries[heap[0].position];
+        if (count == capacity) {
+            BalanceEntry *grown = realloc(*out, capacity * 2 * sizeof(BalanceEntry));
+            if (grown == NULL) {
+                count = -1;
+                break;
+            }
+            *out = grown;
+            capacity *= 2;
+        }
+        (*out)[count++] = entry;
+
+        heap[0].position += descending ? -1 : 1;
+        int position = heap[0].position;
+        if (position < 0 || position >= stripe->size ||
+            stripe->entries[position].balance < low || stripe->entries[position].balance > high) {
+            heap[0] = heap[--size];
+        }
+        balanceCursorSiftDown(heap, size, 0, descending);
+    }
+    endExclusiveAccess();
+
+    free(heap);
+    if (count == -1) {
+        free(*out);
+        *out = NULL;
+    }
+    return count;
+}
+
+// Keeps the cursor whose entry comes first (last when descending) on top.
+void balanceCursorSiftDown(BalanceCursor* heap, int size, int i, int descending) {
+    for (;;) {
+        int best = i;
+        for (int child = 2 * i + 1; child <= 2 * i + 2 && child < size; child++) {
+            const BalanceEntry *a = &balanceStripes[heap[child].stripe].entries[heap[child].position];
+            const BalanceEntry *b = &balanceStripes[heap[best].stripe].entries[heap[best].position];
+            if (descending ? balanceEntryBefore(b, a) : balanceEntryBefore(a, b)) best = child;
+        }
+        if (best == i) return;
+        BalanceCursor swap = heap[i];
+        heap[i] = heap[best];
+        heap[best] = swap;
+        i = best;
+    }
+}
+
+void rebuildAccountIndex() {
+    accountIndexClear(&accountIndex);
+    for (int i = 0; i < accountCount; i++) {
+        accountIndexInsert(&accountIndex, accountAt(i)->accountNumber, i);
+    }
+}
+
+void foldName(char* out, const char* name, size_t size) {
+    size_t i = 0;
+    for (; name[i] && i + 1 < size; i++) out[i] = tolower((unsigned char)name[i]);
+    out[i] = '\0';
+}
+
+// Returns the entry for trigram, adding an empty one when create is set, or
+// NULL when it is absent.
+NameIndexEntry* nameIndexEntry(NameIndex* index, uint32_t trigram, int create) {
+    if (create && (index->size + 1) * 2 > index->capacity) {
+        size_t newCapacity = index->capacity ? index->capacity * 2 : 4096;
+        NameIndexEntry *newEntries = calloc(newCapacity, sizeof(NameIndexEntry));
+        if (newEntries == NULL) {
+            printf(" CRITICAL ERROR: Out of memory growing name index!\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < index->capacity; i++) {
+            if (index->entries[i].trigram == 0) continue;
+            size_t b = accountIndexBucket((int)index->entries[i].trigram, newCapacity);
+            while (newEntries[b].trigram != 0) b = (b + 1) & (newCapacity - 1);
+            newEntries[b] = index->entries[i];
+        }
+        free(index->entries);
+        index->entries = newEntries;
+        index->capacity = newCapacity;
+    }
+    if (index->capacity == 0) return NULL;
+
+    size_t b = accountIndexBucket((int)trigram, index->capacity);
+    while (index->entries[b].trigram != 0) {
+        if (index->entries[b].trigram == trigram) return &index->entries[b];
+        b = (b + 1) & (index->capacity - 1);
+    }
+    if (!create) return NULL;
+    index->entries[b].trigram = trigram;
+    index->size++;
+    return &index->entries[b];
+}
+
+// Callers must hold exclusive access. An account's trigrams are all added in
+// one call, so a repeat within it is always the last entry of its list.
+void nameIndexAdd(int accountIndex) {
+    const char *names[2] = {profileAt(accountIndex)->firstName, profileAt(accountIndex)->lastName};
+    for (int n = 0; n < 2; n++) {
+        char folded[MAX_NAME_LENGTH];
+        foldName(folded, names[n], sizeof(folded));
+        for (int i = 0; folded[i] && folded[i + 1] && folded[i + 2]; i++) {
+            uint32_t trigram = (uint8_t)folded[i] << 16 | (uint8_t)folded[i + 1] << 8 | (uint8_t)folded[i + 2];
+            NameIndexEntry *entry = nameIndexEntry(&nameIndex, trigram, 1);
+            if (entry->count > 0 && entry->accounts[entry->count - 1] == accountIndex) continue;
+            if (entry->count == entry->capacity) {
+                int capacity = entry->capacity ? entry->capacity * 2 : 4;
+                int *grown = realloc(entry->accounts, capacity * sizeof(int));
+                if (grown == NULL) {
+                    printf(" CRITICAL ERROR: Out of memory growing name index!\n");
+                    exit(1);
+                }
+                entry->accounts = grown;
+                entry->capacity = capacity;
+            }
+            entry->accounts[entry->count++] = accountIndex;
+        }
+    }
+}
+
+void nameIndexRemove(int accountIndex) {
+    const char *names[2] = {profileAt(accountIndex)->firstName, profileAt(accountIndex)->lastName};
+    for (int n = 0; n < 2; n++) {
+        char folded[MAX_NAME_LENGTH];
+        foldName(folded, names[n], sizeof(folded));
+        for (int i = 0; folded[i] && folded[i + 1] && folded[i + 2]; i++) {
+            uint32_t trigram = (uint8_t)folded[i] << 16 | (uint8_t)folded[i + 1] << 8 | (uint8_t)folded[i + 2];
+            NameIndexEntry *entry = nameIndexEntry(&nameIndex, trigram, 0);
+            if (entry == NULL) continue;
+            for (int k = 0; k < entry->count; k++) {
+                if (entry->accounts[k] != accountIndex) continue;
+                entry->accounts[k] = entry->accounts[--entry->count];
+                break;
+            }
+        }
+    }
+}
+
+void rebuildNameIndex() {
+    for (size_t i = 0; i < nameIndex.capacity; i++) free(nameIndex.entries[i].accounts);
+    free(nameIndex.entries);
+    nameIndex.entries = NULL;
+    nameIndex.capacity = 0;
+    nameIndex.size = 0;
+    for (int i = 0; i < accountCount; i++) nameIndexAdd(i);
+}
+
+// Finds accounts whose first or last name contains query, ignoring case, and
+// ranks exact name matches above prefix matches above the rest. Candidates come
+// from the query's rarest trigram; queries shorter than a trigram check every
+// account. Returns the number of matches, or -1 when out of memory. The caller
+// frees *matches and must hold shared access.
+int findAccountsByName(const char* query, NameMatch** matches) {
+    char folded[MAX_NAME_LENGTH];
+    foldName(folded, query, sizeof(folded));
+    size_t length = strlen(folded);
+
+    const int *candidates = NULL;
+    int candidateCount = accountCount;
+    for (size_t i = 0; i + 2 < length; i++) {
+        uint32_t trigram = (uint8_t)folded[i] << 16 | (uint8_t)folded[i + 1] << 8 | (uint8_t)folded[i + 2];
+        NameIndexEntry *entry = nameIndexEntry(&nameIndex, trigram, 0);
+        if (entry == NULL || entry->count == 0) {
+            candidateCount = 0;
+            break;
+        }
+        if (candidates == NULL || entry->count < candidateCount) {
+            candidates = entry->accounts;
+            candidateCount = entry->count;
+        }
+    }
+
+    *matches = malloc((candidateCount ? candidateCount : 1) * sizeof(NameMatch));
+    if (*matches == NULL) return -1;
+
+    int found = 0;
+    for (int c = 0; c < candidateCount; c++) {
+        int slot = candidates != NULL ? candidates[c] : c;
+        const char *names[2] = {profileAt(slot)->firstName, profileAt(slot)->lastName};
+        int score = 0;
+        for (int n = 0; n < 2; n++) {
+            char name[MAX_NAME_LENGTH];
+            foldName(name, names[n], sizeof(name));
+            const char *at = strstr(name, folded);
+            if (at == NULL) continue;
+            int fieldScore = at != name ? 1 : name[length] != '\0' ? 2 : 3;
+            if (fieldScore > score) score = fieldScore;
+        }
+        if (score == 0) continue;
+        (*matches)[found].slot = slot;
+        (*matches)[found].score = score;
+        (*matches)[found].accountNumber = accountAt(slot)->accountNumber;
+        found++;
+    }
+    qsort(*matches, found, sizeof(NameMatch), compareNameMatches);
+    return found;
+}
+
+int compareNameMatches(const void* a, const void* b) {
+    const NameMatch *x = a, *y = b;
+    if (x->score != y->score) return y->score - x->score;
+    return (x->accountNumber > y->accountNumber) - (x->accountNumber < y->accountNumber);
+}
+
+double nowSeconds() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+uint64_t nowNanoseconds() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Wall-clock time, for comparing timestamps between processes.
+int64_t wallMicroseconds() {
+#ifdef _WIN32
+    return (int64_t)time(NULL) * 1000000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+// Values below 8 ns get a bucket each; above that every power of two is split
+// into 8 buckets. Anything past 2^40 ns (about 18 minutes) lands in the last.
+int latencyBucket(uint64_t nanoseconds) {
+    if (nanoseconds < 8) return (int)nanoseconds;
+    int msb = 63 - __builtin_clzll(nanoseconds);
+    if (msb >= 40) return LATENCY_BUCKETS - 1;
+    return (msb - 2) * 8 + (int)((nanoseconds >> (msb - 3)) & 7);
+}
+
+// Returns the exclusive upper bound of a bucket in nanoseconds.
+uint64_t latencyBucketLimit(int bucket) {
+    if (bucket < 8) return (uint64_t)bucket + 1;
+    int msb = bucket / 8 + 2;
+    return (uint64_t)(8 + bucket % 8 + 1) << (msb - 3);
+}
+
+// Counts one operation with its outcome and the time since start, and returns
+// result so callers can record on their way out.
+int recordOperation(MetricOperation op, int result, uint64_t start) {
+    uint64_t elapsed = nowNanoseconds() - start;
+    if (metricShard == -1) {
+        metricShard = __atomic_fetch_add(&nextMetricShard, 1, __ATOMIC_RELAXED) % METRIC_SHARDS;
+    }
+    MetricShard *shard = &metricShards[metricShard];
+    __atomic_fetch_add(&shard->outcomes[op][result], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shard->latency[op][latencyBucket(elapsed)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shard->latencySum[op], elapsed, __ATOMIC_RELAXED);
+    return result;
+}
+
+void collectMetrics(MetricShard* total) {
+    memset(total, 0, sizeof(*total));
+    for (int s = 0; s < METRIC_SHARDS; s++) {
+        for (int op = 0; op < METRIC_OPERATION_COUNT; op++) {
+            for (int r = 0; r < TXN_RESULT_COUNT; r++) {
+                total->outcomes[op][r] += __atomic_load_n(&metricShards[s].outcomes[op][r], __ATOMIC_RELAXED);
+            }
+            for (int b = 0; b < LATENCY_BUCKETS; b++) {
+                total->latency[op][b] += __atomic_load_n(&metricShards[s].latency[op][b], __ATOMIC_RELAXED);
+            }
+            total->latencySum[op] += __atomic_load_n(&metricShards[s].latencySum[op], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Returns the upper bound, in microseconds, of the bucket holding quantile q.
+double metricQuantile(const uint64_t* buckets, uint64_t count, double q) {
+    uint64_t rank = (uint64_t)(q * count), seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen > rank) return latencyBucketLimit(b) / 1e3;
+    }
+    return 0;
+}
+
+// Writes every counter and histogram in the Prometheus text format. Histogram
+// buckets are reported at each power of two from about 1 us to 137 s.
+void writeMetrics(FILE* out) {
+    MetricShard total;
+    collectMetrics(&total);
+
+    fprintf(out, "# HELP bank_operations_total Operations attempted, by type.\n");
+    fprintf(out, "# TYPE bank_operations_total counter\n");
+    for (int op = 0; op < METRIC_OPERATION_COUNT; op++) {
+        uint64_t count = 0;
+        for (int r = 0; r < TXN_RESULT_COUNT; r++) count += total.outcomes[op][r];
+        fprintf(out, "bank_operations_total{operation=\"%s\"} %llu\n",
+                metricOperationNames[op], (unsigned long long)count);
+    }
+
+    fprintf(out, "# HELP bank_operation_failures_total Failed operations, by type and reason.\n");
+    fprintf(out, "# TYPE bank_operation_failures_total counter\n");
+    for (int op = 0; op < METRIC_OPERATION_COUNT; op++) {
+        for (int r = TXN_OK + 1; r < TXN_RESULT_COUNT; r++) {
+            if (total.outcomes[op][r] == 0) continue;
+            fprintf(out, "bank_operation_failures_total{operation=\"%s\",reason=\"%s\"} %llu\n",
+                    metricOperationNames[op], metricReasonNames[r], (unsigned long long)total.outcomes[op][r]);
+        }
+    }
+
+    fprintf(out, "# HELP bank_operation_duration_seconds Operation latency.\n");
+    fprintf(out, "# TYPE bank_operation_duration_seconds histogram\n");
+    for (int op = 0; op < METRIC_OPERATION_COUNT; op++) {
+        uint64_t cumulative = 0;
+        int bucket = 0;
+        for (int shift = 10; shift <= 37; shift++) {
+            // 2^shift ns is where bucket (shift - 2) * 8 begins.
+            for (; bucket < (shift - 2) * 8; bucket++) cumulative += total.latency[op][bucket];
+            fprintf(out, "bank_operation_duration_seconds_bucket{operation=\"%s\",le=\"%.9g\"} %llu\n",
+                    metricOperationNames[op], (double)(1ULL << shift) / 1e9, (unsigned long long)cumulative);
+        }
+        for (; bucket < LATENCY_BUCKETS; bucket++) cumulative += total.latency[op][bucket];
+        fprintf(out, "bank_operation_duration_seconds_bucket{operation=\"%s\",le=\"+Inf\"} %llu\n",
+                metricOperationNames[op], (unsigned long long)cumulative);
+        fprintf(out, "bank_operation_duration_seconds_sum{operation=\"%s\"} %.9f\n",
+                metricOperationNames[op], total.latencySum[op] / 1e9);
+        fprintf(out, "bank_operation_duration_seconds_count{operation=\"%s\"} %llu\n",
+                metricOperationNames[op], (unsigned long long)cumulative);
+    }
+
+    if (replicationFd >= 0) {
+        fprintf(out, "# HELP bank_replication_followers Followers attached to this primary.\n");
+        fprintf(out, "# TYPE bank_replication_followers gauge\n");
+        fprintf(out, "bank_replication_followers %d\n", __atomic_load_n(&replicationFollowerCount, __ATOMIC_RELAXED));
+    }
+    if (followerMode) {
+        int64_t heartbeat = __atomic_load_n(&followHeartbeat, __ATOMIC_RELAXED);
+        fprintf(out, "# HELP bank_replication_connected Whether the follower is receiving the primary's stream.\n");
+        fprintf(out, "# TYPE bank_replication_connected gauge\n");
+        fprintf(out, "bank_replication_connected %d\n", __atomic_load_n(&followConnected, __ATOMIC_RELAXED));
+        fprintf(out, "# HELP bank_replication_applied_records_total Journal records applied from the primary.\n");
+        fprintf(out, "# TYPE bank_replication_applied_records_total counter\n");
+        fprintf(out, "bank_replication_applied_records_total %llu\n",
+                (unsigned long long)__atomic_load_n(&followAppliedRecords, __ATOMIC_RELAXED));
+        if (heartbeat > 0) {
+            fprintf(out, "# HELP bank_replication_lag_seconds Age of the newest primary state applied here.\n");
+            fprintf(out, "# TYPE bank_replication_lag_seconds gauge\n");
+            fprintf(out, "bank_replication_lag_seconds %.6f\n", (wallMicroseconds() - heartbeat) / 1e6);
+        }
+    }
+}
+
+void showMetrics() {
+    MetricShard total;
+    collectMetrics(&total);
+
+    printf("\n--- Metrics ---\n");
+    printf("%-11s %-10s %-10s %-10s %-10s %-10s %-10s\n", "Operation", "Count", "Failed", "p50 (us)", "p99 (us)", "p999 (us)", "Mean (us)");
+    for (int op = 0; op < METRIC_OPERATION_COUNT; op++) {
+        uint64_t count = 0;
+        for (int r = 0; r < TXN_RESULT_COUNT; r++) count += total.outcomes[op][r];
+        if (count == 0) continue;
+        printf("%-11s %-10llu %-10llu %-10.1f %-10.1f %-10.1f %-10.1f\n", metricOperationNames[op],
+               (unsigned long long)count, (unsigned long long)(count - total.outcomes[op][TXN_OK]),
+               metricQuantile(total.latency[op], count, 0.50),
+               metricQuantile(total.latency[op], count, 0.99),
+               metricQuantile(total.latency[op], count, 0.999),
+               total.latencySum[op] / 1e3 / count);
+        for (int r = TXN_OK + 1; r < TXN_RESULT_COUNT; r++) {
+            if (total.outcomes[op][r] == 0) continue;
+            printf("    %-24s %llu\n", transactionResultMessage(r), (unsigned long long)total.outcomes[op][r]);
+        }
+    }
+
+    printf("\nWrite Prometheus text to file (blank to skip): ");
+    char path[256];
+    if (fgets(path, sizeof(path), stdin) == NULL) return;
+    path[strcspn(path, "\n")] = 0;
+    if (path[0] == '\0') return;
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        printf(" Error: Cannot create '%s'.\n", path);
+        return;
+    }
+    writeMetrics(file);
+    if (fclose(file) != 0) printf(" Error: Cannot write '%s'.\n", path);
+    else printf(" Metrics written to '%s'.\n", path);
+}
+
+uint64_t nextRandom(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+// Compares hash index lookups against the linear scan the index replaced.
+// The scan runs over a packed key array, which flatters it: the real scan
+// strode through whole Account records.
+void benchmarkLookup() {
+    const size_t sizes[] = {1000, 100000, 10000000};
+    volatile long sink = 0;
+
+    printf("%-12s %-18s %-18s %-10s\n", "Accounts", "Scan (ns/lookup)", "Index (ns/lookup)", "Speedup");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = sizes[s];
+        int *keys = malloc(n * sizeof(int));
+        if (keys == NULL) {
+            printf(" Not enough memory for %zu accounts.\n", n);
+            break;
+        }
+
+        // i * 2654435761 mod (2^31 - 1) is a bijection, so the keys are distinct.
+        AccountIndex index = {NULL, 0, 0};
+        for (size_t i = 0; i < n; i++) {
+            keys[i] = (int)((i * 2654435761ULL) % 2147483647ULL) + 1;
+            accountIndexInsert(&index, keys[i], (int)i);
+        }
+
+        uint64_t rng = 88172645463325252ULL;
+        size_t scanLookups = n > 200000000 / 1000 ? 200 : 200000000 / n;
+        double start = nowSeconds();
+        for (size_t q = 0; q < scanLookups; q++) {
+            int key = keys[nextRandom(&rng) % n];
+            for (size_t i = 0; i < n; i++) {
+                if (keys[i] == key) {
+                    sink += (long)i;
+                    break;
+                }
+            }
+        }
+        double scanNs = (nowSeconds() - start) * 1e9 / scanLookups;
+
+        size_t indexLookups = 2000000;
+        start = nowSeconds();
+        for (size_t q = 0; q < indexLookups; q++) {
+            sink += accountIndexFind(&index, keys[nextRandom(&rng) % n]);
+        }
+        double indexNs = (nowSeconds() - start) * 1e9 / indexLookups;
+
+        printf("%-12zu %-18.1f %-18.1f %.0fx\n", n, scanNs, indexNs, scanNs / indexNs);
+        accountIndexClear(&index);
+        free(keys);
+    }
+    (void)sink;
+}
+
+
+
+int validatePassword(const char* password) {
+    if (strlen(password) < 6) return 0;
+    for (int i = 0; password[i]; i++) {
+        if (isdigit(password[i])) return 1;
+    }
+    return 0;
+}
+int exportTextData(const char* path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        printf(" Error: Cannot create '%s'.\n", path);
+        return 0;
+    }
+
+    // The snapshot pins the ledger length along with the balances, so every
+    // exported balance is the sum of the exported rows.
+    BalanceSnapshot snapshot;
+    pinBalanceSnapshot(&snapshot);
+    fprintf(file, "%d %d %d\n", snapshot.accounts, snapshot.transactions, adminCount);
+
+
+    for (int i = 0; i < snapshot.accounts; i++) {
+        fprintf(file, "%d|%s|%s|%.2f|%d|%d|%d|%ld|%s\n",
+                accountAt(i)->accountNumber,
+                profileAt(i)->firstName,
+                profileAt(i)->lastName,
+                snapshotBalance(&snapshot, i),
+                accountAt(i)->isActive,
+                accountAt(i)->isLocked,
+                accountAt(i)->isSavings,
+                accountAt(i)->lastInterestDate,
+                profileAt(i)->password);
+    }
+
+
+    for (int i = 0; i < snapshot.transactions; i++) {
+        fprintf(file, "%d|%d|%s|%.2f|%ld|%d|%s\n",
+                transactionAt(i)->transactionId,
+                transactionAt(i)->accountNumber,
+                transactionTypeName(transactionAt(i)->type),
+                transactionAt(i)->amount,
+                transactionAt(i)->timestamp,
+                transactionAt(i)->relatedAccount,
+                stringAt(transactionAt(i)->description));
+    }
+
+
+    for (int i = 0; i < adminCount; i++) {
+        fprintf(file, "%s|%s\n", admins[i].username, admins[i].password);
+    }
+    releaseBalanceSnapshot(&snapshot);
+
+    if (fclose(file) != 0) {
+        printf(" Error: Failed to finish writing '%s'.\n", path);
+        return 0;
+    }
+    printf(" Exported %d accounts and %d transactions to '%s'\n", snapshot.accounts, snapshot.transactions, path);
+    return 1;
+}
+
+void saveData() {
+    uint64_t start = nowNanoseconds();
+    beginExclusiveAccess();
+    int result = writeCheckpoint();
+    endExclusiveAccess();
+    recordOperation(METRIC_SAVE, result, start);
+}
+
+// Writes the snapshot and resets the journal. The caller must hold exclusive
+// access so no operation is half-applied while the tables are written out.
+// Returns TXN_OK, TXN_SKIPPED when there is nothing to save, or
+// TXN_SAVE_FAILED.
+int writeCheckpoint() {
+    if (accountCount == 0 && transactionCount == 0) {
+        printf("No data to save (no accounts or transactions created).\n");
+        return TXN_SKIPPED;
+    }
+
+    int shardCount = (accountCount + SHARD_SIZE - 1) >> SHARD_SHIFT;
+    int *shards = calloc(shardCount + 1, sizeof(int));
+    if (shards == NULL) {
+        printf(" CRITICAL ERROR: Not enough memory to save data!\n");
+        return TXN_SAVE_FAILED;
+    }
+
+    printf("💾 Saving data to '%s'...\n", SNAPSHOT_FILE);
+    lockCheckpointFiles();
+    pthread_mutex_lock(&archiveLock);
+    int shardTotal = collectDirtyShards(accountCount, shards);
+    RollupBatch rollups;
+    if (!collectDirtyRollups(&rollups)) {
+        printf(" CRITICAL ERROR: Not enough memory to save data!\n");
+        restoreDirtyShards(shards, shardTotal);
+        pthread_mutex_unlock(&archiveLock);
+        unlockCheckpointFiles();
+        free(shards);
+        return TXN_SAVE_FAILED;
+    }
+    int archived = sealArchiveSegment(transactionCount);
+    if (!writeSnapshot(accountChunks, profileChunks, accountCount, transactionCount, stringCount, admins, adminCount, archived, shards, shardTotal, &rollups)) {
+        restoreDirtyShards(shards, shardTotal);
+        restoreDirtyRollups(&rollups);
+        pthread_mutex_unlock(&archiveLock);
+        unlockCheckpointFiles();
+        free(rollups.records);
+        free(shards);
+        return TXN_SAVE_FAILED;
+    }
+    commitArchive(archived);
+    pthread_mutex_unlock(&archiveLock);
+    free(rollups.records);
+    free(shards);
+
+    // The checkpoint now covers everything in the journal, so start it afresh.
+    // Modes that run without an open journal still truncate the file, or its
+    // stale account records would be replayed over this checkpoint.
+    pthread_mutex_lock(&journalWriteLock);
+    if (journalFile != NULL) {
+        journalFile = freopen(JOURNAL_FILE, "w", journalFile);
+        if (journalFile == NULL) {
+            printf(" WARNING: Cannot reset journal '%s'. Falling back to full saves.\n", JOURNAL_FILE);
+            journalMode = 0;
+        }
+    } else {
+        FILE *staleJournal = fopen(JOURNAL_FILE, "w");
+        if (staleJournal != NULL) fclose(staleJournal);
+    }
+    remove(JOURNAL_FILE ".old");
+
+    pthread_mutex_lock(&journalLock);
+    journalPendingLength = 0;
+    journalDurableLsn = journalAppendedLsn;
+    __atomic_store_n(&journalFailedLsn, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&journalRecords, 0, __ATOMIC_RELAXED);
+    pthread_cond_broadcast(&journalFlushed);
+    pthread_mutex_unlock(&journalLock);
+    pthread_mutex_unlock(&journalWriteLock);
+    unlockCheckpointFiles();
+
+    printf(" SUCCESS: All data saved to '%s'\n", SNAPSHOT_FILE);
+    printf(" Saved: %d accounts, %d transactions\n", accountCount, transactionCount);
+    printf(" Rewrote %d of %d account shards\n", shardTotal, shardCount);
+    if (archivedTransactions > 0) {
+        printf(" Archived: %d oldest transactions in sealed segments\n", archivedTransactions);
+    }
+    return TXN_OK;
+}
+
+// Lists the shards among the first accounts that changed since the last
+// checkpoint and clears their marks. The caller holds exclusive access, so
+// no operation marks one meanwhile.
+int collectDirtyShards(int accounts, int* shards) {
+    int count = 0;
+    for (int s = 0; s << SHARD_SHIFT < accounts; s++) {
+        if (!shardDirty[s]) continue;
+        shardDirty[s] = 0;
+        shards[count++] = s;
+    }
+    return count;
+}
+
+// Marks the shards of a checkpoint that did not land dirty again.
+void restoreDirtyShards(const int* shards, int count) {
+    for (int i = 0; i < count; i++) __atomic_store_n(&shardDirty[shards[i]], 1, __ATOMIC_RELAXED);
+}
+
+// Copies the rollups the next checkpoint writes into batch, whose records the
+// caller frees, and clears their marks. The log starts afresh when there is
+// none yet or when appending would grow it past twice the pool. The caller
+// holds exclusive access and archiveLock. Returns 0 when out of memory.
+int collectDirtyRollups(RollupBatch* batch) {
+    int slots = rollupCount;
+    if (slots > rollupChunkCount << CHUNK_SHIFT) slots = rollupChunkCount << CHUNK_SHIFT;
+    int blocks = (slots + (1 << ROLLUP_BLOCK_SHIFT) - 1) >> ROLLUP_BLOCK_SHIFT;
+    int dirty = 0;
+    for (int b = 0; b < blocks; b++) dirty += rollupDirty[b];
+    batch->slots = slots;
+    batch->count = 0;
+    batch->fresh = checkpointState.rollupRecords == 0 ||
+                   checkpointState.rollupRecords + ((uint64_t)dirty << ROLLUP_BLOCK_SHIFT) > 2ULL * slots;
+    batch->records = malloc(((size_t)(batch->fresh ? blocks : dirty) << ROLLUP_BLOCK_SHIFT) * sizeof(DiskRollup) + 1);
+    if (batch->records == NULL) return 0;
+
+    for (int b = 0; b < blocks; b++) {
+        if (!batch->fresh && !rollupDirty[b]) continue;
+        int end = (b + 1) << ROLLUP_BLOCK_SHIFT < slots ? (b + 1) << ROLLUP_BLOCK_SHIFT : slots;
+        for (int slot = b << ROLLUP_BLOCK_SHIFT; slot < end; slot++) {
+            const Rollup *r = rollupAt(slot);
+            DiskRollup *record = &batch->records[batch->count++];
+            record->slot = slot;
+            record->account = r->account;
+            record->period = r->period;
+            record->previous = r->previous;
+            record->opening = r->opening;
+            record->deposits = r->deposits;
+            record->withdrawals = r->withdrawals;
+            record->transfersIn = r->transfersIn;
+            record->transfersOut = r->transfersOut;
+            record->interest = r->interest;
+            record->entries = r->entries;
+            record->depositCount = r->depositCount;
+            record->withdrawalCount = r->withdrawalCount;
+            record->transferInCount = r->transferInCount;
+            record->transferOutCount = r->transferOutCount;
+            record->interestCount = r->interestCount;
+        }
+    }
+    memset(rollupDirty, 0, blocks);
+    return 1;
+}
+
+// Marks the blocks of a checkpoint's rollups that did not land dirty again.
+void restoreDirtyRollups(const RollupBatch* batch) {
+    for (int i = 0; i < batch->count; i++) markRollupDirty(batch->records[i].slot);
+}
+
+// Writes a version 5 snapshot: the listed account shards, the strings and
+// ledger rows added since the last checkpoint, the archived history heads if
+// the archive grew, the collected rollups, and last the manifest in SNAPSHOT_FILE, whose atomic
+// rename commits the rest. Parts written for a checkpoint that never commits
+// do no harm: the old manifest ignores appended bytes, and the journal it
+// pairs with replays account records over any shard that was replaced. Ledger
+// rows and strings below the given counts are immutable, so they are read
+// straight from the live chunks. Only failures are reported.
+int writeSnapshot(void* const* accountChunkDir, void* const* profileChunkDir, int accounts, int transactions, int strings, const Admin* adminRows, int admins, int archived, const int* shards, int shardTotal, const RollupBatch* rollups) {
+    SnapshotHeader next = checkpointState;
+    int ok = 1;
+    for (int i = 0; ok && i < shardTotal; i++) {
+        ok = writeShard(accountChunkDir, profileChunkDir, shards[i], accounts);
+    }
+    ok = ok && appendStrings(strings, &next);
+    ok = ok && appendLedger(transactions, archived, &next);
+    if (ok && archived > 0 && (uint64_t)archived != checkpointState.archivedTransactions) {
+        ok = writeArchiveHeads(accounts, archived);
+    }
+    ok = ok && appendRollups(rollups, &next);
+    // The parts' directory entries must be on disk before a manifest that
+    // refers to them.
+    if (ok && !syncDataDirectory()) {
+        printf(" CRITICAL ERROR: Cannot sync the data directory!\n");
+        ok = 0;
+    }
+    if (!ok) return 0;
+
+    char tempFile[] = SNAPSHOT_FILE ".tmp";
+    FILE *file = fopen(tempFile, "wb");
+    if (file == NULL) {
+        printf(" CRITICAL ERROR: Cannot create/write to '%s'!\n", tempFile);
+        printf(" Possible solutions:\n");
+        printf(" 1. Run as administrator/sudo\n");
+        printf(" 2. Check folder write permissions\n");
+        printf(" 3. Try running from a different directory\n");
+        printf(" 4. Check if antivirus is blocking file creation\n");
+        return 0;
+    }
+
+    memcpy(next.magic, SNAPSHOT_MAGIC, sizeof(next.magic));
+    next.version = SNAPSHOT_VERSION;
+    next.headerSize = sizeof(next);
+    next.accountCount = accounts;
+    next.transactionCount = transactions;
+    next.adminCount = admins;
+    next.archivedTransactions = archived;
+    next.shardSize = SHARD_SIZE;
+    next.checksum = 0xcbf29ce484222325ULL;
+    DiskAdmin records[5];
+    memset(records, 0, sizeof(records));
+    for (int i = 0; i < admins; i++) {
+        snprintf(records[i].username, sizeof(records[i].username), "%.49s", adminRows[i].username);
+        snprintf(records[i].password, sizeof(records[i].password), "%.49s", adminRows[i].password);
+    }
+    next.checksum = snapshotChecksum(next.checksum, records, admins * sizeof(DiskAdmin));
+    ok = fwrite(&next, sizeof(next), 1, file) == 1 &&
+         fwrite(records, sizeof(DiskAdmin), admins, file) == (size_t)admins;
+    if (!finishPartFile(file, ok, tempFile, SNAPSHOT_FILE)) return 0;
+
+    // Callers truncate or remove journal segments once this returns, so the
+    // rename must be durable first. If that cannot be known, which manifest
+    // a restart finds is unknown too, and only the untouched journal can
+    // cover either; stop here.
+    if (!syncDataDirectory()) {
+        printf(" CRITICAL ERROR: Cannot sync the data directory after replacing '%s'; stopping with the journal kept.\n",
+               SNAPSHOT_FILE);
+        exit(1);
+    }
+
+    // Parts only the previous manifest referred to can go now.
+    char path[64];
+    if (checkpointState.ledgerFirst != UINT64_MAX && checkpointState.ledgerFirst != next.ledgerFirst) {
+        snprintf(path, sizeof(path), LEDGER_FILE, (int)(checkpointState.ledgerFirst >> CHUNK_SHIFT));
+        remove(path);
+    }
+    if (checkpointState.archivedTransactions > 0 && checkpointState.archivedTransactions != next.archivedTransactions) {
+        snprintf(path, sizeof(path), HEADS_FILE, (int)(checkpointState.archivedTransactions >> CHUNK_SHIFT));
+        remove(path);
+    }
+    if (checkpointState.rollupFile != 0 && checkpointState.rollupFile != next.rollupFile) {
+        snprintf(path, sizeof(path), ROLLUP_FILE, (int)checkpointState.rollupFile);
+        remove(path);
+    }
+    checkpointState = next;
+    return 1;
+}
+
+// Makes the files created, renamed and removed in the data directory so far
+// survive a power loss. Windows has no directory fsync.
+int syncDataDirectory() {
+#ifndef _WIN32
+    int fd = open(".", O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return 0;
+    int ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+#else
+    return 1;
+#endif
+}
+
+// Flushes a snapshot part to disk and closes it. A part written to a
+// temporary file then replaces path; appended parts pass NULL.
+int finishPartFile(FILE* file, int ok, const char* written, const char* path) {
+    ok = ok && fflush(file) == 0;
+#ifndef _WIN32
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    if (fclose(file) != 0 || !ok) {
+        printf(" CRITICAL ERROR: Failed to finish writing '%s'!\n", written);
+        if (path != NULL) remove(written);
+        return 0;
+    }
+    if (path == NULL) return 1;
+
+#ifdef _WIN32
+    remove(path);
+#endif
+    if (rename(written, path) != 0) {
+        printf(" CRITICAL ERROR: Cannot replace '%s'!\n", path);
+        remove(written);
+        return 0;
+    }
+    return 1;
+}
+
+// Rewrites one shard of SHARD_SIZE account slots.
+int writeShard(void* const* accountChunkDir, void* const* profileChunkDir, int shard, int accounts) {
+    int first = shard << SHARD_SHIFT;
+    int rows = accounts - first < SHARD_SIZE ? accounts - first : SHARD_SIZE;
+    DiskAccount *records = malloc(rows * sizeof(DiskAccount));
+    if (records == NULL) {
+        printf(" CRITICAL ERROR: Not enough memory to save data!\n");
+        return 0;
+    }
+    for (int i = first; i < first + rows; i++) {
+        fillDiskAccount(&records[i - first],
+                        (const Account*)accountChunkDir[i >> CHUNK_SHIFT] + (i & (CHUNK_SIZE - 1)),
+                        (const AccountProfile*)profileChunkDir[i >> CHUNK_SHIFT] + (i & (CHUNK_SIZE - 1)));
+    }
+
+    PartHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SHARD_MAGIC, sizeof(header.magic));
+    header.version = 1;
+    header.recordSize = sizeof(DiskAccount);
+    header.first = first;
+    header.count = rows;
+    header.checksum = snapshotChecksum(0xcbf29ce484222325ULL, records, rows * sizeof(DiskAccount));
+
+    char path[64], tempFile[80];
+    snprintf(path, sizeof(path), SHARD_FILE, shard);
+    snprintf(tempFile, sizeof(tempFile), "%s.tmp", path);
+    FILE *file = fopen(tempFile, "wb");
+    if (file == NULL) {
+        printf(" CRITICAL ERROR: Cannot create/write to '%s'!\n", tempFile);
+        free(records);
+        return 0;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(records, sizeof(DiskAccount), rows, file) == (size_t)rows;
+    free(records);
+    return finishPartFile(file, ok, tempFile, path);
+}
+
+// Appends the strings interned since the last checkpoint to STRINGS_FILE,
+// each NUL-padded to an 8-byte boundary, and advances next past them.
+int appendStrings(int strings, SnapshotHeader* next) {
+    if (next->stringCount > 0 && (uint64_t)strings == next->stringCount) return 1;
+
+    FILE *file = next->stringCount > 0 ? fopen(STRINGS_FILE, "r+b") : NULL;
+    int ok = 1;
+    if (file == NULL) {
+        // Texts never change, so without a usable file they are all written
+        // again from the start.
+        next->stringCount = 0;
+        next->stringBytes = 0;
+        next->stringChecksum = 0xcbf29ce484222325ULL;
+        file = fopen(STRINGS_FILE, "wb");
+        if (file == NULL) {
+            printf(" CRITICAL ERROR: Cannot create/write to '%s'!\n", STRINGS_FILE);
+            return 0;
+        }
+        PartHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, STRINGS_MAGIC, sizeof(header.magic));
+        header.version = 1;
+        header.recordSize = 1;
+        ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+    ok = ok && fseek(file, (long)(sizeof(PartHeader) + next->stringBytes), SEEK_SET) == 0;
+
+    char padded[MAX_DESCRIPTION_LENGTH + 8];
+    for (int id = (int)next->stringCount; ok && id < strings; id++) {
+        size_t length = (size_t)snprintf(padded, sizeof(padded), "%.*s", MAX_DESCRIPTION_LENGTH - 1, stringAt(id));
+        size_t end = (length + 8) & ~(size_t)7;
+        memset(padded + length, 0, end - length);
+        next->stringChecksum = snapshotChecksum(next->stringChecksum, padded, end);
+        next->stringBytes += end;
+        ok = fwrite(padded, 1, end, file) == end;
+    }
+    next->stringCount = strings;
+    return finishPartFile(file, ok, STRINGS_FILE, NULL);
+}
+
+// Appends the ledger rows added since the last checkpoint and advances next
+// past them. Once the archive covers more of the file than the live rows
+// after it, those rows go to a new file starting at archived instead, which
+// keeps the file in proportion to the in-memory window.
+int appendLedger(int transactions, int archived, SnapshotHeader* next) {
+    char path[64];
+    uint64_t from = next->transactionCount;
+    FILE *file = NULL;
+    int ok = 1;
+    if (next->ledgerFirst != UINT64_MAX &&
+        (uint64_t)archived - next->ledgerFirst <= (uint64_t)(transactions - archived)) {
+        snprintf(path, sizeof(path), LEDGER_FILE, (int)(next->ledgerFirst >> CHUNK_SHIFT));
+        file = fopen(path, "r+b");
+    }
+    if (file == NULL) {
+        next->ledgerFirst = archived;
+        next->ledgerChecksum = 0xcbf29ce484222325ULL;
+        from = archived;
+        snprintf(path, sizeof(path), LEDGER_FILE, archived >> CHUNK_SHIFT);
+        file = fopen(path, "wb");
+        if (file == NULL) {
+            printf(" CRITICAL ERROR: Cannot create/write to '%s'!\n", path);
+            return 0;
+        }
+        PartHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, LEDGER_MAGIC, sizeof(header.magic));
+        header.version = 1;
+        header.recordSize = sizeof(DiskTransaction);
+        header.first = archived;
+        ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+    ok = ok && fseek(file, (long)(sizeof(PartHeader) + (from - next->ledgerFirst) * sizeof(DiskTransaction)), SEEK_SET) == 0;
+
+    for (int i = (int)from; ok && i < transactions; i++) {
+        DiskTransaction record;
+        memset(&record, 0, sizeof(record));
+        record.transactionId = transactionAt(i)->transactionId;
+        record.accountNumber = transactionAt(i)->accountNumber;
+        record.amount = transactionAt(i)->amount;
+        record.timestamp = transactionAt(i)->timestamp;
+        record.relatedAccount = transactionAt(i)->relatedAccount;
+        record.type = transactionAt(i)->type;
+        record.description = transactionAt(i)->description;
+        next->ledgerChecksum = snapshotChecksum(next->ledgerChecksum, &record, sizeof(record));
+        ok = fwrite(&record, sizeof(record), 1, file) == 1;
+    }
+    return finishPartFile(file, ok, path, NULL);
+}
+
+// Appends the collected rollups to the log and advances next past them. A
+// fresh log goes to a new file, since the manifest that commits it still
+// reads the old one until then.
+int appendRollups(const RollupBatch* rollups, SnapshotHeader* next) {
+    char path[64];
+    FILE *file = NULL;
+    int ok = 1;
+    if (rollups->fresh) {
+        next->rollupFile++;
+        next->rollupRecords = 0;
+        next->rollupChecksum = 0xcbf29ce484222325ULL;
+        snprintf(path, sizeof(path), ROLLUP_FILE, (int)next->rollupFile);
+        file = fopen(path, "wb");
+        if (file == NULL) {
+            printf(" CRITICAL ERROR: Cannot create/write to '%s'!\n", path);
+            return 0;
+        }
+        PartHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, ROLLUP_MAGIC, sizeof(header.magic));
+        header.version = 1;
+        header.recordSize = sizeof(DiskRollup);
+        header.first = next->rollupFile;
+        ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    } else {
+        snprintf(path, sizeof(path), ROLLUP_FILE, (int)next->rollupFile);
+        file = fopen(path, "r+b");
+        if (file == NULL) {
+            // Only a whole log can stand in for the missing one.
+            printf(" CRITICAL ERROR: Cannot open '%s'; the next checkpoint rewrites it.\n", path);
+            checkpointState.rollupRecords = 0;
+            return 0;
+        }
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+    ok = ok && fseek(file, (long)(sizeof(PartHeader) + next->rollupRecords * sizeof(DiskRollup)), SEEK_SET) == 0;
+    ok = ok && fwrite(rollups->records, sizeof(DiskRollup), rollups->count, file) == (size_t)rollups->count;
+    next->rollupChecksum = snapshotChecksum(next->rollupChecksum, rollups->records, rollups->count * sizeof(DiskRollup));
+    next->rollupRecords += rollups->count;
+    next->rollupCount = rollups->slots;
+    return finishPartFile(file, ok, path, NULL);
+}
+
+// Writes each account's newest archived row for a new archive length; load
+// needs it to reattach the history chains to the archive. The walk from each
+// account's newest row only visits rows after the archive, under the
+// account's stripe lock since operations may still be running.
+int writeArchiveHeads(int accounts, int archived) {
+    char path[64], tempFile[80];
+    snprintf(path, sizeof(path), HEADS_FILE, archived >> CHUNK_SHIFT);
+    snprintf(tempFile, sizeof(tempFile), "%s.tmp", path);
+    FILE *file = fopen(tempFile, "wb");
+    if (file == NULL) {
+        printf(" CRITICAL ERROR: Cannot create/write to '%s'!\n", tempFile);
+        return 0;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+
+    // The header is rewritten with the final checksum once the heads are out.
+    PartHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HEADS_MAGIC, sizeof(header.magic));
+    header.version = 1;
+    header.recordSize = sizeof(int32_t);
+    header.first = archived;
+    header.count = accounts;
+    header.checksum = 0xcbf29ce484222325ULL;
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    int32_t heads[512];
+    int pending = 0;
+    for (int i = 0; ok && i < accounts + (accounts & 1); i++) {
+        int32_t head = -1;
+        if (i < accounts) {
+            lockAccount(i);
+            head = archivedChainHead(accountAt(i)->lastTransaction, archived);
+            unlockAccount(i);
+        }
+        heads[pending++] = head;
+        if (pending == 512 || i + 1 == accounts + (accounts & 1)) {
+            header.checksum = snapshotChecksum(header.checksum, heads, pending * sizeof(int32_t));
+            ok = fwrite(heads, sizeof(int32_t), pending, file) == (size_t)pending;
+            pending = 0;
+        }
+    }
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    return finishPartFile(file, ok, tempFile, path);
+}
+
+// Names the index-th file of the last committed snapshot; returns 0 past the
+// last one.
+int checkpointFileName(int index, char* path, size_t size) {
+    int shards = (int)((checkpointState.accountCount + SHARD_SIZE - 1) >> SHARD_SHIFT);
+    if (index == 0) {
+        snprintf(path, size, "%s", SNAPSHOT_FILE);
+    } else if (index == 1) {
+        snprintf(path, size, "%s", STRINGS_FILE);
+    } else if (index == 2) {
+        snprintf(path, size, LEDGER_FILE, (int)(checkpointState.ledgerFirst >> CHUNK_SHIFT));
+    } else if (index == 3) {
+        snprintf(path, size, HEADS_FILE, (int)(checkpointState.archivedTransactions >> CHUNK_SHIFT));
+    } else if (index == 4) {
+        snprintf(path, size, ROLLUP_FILE, (int)checkpointState.rollupFile);
+    } else if (index - 5 < shards) {
+        snprintf(path, size, SHARD_FILE, index - 5);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+long long checkpointBytes() {
+    char path[64];
+    long long total = 0;
+    for (int i = 0; checkpointFileName(i, path, sizeof(path)); i++) {
+        FILE *file = fopen(path, "rb");
+        if (file == NULL) continue;
+        fseek(file, 0, SEEK_END);
+        total += ftell(file);
+        fclose(file);
+    }
+    return total;
+}
+
+void removeCheckpointFiles() {
+    char path[64];
+    for (int i = 0; checkpointFileName(i, path, sizeof(path)); i++) remove(path);
+}
+
+// Writes the ledger chunks that have fallen more than ledgerWindow rows behind
+// transactions, and are not archived yet, to a new sealed segment. Returns how
+// many rows the archive covers once a snapshot records it; with nothing worth
+// sealing, or on failure, that is archivedTransactions unchanged. A segment no
+// snapshot refers to is simply written again next time.
+int sealArchiveSegment(int transactions) {
+    int firstChunk = archivedTransactions >> CHUNK_SHIFT;
+    int endChunk = transactions > ledgerWindow ? (transactions - ledgerWindow) >> CHUNK_SHIFT : 0;
+    if (endChunk - firstChunk < ARCHIVE_MIN_CHUNKS) return archivedTransactions;
+
+    char path[64], tempFile[80];
+    snprintf(path, sizeof(path), ARCHIVE_FILE, firstChunk);
+    snprintf(tempFile, sizeof(tempFile), "%s.tmp", path);
+    FILE *file = fopen(tempFile, "wb");
+    if (file == NULL) {
+        printf(" WARNING: Cannot create archive segment '%s'.\n", tempFile);
+        return archivedTransactions;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+
+    ArchiveHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = 1;
+    header.recordSize = sizeof(Transaction);
+    header.firstChunk = firstChunk;
+    header.chunkCount = endChunk - firstChunk;
+    int firstBlock = firstChunk << (CHUNK_SHIFT - TIME_BLOCK_SHIFT);
+    int blocks = header.chunkCount << (CHUNK_SHIFT - TIME_BLOCK_SHIFT);
+    header.dataOffset = (sizeof(header) + blocks * 2 * sizeof(int64_t) + ARCHIVE_ALIGN - 1) / ARCHIVE_ALIGN * ARCHIVE_ALIGN;
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (int b = firstBlock; ok && b < firstBlock + blocks; b++) {
+        int64_t range[2] = {INT64_MAX, INT64_MIN};
+        for (int i = b << TIME_BLOCK_SHIFT; i < (b + 1) << TIME_BLOCK_SHIFT; i++) {
+            int64_t timestamp = transactionAt(i)->timestamp;
+            if (timestamp < range[0]) range[0] = timestamp;
+            if (timestamp > range[1]) range[1] = timestamp;
+        }
+        ok = fwrite(range, sizeof(range), 1, file) == 1;
+    }
+    ok = ok && fseek(file, (long)header.dataOffset, SEEK_SET) == 0;
+    for (int c = firstChunk; ok && c < endChunk; c++) {
+        ok = fwrite(transactionChunks[c], CHUNK_SIZE * sizeof(Transaction), 1, file) == 1;
+    }
+    ok = ok && fflush(file) == 0;
+#ifndef _WIN32
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    if (fclose(file) != 0 || !ok) {
+        printf(" WARNING: Cannot write archive segment '%s'.\n", tempFile);
+        remove(tempFile);
+        return archivedTransactions;
+    }
+
+#ifdef _WIN32
+    remove(path);
+#endif
+    if (rename(tempFile, path) != 0) {
+        printf(" WARNING: Cannot replace archive segment '%s'.\n", path);
+        remove(tempFile);
+        return archivedTransactions;
+    }
+    return endChunk << CHUNK_SHIFT;
+}
+
+// Maps the archive segment that starts at firstChunk over the ledger chunks it
+// covers, which must end by endChunk, and restores their time index blocks.
+// The file holds the same bytes as the chunks, so readers never notice the
+// switch. Returns the chunk after the segment, or -1.
+int mapArchiveSegment(int firstChunk, int endChunk) {
+    char path[64];
+    snprintf(path, sizeof(path), ARCHIVE_FILE, firstChunk);
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        printf(" Error: Cannot open archive segment '%s'.\n", path);
+        return -1;
+    }
+
+    size_t chunkBytes = CHUNK_SIZE * sizeof(Transaction);
+    ArchiveHeader header;
+    int ok = fread(&header, sizeof(header), 1, file) == 1 &&
+             memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) == 0 && header.version == 1 &&
+             header.recordSize == sizeof(Transaction) && header.firstChunk == (uint32_t)firstChunk &&
+             header.chunkCount > 0 && header.chunkCount <= (uint32_t)(endChunk - firstChunk) &&
+             header.dataOffset % ARCHIVE_ALIGN == 0 &&
+             fseek(file, 0, SEEK_END) == 0 &&
+             (uint64_t)ftell(file) >= header.dataOffset + header.chunkCount * chunkBytes &&
+             fseek(file, sizeof(header), SEEK_SET) == 0 &&
+             ensureTransactionCapacity((long long)(firstChunk + header.chunkCount) << CHUNK_SHIFT);
+
+    int firstBlock = firstChunk << (CHUNK_SHIFT - TIME_BLOCK_SHIFT);
+    int blocks = ok ? (int)header.chunkCount << (CHUNK_SHIFT - TIME_BLOCK_SHIFT) : 0;
+    for (int b = firstBlock; ok && b < firstBlock + blocks; b++) {
+        int64_t range[2];
+        ok = fread(range, sizeof(range), 1, file) == 1;
+        __atomic_store_n(&timeBlockMin[b], range[0], __ATOMIC_SEQ_CST);
+        __atomic_store_n(&timeBlockMax[b], range[1], __ATOMIC_SEQ_CST);
+    }
+
+    for (uint32_t c = 0; ok && c < header.chunkCount; c++) {
+#ifdef _WIN32
+        ok = fseek(file, (long)(header.dataOffset + c * chunkBytes), SEEK_SET) == 0 &&
+             fread(transactionChunks[firstChunk + c], chunkBytes, 1, file) == 1;
+#else
+        ok = mmap(transactionChunks[firstChunk + c], chunkBytes, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+                  fileno(file), (off_t)(header.dataOffset + c * chunkBytes)) != MAP_FAILED;
+#endif
+    }
+    fclose(file);
+
+    if (!ok) {
+        printf(" Error: Archive segment '%s' is damaged.\n", path);
+        return -1;
+    }
+    return firstChunk + (int)header.chunkCount;
+}
+
+// Maps the segments holding the first archived ledger rows.
+int mapArchive(int archived) {
+    int chunk = 0;
+    while (chunk != -1 && chunk < archived >> CHUNK_SHIFT) {
+        chunk = mapArchiveSegment(chunk, archived >> CHUNK_SHIFT);
+    }
+    return chunk != -1;
+}
+
+// Switches freshly sealed chunks over to their segment once a snapshot records
+// it, which hands their memory back. Windows keeps them resident.
+void commitArchive(int archived) {
+    if (archived == archivedTransactions) return;
+#ifndef _WIN32
+    if (mapArchiveSegment(archivedTransactions >> CHUNK_SHIFT, archived >> CHUNK_SHIFT) == -1) {
+        printf(" WARNING: Archived ledger rows stay in memory until the next start.\n");
+    }
+#endif
+    archivedTransactions = archived;
+}
+
+void openJournal() {
+    if (!journalMode) return;
+
+    journalFile = fopen(JOURNAL_FILE, "a");
+    if (journalFile == NULL) {
+        printf(" WARNING: Cannot open journal '%s'. Falling back to full saves.\n", JOURNAL_FILE);
+        journalMode = 0;
+        return;
+    }
+
+    // A rotated segment left behind means the last background checkpoint never
+    // landed. Its records were replayed at load, so fold them in right away.
+    // So are the records of rows replay dropped, before new rows take their
+    // ids.
+    FILE *rotated = fopen(JOURNAL_FILE ".old", "r");
+    if (rotated != NULL) fclose(rotated);
+    if (rotated != NULL || journalTrimmed) saveData();
+}
+
+// Records hold at most two names, a password, a description and a %.2f of any
+// double (up to 313 characters), so JOURNAL_RECORD_SIZE always fits them.
+void journalAccount(int accountIndex) {
+    markShardDirty(accountIndex);
+    if (journalFile == NULL) return;
+
+    char record[JOURNAL_RECORD_SIZE];
+    int length = snprintf(record, sizeof(record), "A|%d|%s|%s|%.2f|%d|%d|%d|%ld|%s\n",
+            accountAt(accountIndex)->accountNumber,
+            profileAt(accountIndex)->firstName,
+            profileAt(accountIndex)->lastName,
+            accountAt(accountIndex)->balance,
+            accountAt(accountIndex)->isActive,
+            accountAt(accountIndex)->isLocked,
+            accountAt(accountIndex)->isSavings,
+            accountAt(accountIndex)->lastInterestDate,
+            profileAt(accountIndex)->password);
+    journalAppend(record, length);
+}
+
+void journalTransaction(const Transaction* t) {
+    if (journalFile == NULL) return;
+
+    char record[JOURNAL_RECORD_SIZE];
+    int length = snprintf(record, sizeof(record), "T|%d|%d|%s|%.2f|%ld|%d|%s\n",
+            t->transactionId,
+            t->accountNumber,
+            transactionTypeName(t->type),
+            t->amount,
+            t->timestamp,
+            t->relatedAccount,
+            stringAt(t->description));
+    journalAppend(record, length);
+}
+
+// A record that does not fit is dropped rather than written without its
+// newline, which would end replay there.
+void journalAppend(const char* record, int length) {
+    if (length < 0 || length >= JOURNAL_RECORD_SIZE) {
+        printf(" WARNING: Journal record too long; not written.\n");
+        return;
+    }
+
+    pthread_mutex_lock(&journalLock);
+    if (journalPendingLength + length > journalPendingCapacity) {
+        size_t capacity = journalPendingCapacity ? journalPendingCapacity * 2 : 1 << 16;
+        while (capacity < journalPendingLength + length) capacity *= 2;
+        char *grown = realloc(journalPending, capacity);
+        if (grown == NULL) {
+            // Keep the operation going; the next checkpoint still captures it,
+            // but followers would silently miss it.
+            if (replicationFollowerCount > 0) replicationLost = 1;
+            pthread_mutex_unlock(&journalLock);
+            printf(" WARNING: Out of memory while buffering journal record.\n");
+            return;
+        }
+        journalPending = grown;
+        journalPendingCapacity = capacity;
+    }
+    memcpy(journalPending + journalPendingLength, record, length);
+    journalPendingLength += length;
+    journalAppendedLsn += length;
+    if (replicationFollowerCount > 0 &&
+        !replicationAppend(&replicationPending, &replicationPendingLength, &replicationPendingCapacity, record, length)) {
+        replicationLost = 1;
+    }
+    threadJournalLsn = journalAppendedLsn;
+    __atomic_fetch_add(&journalRecords, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&journalLock);
+}
+
+int writeJournalBuffer(const char* data, size_t length) {
+    if (journalFile == NULL) return 0;
+    if (length > 0 && fwrite(data, 1, length, journalFile) != length) return 0;
+    if (fflush(journalFile) != 0) return 0;
+#ifndef _WIN32
+    if (fsync(fileno(journalFile)) != 0) return 0;
+#endif
+    return 1;
+}
+
+// Swaps the pending buffer out and writes it with no lock held, so operations
+// keep appending while the disk catches up. Returns 0 when the records are
+// not durable.
+int flushJournal() {
+    pthread_mutex_lock(&journalWriteLock);
+    pthread_mutex_lock(&journalLock);
+    char *data = journalPending;
+    size_t length = journalPendingLength;
+    size_t capacity = journalPendingCapacity;
+    journalPending = journalWriting;
+    journalPendingCapacity = journalWritingCapacity;
+    journalPendingLength = 0;
+    journalWriting = data;
+    journalWritingCapacity = capacity;
+    uint64_t lsn = journalAppendedLsn;
+    pthread_mutex_unlock(&journalLock);
+
+    int written = length == 0 || writeJournalBuffer(data, length);
+    if (!written) printf(" CRITICAL ERROR: Cannot write journal '%s'; operations are not durable.\n", JOURNAL_FILE);
+
+    pthread_mutex_lock(&journalLock);
+    noteJournalWritten(lsn, written);
+    int durable = journalDurableLsn >= lsn;
+    pthread_mutex_unlock(&journalLock);
+    pthread_mutex_unlock(&journalWriteLock);
+    return durable;
+}
+
+// Called with journalLock held once the records up to lsn were written, or
+// failed to be.
+void noteJournalWritten(uint64_t lsn, int written) {
+    if (!written && lsn > journalFailedLsn) __atomic_store_n(&journalFailedLsn, lsn, __ATOMIC_RELAXED);
+    if (journalFailedLsn == 0 && lsn > journalDurableLsn) journalDurableLsn = lsn;
+    pthread_cond_broadcast(&journalFlushed);
+}
+
+// Returns 0 when the records up to lsn will not become durable.
+int waitForDurable(uint64_t lsn) {
+    pthread_mutex_lock(&journalLock);
+    durableWaiters++;
+    pthread_cond_signal(&persistWake);
+    while (journalDurableLsn < lsn && journalFailedLsn == 0 && persistenceRunning) {
+        pthread_cond_wait(&journalFlushed, &journalLock);
+    }
+    durableWaiters--;
+    int durable = journalDurableLsn >= lsn;
+    pthread_mutex_unlock(&journalLock);
+    return durable;
+}
+
+// Makes the operation's journal records durable, and folds the journal into a
+// full checkpoint once it has grown past CHECKPOINT_INTERVAL records and half
+// the ledger size, which keeps the amortised checkpoint cost per operation
+// constant as the ledger grows. With the persistence thread running both
+// happen in the background and this only waits when durableAck is set.
+// Returns 0 when the operation was meant to be durable and is not.
+int commitChanges() {
+    if (!journalMode) {
+        saveData();
+        return 1;
+    }
+
+    if (persistenceRunning) {
+        return durableAck ? waitForDurable(threadJournalLsn) : 1;
+    }
+
+    int durable = flushJournal();
+    if (checkpointDue()) {
+        beginExclusiveAccess();
+        if (checkpointDue()) writeCheckpoint();
+        endExclusiveAccess();
+    }
+    return durable;
+}
+
+// Moves the current journal segment to JOURNAL_FILE.old and starts a new one
+// on the same stream, so appenders never see it closed. If an earlier
+// background checkpoint failed, its rotated segment is still needed and the
+// current one is appended to it instead; the same copy serves platforms that
+// cannot rename an open file.
+int rotateJournal() {
+    FILE *rotated = fopen(JOURNAL_FILE ".old", "r");
+    if (rotated != NULL) fclose(rotated);
+    if (rotated != NULL || rename(JOURNAL_FILE, JOURNAL_FILE ".old") != 0) {
+        FILE *source = fopen(JOURNAL_FILE, "r");
+        FILE *target = fopen(JOURNAL_FILE ".old", "a");
+        int ok = source != NULL && target != NULL;
+        char block[8192];
+        size_t length;
+        while (ok && (length = fread(block, 1, sizeof(block), source)) > 0) {
+            ok = fwrite(block, 1, length, target) == length;
+        }
+        // The copy must be on disk before the segment is truncated below.
+        ok = ok && fflush(target) == 0;
+#ifndef _WIN32
+        ok = ok && fsync(fileno(target)) == 0;
+#endif
+        if (source != NULL) fclose(source);
+        if (target != NULL && fclose(target) != 0) ok = 0;
+        if (!ok) return 0;
+    }
+
+    if (freopen(JOURNAL_FILE, "w", journalFile) == NULL) {
+        journalFile = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+// Checkpoints without stalling operations for the disk write. Exclusive access
+// is held only to copy the dirty account shards and rollups and cut the
+// journal at the same point; the snapshot is written afterwards from the copy.
+// archiveLock is taken before exclusive access is released, so a foreground
+// checkpoint cannot commit in between and be overwritten by this older copy.
+void backgroundCheckpoint() {
+    uint64_t start = nowNanoseconds();
+    Admin adminRows[5];
+
+    lockCheckpointFiles();
+    beginExclusiveAccess();
+    int accounts = accountCount;
+    int transactions = transactionCount;
+    int strings = stringCount;
+    int adminTotal = adminCount;
+    memcpy(adminRows, admins, sizeof(adminRows));
+    int *shards = calloc(((accounts + SHARD_SIZE - 1) >> SHARD_SHIFT) + 1, sizeof(int));
+    if (shards == NULL ||
+        !ensureChunkCapacity(snapshotAccountChunks, &snapshotAccountChunkCount, sizeof(Account), accounts) ||
+        !ensureChunkCapacity(snapshotProfileChunks, &snapshotProfileChunkCount, sizeof(AccountProfile), accounts)) {
+        endExclusiveAccess();
+        unlockCheckpointFiles();
+        free(shards);
+        return;
+    }
+    pthread_mutex_lock(&archiveLock);
+    int shardTotal = collectDirtyShards(accounts, shards);
+    RollupBatch rollups;
+    if (!collectDirtyRollups(&rollups)) {
+        restoreDirtyShards(shards, shardTotal);
+        pthread_mutex_unlock(&archiveLock);
+        endExclusiveAccess();
+        unlockCheckpointFiles();
+        free(shards);
+        return;
+    }
+    for (int i = 0; i < shardTotal; i++) {
+        int first = shards[i] << SHARD_SHIFT;
+        int rows = accounts - first < SHARD_SIZE ? accounts - first : SHARD_SIZE;
+        int c = first >> CHUNK_SHIFT, offset = first & (CHUNK_SIZE - 1);
+        memcpy((Account*)snapshotAccountChunks[c] + offset, (Account*)accountChunks[c] + offset, rows * sizeof(Account));
+        memcpy((AccountProfile*)snapshotProfileChunks[c] + offset, (AccountProfile*)profileChunks[c] + offset,
+               rows * sizeof(AccountProfile));
+    }
+
+    pthread_mutex_lock(&journalWriteLock);
+    pthread_mutex_lock(&journalLock);
+    char *data = journalPending;
+    size_t length = journalPendingLength;
+    size_t capacity = journalPendingCapacity;
+    journalPending = journalWriting;
+    journalPendingCapacity = journalWritingCapacity;
+    journalPendingLength = 0;
+    journalWriting = data;
+    journalWritingCapacity = capacity;
+    uint64_t lsn = journalAppendedLsn;
+    __atomic_store_n(&journalRecords, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&journalLock);
+    endExclusiveAccess();
+
+    // Everything before the cut goes to the segment the snapshot will cover.
+    int written = writeJournalBuffer(data, length);
+    int ok = written && rotateJournal();
+    pthread_mutex_lock(&journalLock);
+    noteJournalWritten(lsn, written);
+    pthread_mutex_unlock(&journalLock);
+    pthread_mutex_unlock(&journalWriteLock);
+
+    if (!ok) {
+        printf(" WARNING: Cannot rotate journal '%s'. Checkpoint postponed.\n", JOURNAL_FILE);
+    } else {
+        int archived = sealArchiveSegment(transactions);
+        ok = writeSnapshot(snapshotAccountChunks, snapshotProfileChunks, accounts, transactions, strings,
+                           adminRows, adminTotal, archived, shards, shardTotal, &rollups);
+        if (ok) {
+            commitArchive(archived);
+            remove(JOURNAL_FILE ".old");
+            // The snapshot holds every record up to the cut, including any
+            // the journal lost before it.
+            pthread_mutex_lock(&journalLock);
+            if (journalFailedLsn != 0 && journalFailedLsn <= lsn) {
+                __atomic_store_n(&journalFailedLsn, 0, __ATOMIC_RELAXED);
+                if (lsn > journalDurableLsn) journalDurableLsn = lsn;
+                pthread_cond_broadcast(&journalFlushed);
+            }
+            pthread_mutex_unlock(&journalLock);
+            recordOperation(METRIC_CHECKPOINT, TXN_OK, start);
+        }
+    }
+    if (!ok) {
+        restoreDirtyShards(shards, shardTotal);
+        restoreDirtyRollups(&rollups);
+        recordOperation(METRIC_CHECKPOINT, TXN_SAVE_FAILED, start);
+    }
+    pthread_mutex_unlock(&archiveLock);
+    unlockCheckpointFiles();
+    free(rollups.records);
+    free(shards);
+}
+
+void* persistenceMain(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&journalLock);
+    while (persistenceRunning) {
+        if (durableWaiters == 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += persistIntervalMs / 1000;
+            deadline.tv_nsec += (long)(persistIntervalMs % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&persistWake, &journalLock, &deadline);
+        }
+        pthread_mutex_unlock(&journalLock);
+
+        // Interest falls due on this tick too, so it is paid without an admin
+        // and caught up right after a restart.
+        runDueInterest(time(NULL), 0);
+        flushJournal();
+        if (checkpointDue()) backgroundCheckpoint();
+        pthread_mutex_lock(&journalLock);
+    }
+    pthread_mutex_unlock(&journalLock);
+    flushJournal();
+    return NULL;
+}
+
+void startPersistence() {
+    if (journalFile == NULL || persistenceRunning) return;
+
+    persistenceRunning = 1;
+    if (pthread_create(&persistenceThread, NULL, persistenceMain, NULL) != 0) {
+        printf(" WARNING: Cannot start persistence thread. Flushing synchronously.\n");
+        persistenceRunning = 0;
+    }
+}
+
+void stopPersistence() {
+    if (!persistenceRunning) return;
+
+    pthread_mutex_lock(&journalLock);
+    persistenceRunning = 0;
+    pthread_cond_signal(&persistWake);
+    pthread_cond_broadcast(&journalFlushed);
+    pthread_mutex_unlock(&journalLock);
+    pthread_join(persistenceThread, NULL);
+}
+
+// A journal that lost records is checkpointed at once to close the gap.
+int checkpointDue() {
+    if (__atomic_load_n(&journalFailedLsn, __ATOMIC_RELAXED) != 0) return 1;
+    int records = __atomic_load_n(&journalRecords, __ATOMIC_RELAXED);
+    return records >= CHECKPOINT_INTERVAL && records >= __atomic_load_n(&transactionCount, __ATOMIC_RELAXED) / 2;
+}
+
+// Held while a checkpoint replaces snapshot files and rotates the journal, so
+// a follower loading them meanwhile never sees half of each. Only taken once
+// replication has opened the lock file.
+void lockCheckpointFiles() {
+#ifndef _WIN32
+    if (checkpointLockFd >= 0) flock(checkpointLockFd, LOCK_EX);
+#endif
+}
+
+void unlockCheckpointFiles() {
+#ifndef _WIN32
+    if (checkpointLockFd >= 0) flock(checkpointLockFd, LOCK_UN);
+#endif
+}
+
+int replicationAppend(char** data, size_t* length, size_t* capacity, const char* bytes, size_t count) {
+    if (*length + count > *capacity) {
+        size_t grownCapacity = *capacity ? *capacity * 2 : 1 << 16;
+        while (grownCapacity < *length + count) grownCapacity *= 2;
+        char *grown = realloc(*data, grownCapacity);
+        if (grown == NULL) return 0;
+        *data = grown;
+        *capacity = grownCapacity;
+    }
+    memcpy(*data + *length, bytes, count);
+    *length += count;
+    return 1;
+}
+
+// Replays the rotated segment left by an unfinished background checkpoint,
+// then the live journal, on top of the loaded checkpoint.
+void replayJournal() {
+    int checkpointTransactions = transactionCount;
+    int replayed = replayJournalFile(JOURNAL_FILE ".old", checkpointTransactions);
+    replayed += replayJournalFile(JOURNAL_FILE, checkpointTransactions);
+
+    // A crash can leave a row's record on disk without that of a lower id
+    // journaled by another thread, and the empty slot would be checkpointed
+    // as a row of its own. The ledger is cut back to the first hole; a
+    // follower keeps the rows after it for the stream to complete, see
+    // trimFollowedLedger().
+    for (int i = checkpointTransactions; !followerMode && i < transactionCount; i++) {
+        if (transactionAt(i)->transactionId != i + 1) {
+            printf(" WARNING: The journal lacks transaction %d; the %d after it are dropped.\n",
+                   i + 1, transactionCount - i - 1);
+            transactionCount = i;
+            journalTrimmed = 1;
+        }
+    }
+
+    journalRecords = replayed;
+    if (transactionCount > checkpointTransactions) rebuildTransactionChains();
+    if (replayed > 0) {
+        printf(" Replayed %d journal records. Accounts: %d, Transactions: %d\n",
+               replayed, accountCount, transactionCount);
+    }
+}
+
+int replayJournalFile(const char* path, int checkpointTransactions) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return 0;
+
+    char line[JOURNAL_RECORD_SIZE];
+    int replayed = 0;
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), file)) {
+        lineNumber++;
+        if (line[strcspn(line, "\n")] != '\n') {
+            printf(" WARNING: Incomplete record at %s line %d ignored.\n", path, lineNumber);
+            break;
+        }
+
+        if (line[0] == 'A') {
+            Account a;
+            AccountProfile profile;
+            if (!parseAccountRecord(line, &a, &profile)) {
+                printf(" WARNING: Corrupt record at %s line %d. Stopping replay...\n", path, lineNumber);
+                break;
+            }
+
+            int accIndex = findAccountByNumber(a.accountNumber);
+            if (accIndex != -1) {
+                a.lastTransaction = accountAt(accIndex)->lastTransaction;
+                a.olderBalance = -1;
+                a.balanceEpoch = 0;
+                adjustAggregates(accIndex, -1);
+                *accountAt(accIndex) = a;
+                adjustAggregates(accIndex, 1);
+                *profileAt(accIndex) = profile;
+                markShardDirty(accIndex);
+            } else if (appendAccount(&a, &profile) == -1) {
+                printf(" WARNING: Out of memory while replaying journal.\n");
+                break;
+            }
+        } else if (line[0] == 'T') {
+            Transaction t;
+            char description[MAX_DESCRIPTION_LENGTH];
+            if (!parseTransactionRecord(line, &t, description)) {
+                printf(" WARNING: Corrupt record at %s line %d. Stopping replay...\n", path, lineNumber);
+                break;
+            }
+
+            // Records already folded into the checkpoint are skipped, so a crash
+            // between writing the checkpoint and resetting the journal is harmless.
+            // Concurrent sessions can journal entries slightly out of id order,
+            // so each one is placed by id and the history chains rebuilt after.
+            if (t.transactionId <= checkpointTransactions) continue;
+            t.description = internString(description);
+            if (t.description == -1 || !ensureTransactionCapacity(t.transactionId)) {
+                printf(" WARNING: Out of memory while replaying journal.\n");
+                break;
+            }
+            *transactionAt(t.transactionId - 1) = t;
+            if (t.transactionId > transactionCount) transactionCount = t.transactionId;
+        } else {
+            printf(" WARNING: Unknown record at %s line %d. Stopping replay...\n", path, lineNumber);
+            break;
+        }
+        replayed++;
+    }
+
+    fclose(file);
+    return replayed;
+}
+
+// Parse journal records, as written by journalAccount() and
+// journalTransaction(). They return 0 for a malformed record.
+int parseAccountRecord(const char* line, Account* a, AccountProfile* profile) {
+    return sscanf(line, "A|%d|%49[^|]|%49[^|]|%lf|%d|%d|%d|%ld|%49[^\n]",
+                  &a->accountNumber, profile->firstName, profile->lastName, &a->balance,
+                  &a->isActive, &a->isLocked, &a->isSavings,
+                  &a->lastInterestDate, profile->password) == 9;
+}
+
+int parseTransactionRecord(const char* line, Transaction* t, char* description) {
+    char type[20];
+    description[0] = '\0';
+    if (sscanf(line, "T|%d|%d|%19[^|]|%lf|%ld|%d|%99[^\n]",
+               &t->transactionId, &t->accountNumber, type, &t->amount,
+               &t->timestamp, &t->relatedAccount, description) < 6) {
+        return 0;
+    }
+    t->type = transactionTypeFromName(type);
+    return 1;
+}
+
+void updateAccount() {
+    printf("\n--- Update Account ---\n");
+    printf("Enter account number to update: ");
+    int accNum;
+    if (scanf("%d", &accNum) != 1) {
+        printf(" Invalid account number!\n");
+        clearInputBuffer();
+        return;
+    }
+    clearInputBuffer();
+
+    int accIndex = findAccountByNumber(accNum);
+    if (accIndex == -1) {
+        printf(" Account not found.\n");
+        return;
+    }
+
+    printf("\nCurrent Account Details:\n");
+    printAccountDetails(accIndex);
+
+    printf("\n Enter new first name (or press Enter to keep current): ");
+    char firstName[MAX_NAME_LENGTH];
+    fgets(firstName, sizeof(firstName), stdin);
+
+    printf(" Enter new last name (or press Enter to keep current): ");
+    char lastName[MAX_NAME_LENGTH];
+    fgets(lastName, sizeof(lastName), stdin);
+
+    // Renaming moves the account between name index lists, so it runs with
+    // exclusive access.
+    beginExclusiveAccess();
+    nameIndexRemove(accIndex);
+    if (strlen(firstName) > 1) {
+        firstName[strcspn(firstName, "\n")] = 0;
+        strcpy(profileAt(accIndex)->firstName, firstName);
+    }
+    if (strlen(lastName) > 1) {
+        lastName[strcspn(lastName, "\n")] = 0;
+        strcpy(profileAt(accIndex)->lastName, lastName);
+    }
+    nameIndexAdd(accIndex);
+    journalAccount(accIndex);
+    createTransaction(accNum, TXN_TYPE_ACCOUNT_UPDATE, 0, 0, "Account information modified");
+    endExclusiveAccess();
+
+    printf(" Account updated successfully!\n");
+    commitChanges();
+}
+
+void deleteAccount() {
+    printf("\n--- Delete Account ---\n");
+    printf("Enter account number to delete: ");
+    int accNum;
+    if (scanf("%d", &accNum) != 1) {
+        printf(" Invalid account number!\n");
+        clearInputBuffer();
+        return;
+    }
+    clearInputBuffer();
+
+    int accIndex = findAccountByNumber(accNum);
+    if (accIndex == -1) {
+        printf(" Account not found.\n");
+        return;
+    }
+
+    printAccountDetails(accIndex);
+    printf("\n Are you sure you want to delete this account? (y/n): ");
+    char confirm;
+    if (scanf("%c", &confirm) != 1) confirm = 'n';
+    clearInputBuffer();
+
+    if (confirm == 'y' || confirm == 'Y') {
+        beginSharedAccess();
+        lockAccount(accIndex);
+        adjustAggregates(accIndex, -1);
+        accountAt(accIndex)->isActive = 0;
+        journalAccount(accIndex);
+        createTransaction(accNum, TXN_TYPE_ACCOUNT_CLOSE, 0, 0, "Account deactivated");
+        unlockAccount(accIndex);
+        endSharedAccess();
+
+        printf(" Account marked as inactive.\n");
+        commitChanges();
+    } else {
+        printf(" Account deletion cancelled.\n");
+    }
+}
+
+void deposit() {
+    printf("\n--- Deposit ---\n");
+    printf("Current Balance: %.2f\n", accountAt(currentUserAccount)->balance);
+
+    printf("Enter amount to deposit: ");
+    double amount;
+    while (scanf("%lf", &amount) != 1 || amount <= 0) {
+        printf(" Invalid amount! Please enter a positive number: ");
+        clearInputBuffer();
+    }
+    clearInputBuffer();
+
+    int result = applyDeposit(currentUserAccount, amount);
+    if (result != TXN_OK) {
+        printf(" Deposit failed: %s.\n", transactionResultMessage(result));
+        return;
+    }
+
+    printf(" Deposit successful. New Balance: %.2f\n", accountAt(currentUserAccount)->balance);
+    commitChanges();
+}
+
+void withdraw() {
+    printf("\n--- Withdraw ---\n");
+    printf("Current Balance: %.2f\n", accountAt(currentUserAccount)->balance);
+
+    printf("Enter amount to withdraw: ");
+    double amount;
+    while (scanf("%lf", &amount) != 1 || amount <= 0) {
+        printf(" Invalid amount! Please enter a positive number: ");
+        clearInputBuffer();
+    }
+    clearInputBuffer();
+
+    int result = applyWithdrawal(currentUserAccount, amount);
+    if (result != TXN_OK) {
+        printf(" Withdrawal failed: %s.\n", transactionResultMessage(result));
+        return;
+    }
+
+    printf(" Withdrawal successful. New Balance: %.2f\n", accountAt(currentUserAccount)->balance);
+    commitChanges();
+}
+
+void transfer() {
+    printf("\n--- Transfer ---\n");
+    printf("Current Balance: %.2f\n", accountAt(currentUserAccount)->balance);
+
+    printf("Enter destination account number: ");
+    int destAccNum;
+    if (scanf("%d", &destAccNum) != 1) {
+        printf(" Invalid account number!\n");
+        clearInputBuffer();
+        return;
+    }
+    clearInputBuffer();
+
+    int destAccIndex = findAccountByNumber(destAccNum);
+    if (destAccIndex == -1 || !accountAt(destAccIndex)->isActive) {
+        printf(" Destination account not found or inactive.\n");
+        return;
+    }
+
+    if (destAccIndex == currentUserAccount) {
+        printf(" Cannot transfer to same account.\n");
+        return;
+    }
+
+    printf("Destination: %s %s\n", profileAt(destAccIndex)->firstName, profileAt(destAccIndex)->lastName);
+
+    printf("Enter amount to transfer: ");
+    double amount;
+    while (scanf("%lf", &amount) != 1 || amount <= 0) {
+        printf(" Invalid amount! Please enter a positive number: ");
+        clearInputBuffer();
+    }
+    clearInputBuffer();
+
+    int result = applyTransfer(currentUserAccount, destAccIndex, amount);
+    if (result != TXN_OK) {
+        printf(" Transfer failed: %s.\n", transactionResultMessage(result));
+        return;
+    }
+
+    printf(" Transfer successful. New Balance: %.2f\n", accountAt(currentUserAccount)->balance);
+    commitChanges();
+}
+
+int validateTransaction(int accountIndex, double amount) {
+    return checkTransaction(accountIndex, amount) == TXN_OK;
+}
+
+int checkTransaction(int accountIndex, double amount) {
+    if (!accountAt(accountIndex)->isActive) return TXN_INACTIVE;
+    if (accountAt(accountIndex)->isLocked) return TXN_LOCKED;
+    if (accountAt(accountIndex)->balance < amount) return TXN_INSUFFICIENT_FUNDS;
+    return TXN_OK;
+}
+
+// Rules read [withdraw-|transfer-]amount|count:LIMIT/WINDOW, the window in
+// seconds or suffixed m, h or d: "amount:5000/1d" caps the money leaving an
+// account per day and "transfer-count:5/1m" the transfers out per minute.
+int parseVelocityRule(const char* text) {
+    VelocityRule rule = {VELOCITY_WITHDRAWALS | VELOCITY_TRANSFERS, 0, 0, 0, 0};
+    const char *spec = text;
+    if (strncmp(spec, "withdraw-", 9) == 0) {
+        rule.scope = VELOCITY_WITHDRAWALS;
+        spec += 9;
+    } else if (strncmp(spec, "transfer-", 9) == 0) {
+        rule.scope = VELOCITY_TRANSFERS;
+        spec += 9;
+    }
+
+    char measure[8];
+    long window = 0;
+    int used = 0;
+    if (sscanf(spec, "%7[a-z]:%lf/%ld%n", measure, &rule.limit, &window, &used) != 3) used = 0;
+    const char *unit = spec + used;
+    long scale = *unit == 'd' ? 86400 : *unit == 'h' ? 3600 : *unit == 'm' ? 60 : 1;
+    if (*unit != '\0' && strchr("smhd", *unit) != NULL) unit++;
+    rule.countsOperations = strcmp(measure, "count") == 0;
+    if (used == 0 || *unit != '\0' || (!rule.countsOperations && strcmp(measure, "amount") != 0) ||
+        !(rule.limit >= 0) || window < 1 || window > 366L * 86400 / scale) {
+        printf(" Invalid velocity rule '%s'.\n", text);
+        return 0;
+    }
+    if (velocityRuleCount == VELOCITY_MAX_RULES) {
+        printf(" At most %d velocity rules are supported.\n", VELOCITY_MAX_RULES);
+        return 0;
+    }
+    rule.window = (int)(window * scale);
+    rule.bucketSeconds = (rule.window + VELOCITY_BUCKETS - 2) / (VELOCITY_BUCKETS - 1);
+    velocityRules[velocityRuleCount++] = rule;
+    return 1;
+}
+
+// Empties the buckets that fall out of the ring as it moves on to bucket.
+// At most VELOCITY_BUCKETS are touched however long the account was idle.
+void advanceVelocityWindow(VelocityWindow* window, int64_t bucket) {
+    if (bucket <= window->newest) return;
+    if (bucket - window->newest >= VELOCITY_BUCKETS) {
+        memset(window->buckets, 0, sizeof(window->buckets));
+    } else {
+        for (int64_t b = window->newest + 1; b <= bucket; b++) window->buckets[b % VELOCITY_BUCKETS] = 0;
+    }
+    window->newest = bucket;
+}
+
+// Counts an operation at time when against every rule covering scope. Times
+// older than a ring reaches are dropped, so the ledger can be replayed in any
+// order.
+void addVelocity(int accountIndex, int scope, double amount, time_t when) {
+    VelocityWindow *windows = velocityAt(accountIndex);
+    for (int r = 0; r < velocityRuleCount; r++) {
+        const VelocityRule *rule = &velocityRules[r];
+        if (!(rule->scope & scope)) continue;
+        int64_t bucket = (int64_t)when / rule->bucketSeconds;
+        advanceVelocityWindow(&windows[r], bucket);
+        if (windows[r].newest - bucket < VELOCITY_BUCKETS) {
+            windows[r].buckets[bucket % VELOCITY_BUCKETS] += rule->countsOperations ? 1 : amount;
+        }
+    }
+}
+
+// Checks an operation against the velocity rules and, if every rule allows
+// it, counts it. The caller holds the account's lock and must go on to apply
+// the operation. Costs a fixed VELOCITY_BUCKETS additions per rule and never
+// allocates.
+int chargeVelocity(int accountIndex, int scope, double amount) {
+    if (velocityRuleCount == 0) return TXN_OK;
+    time_t now = time(NULL);
+    VelocityWindow *windows = velocityAt(accountIndex);
+    for (int r = 0; r < velocityRuleCount; r++) {
+        const VelocityRule *rule = &velocityRules[r];
+        if (!(rule->scope & scope)) continue;
+        advanceVelocityWindow(&windows[r], (int64_t)now / rule->bucketSeconds);
+        double used = 0;
+        for (int b = 0; b < VELOCITY_BUCKETS; b++) used += windows[r].buckets[b];
+        if (used + (rule->countsOperations ? 1 : amount) > rule->limit) return TXN_VELOCITY_LIMIT;
+    }
+    addVelocity(accountIndex, scope, amount, now);
+    return TXN_OK;
+}
+
+// Counters are not saved. On load they are refilled from the ledger rows
+// within the longest window, which the time index finds without a full scan.
+void rebuildVelocity() {
+    if (velocityRuleCount == 0) return;
+    int span = 0;
+    for (int r = 0; r < velocityRuleCount; r++) {
+        int reach = velocityRules[r].bucketSeconds * VELOCITY_BUCKETS;
+        if (reach > span) span = reach;
+    }
+    time_t now = time(NULL);
+    int first, last;
+    findTransactionRange(now - span, now, &first, &last);
+    for (int i = first; i < last; i++) {
+        const Transaction *t = transactionAt(i);
+        int scope = t->type == TXN_TYPE_WITHDRAWAL ? VELOCITY_WITHDRAWALS :
+                    t->type == TXN_TYPE_TRANSFER ? VELOCITY_TRANSFERS : 0;
+        if (scope == 0 || t->timestamp < now - span) continue;
+        int accIndex = findAccountByNumber(t->accountNumber);
+        if (accIndex != -1) addVelocity(accIndex, scope, t->amount, t->timestamp);
+    }
+}
+
+const char* transactionResultMessage(int result) {
+    switch (result) {
+        case TXN_OK: return "OK";
+        case TXN_NOT_FOUND: return "account not found";
+        case TXN_INACTIVE: return "account inactive";
+        case TXN_LOCKED: return "account locked";
+        case TXN_INSUFFICIENT_FUNDS: return "insufficient funds";
+        case TXN_INVALID_AMOUNT: return "invalid amount";
+        case TXN_SAME_ACCOUNT: return "cannot transfer to same account";
+        case TXN_NOT_ELIGIBLE: return "not eligible for interest";
+        case TXN_BAD_COMMAND: return "malformed command";
+        case TXN_BAD_PASSWORD: return "invalid password";
+        case TXN_VELOCITY_LIMIT: return "velocity limit reached";
+        case TXN_SAVE_FAILED: return "save failed";
+        default: return "unknown error";
+    }
+}
+
+// The apply* functions hold the business rules shared by the menus and batch
+// mode. They update balances and record the ledger entry; the caller decides
+// when to commit. The ledger entry updates the accounts' rollup heads, which
+// live apart from Account, so their lines are fetched while the checks run.
+int applyDeposit(int accountIndex, double amount) {
+    uint64_t start = nowNanoseconds();
+    if (!(amount > 0)) return recordOperation(METRIC_DEPOSIT, TXN_INVALID_AMOUNT, start);
+
+    beginSharedAccess();
+    lockAccount(accountIndex);
+    __builtin_prefetch(rollupHeadsAt(accountIndex), 1);
+    int result = checkTransaction(accountIndex, 0);
+    if (result == TXN_OK) {
+        adjustAggregates(accountIndex, -1);
+        setBalance(accountIndex, accountAt(accountIndex)->balance + amount, nextBalanceEpoch());
+        adjustAggregates(accountIndex, 1);
+        journalAccount(accountIndex);
+        createTransaction(accountAt(accountIndex)->accountNumber, TXN_TYPE_DEPOSIT, amount, 0, "Cash deposit");
+    }
+    unlockAccount(accountIndex);
+    endSharedAccess();
+    return recordOperation(METRIC_DEPOSIT, result, start);
+}
+
+int applyWithdrawal(int accountIndex, double amount) {
+    uint64_t start = nowNanoseconds();
+    if (!(amount > 0)) return recordOperation(METRIC_WITHDRAW, TXN_INVALID_AMOUNT, start);
+
+    beginSharedAccess();
+    lockAccount(accountIndex);
+    __builtin_prefetch(rollupHeadsAt(accountIndex), 1);
+    int result = checkTransaction(accountIndex, amount);
+    if (result == TXN_OK) result = chargeVelocity(accountIndex, VELOCITY_WITHDRAWALS, amount);
+    if (result == TXN_OK) {
+        adjustAggregates(accountIndex, -1);
+        setBalance(accountIndex, accountAt(accountIndex)->balance - amount, nextBalanceEpoch());
+        adjustAggregates(accountIndex, 1);
+        journalAccount(accountIndex);
+        createTransaction(accountAt(accountIndex)->accountNumber, TXN_TYPE_WITHDRAWAL, amount, 0, "Cash withdrawal");
+    }
+    unlockAccount(accountIndex);
+    endSharedAccess();
+    return recordOperation(METRIC_WITHDRAW, result, start);
+}
+
+int applyTransfer(int fromIndex, int toIndex, double amount) {
+    uint64_t start = nowNanoseconds();
+    if (!(amount > 0)) return recordOperation(METRIC_TRANSFER, TXN_INVALID_AMOUNT, start);
+    if (fromIndex == toIndex) return recordOperation(METRIC_TRANSFER, TXN_SAME_ACCOUNT, start);
+
+    beginSharedAccess();
+    lockAccountPair(fromIndex, toIndex);
+    __builtin_prefetch(rollupHeadsAt(fromIndex), 1);
+    __builtin_prefetch(rollupHeadsAt(toIndex), 1);
+    int result = accountAt(toIndex)->isActive ? checkTransaction(fromIndex, amount) : TXN_INACTIVE;
+    if (result == TXN_OK) result = chargeVelocity(fromIndex, VELOCITY_TRANSFERS, amount);
+    if (result == TXN_OK) {
+        adjustAggregates(fromIndex, -1);
+        adjustAggregates(toIndex, -1);
+        uint64_t epoch = nextBalanceEpoch();
+        setBalance(fromIndex, accountAt(fromIndex)->balance - amount, epoch);
+        setBalance(toIndex, accountAt(toIndex)->balance + amount, epoch);
+        adjustAggregates(fromIndex, 1);
+        adjustAggregates(toIndex, 1);
+
+        // Descriptions are kept to MAX_DESCRIPTION_LENGTH - 1 characters.
+        char name[MAX_NAME_LENGTH * 2], desc[MAX_DESCRIPTION_LENGTH];
+        formatFullName(name, sizeof(name), toIndex);
+        snprintf(desc, sizeof(desc), "Transfer to %.*s", MAX_DESCRIPTION_LENGTH - 13, name);
+        journalAccount(fromIndex);
+        journalAccount(toIndex);
+        createTransaction(accountAt(fromIndex)->accountNumber, TXN_TYPE_TRANSFER, amount, accountAt(toIndex)->accountNumber, desc);
+    }
+    unlockAccountPair(fromIndex, toIndex);
+    endSharedAccess();
+    return recordOperation(METRIC_TRANSFER, result, start);
+}
+
+int applyInterest(int accountIndex, time_t now, double* interestOut) {
+    uint64_t start = nowNanoseconds();
+    beginSharedAccess();
+    lockAccount(accountIndex);
+    Account *a = accountAt(accountIndex);
+    int result = TXN_NOT_ELIGIBLE;
+    if (a->isSavings && a->isActive && !a->isLocked &&
+        difftime(now, a->lastInterestDate) >= INTEREST_PERIOD) {
+        // Each period missed while the bank was down is paid in turn, so it
+        // compounds, and the date moves on by whole periods so the schedule
+        // does not drift.
+        char desc[100];
+        snprintf(desc, sizeof(desc), "Monthly interest @ %.1f%%", INTEREST_RATE * 100);
+        double balance = a->balance, total = 0;
+        adjustAggregates(accountIndex, -1);
+        while (difftime(now, a->lastInterestDate) >= INTEREST_PERIOD) {
+            double interest = balance * INTEREST_RATE;
+            balance += interest;
+            a->lastInterestDate += INTEREST_PERIOD;
+            total += interest;
+            createTransaction(a->accountNumber, TXN_TYPE_INTEREST, interest, 0, desc);
+        }
+        setBalance(accountIndex, balance, nextBalanceEpoch());
+        adjustAggregates(accountIndex, 1);
+        journalAccount(accountIndex);
+        scheduleInterest(accountIndex);
+        if (interestOut) *interestOut = total;
+        result = TXN_OK;
+    }
+    unlockAccount(accountIndex);
+    endSharedAccess();
+    return recordOperation(METRIC_INTEREST, result, start);
+}
+
+void balanceInquiry() {
+    uint64_t start = nowNanoseconds();
+    printf("\n--- Balance Inquiry ---\n");
+    printf("==========================================\n");
+    printf("Account Number: %d\n", accountAt(currentUserAccount)->accountNumber);
+    printf("Account Holder: %s %s\n", profileAt(currentUserAccount)->firstName, profileAt(currentUserAccount)->lastName);
+    printf("Account Type: %s\n", accountAt(currentUserAccount)->isSavings ? "Savings" : "Current");
+    printf("Current Balance: %.2f\n", accountAt(currentUserAccount)->balance);
+    printf("==========================================\n");
+    beginSharedAccess();
+    lockAccount(currentUserAccount);
+    createTransaction(accountAt(currentUserAccount)->accountNumber, TXN_TYPE_BALANCE_CHECK, 0, 0, "Balance inquiry");
+    unlockAccount(currentUserAccount);
+    endSharedAccess();
+    recordOperation(METRIC_BALANCE, TXN_OK, start);
+}
+
+void calculateInterest() {
+    printf("\n--- Calculate Interest ---\n");
+    int count = runDueInterest(time(NULL), 1);
+    printf(" Interest calculated for %d savings accounts.\n", count);
+    commitChanges();
+}
+
+int interestQueueReserve(InterestQueue* queue, size_t size) {
+    if (size <= queue->capacity) return 1;
+    size_t capacity = queue->capacity ? queue->capacity : 1024;
+    while (capacity < size) capacity *= 2;
+    InterestEntry *grown = realloc(queue->entries, capacity * sizeof(InterestEntry));
+    if (grown == NULL) return 0;
+    queue->entries = grown;
+    queue->capacity = capacity;
+    return 1;
+}
+
+void interestQueueSiftDown(InterestQueue* queue, size_t i) {
+    InterestEntry entry = queue->entries[i];
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= queue->size) break;
+        if (child + 1 < queue->size && queue->entries[child + 1].due < queue->entries[child].due) child++;
+        if (queue->entries[child].due >= entry.due) break;
+        queue->entries[i] = queue->entries[child];
+        i = child;
+    }
+    queue->entries[i] = entry;
+}
+
+int interestQueuePush(InterestQueue* queue, time_t due, int slot) {
+    if (!interestQueueReserve(queue, queue->size + 1)) return 0;
+    size_t i = queue->size++;
+    while (i > 0 && queue->entries[(i - 1) / 2].due > due) {
+        queue->entries[i] = queue->entries[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    queue->entries[i].due = due;
+    queue->entries[i].slot = slot;
+    return 1;
+}
+
+// Queues an account's next interest date if it can earn interest. The caller
+// holds the account's stripe lock or exclusive access.
+void scheduleInterest(int accountIndex) {
+    const Account *a = accountAt(accountIndex);
+    if (!a->isSavings || !a->isActive || a->isLocked) return;
+
+    pthread_mutex_lock(&interestLock);
+    int ok = interestQueuePush(&interestQueue, a->lastInterestDate + INTEREST_PERIOD, accountIndex);
+    pthread_mutex_unlock(&interestLock);
+    if (!ok) printf(" WARNING: Out of memory while scheduling interest.\n");
+}
+
+void rebuildInterestSchedule() {
+    pthread_mutex_lock(&interestLock);
+    interestQueue.size = 0;
+    for (int i = 0; i < accountCount; i++) {
+        const Account *a = accountAt(i);
+        if (!a->isSavings || !a->isActive || a->isLocked) continue;
+        if (!interestQueueReserve(&interestQueue, interestQueue.size + 1)) {
+            printf(" WARNING: Out of memory while scheduling interest.\n");
+            break;
+        }
+        interestQueue.entries[interestQueue.size].due = a->lastInterestDate + INTEREST_PERIOD;
+        interestQueue.entries[interestQueue.size].slot = i;
+        interestQueue.size++;
+    }
+    for (size_t i = interestQueue.size / 2; i-- > 0;) interestQueueSiftDown(&interestQueue, i);
+    pthread_mutex_unlock(&interestLock);
+}
+
+// Pays every account whose interest date has come, taking them off the queue
+// in due order, so the cost follows the accounts due rather than the number
+// of accounts. Returns how many were paid.
+int runDueInterest(time_t now, int verbose) {
+    int count = 0;
+    for (;;) {
+        pthread_mutex_lock(&interestLock);
+        if (interestQueue.size == 0 || interestQueue.entries[0].due > now) {
+            pthread_mutex_unlock(&interestLock);
+            break;
+        }
+        int slot = interestQueue.entries[0].slot;
+        interestQueue.entries[0] = interestQueue.entries[--interestQueue.size];
+        if (interestQueue.size > 0) interestQueueSiftDown(&interestQueue, 0);
+        pthread_mutex_unlock(&interestLock);
+
+        double interest;
+        if (applyInterest(slot, now, &interest) == TXN_OK) {
+            if (verbose) printf("Account %d: Interest %.2f added\n", accountAt(slot)->accountNumber, interest);
+            count++;
+        }
+    }
+    return count;
+}
+
+// Parses the next whitespace-delimited token in place and advances *cursor.
+char* nextBatchToken(char** cursor) {
+    char *p = *cursor;
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    if (*p == '\0') {
+        *cursor = p;
+        return NULL;
+    }
+    char *token = p;
+    while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+    if (*p) *p++ = '\0';
+    *cursor = p;
+    return token;
+}
+
+int parseBatchAccount(const char* token, int* accountIndex) {
+    if (token == NULL) return TXN_BAD_COMMAND;
+    char *end;
+    long number = strtol(token, &end, 10);
+    if (*end != '\0' || number <= 0 || number > 2147483647L) return TXN_BAD_COMMAND;
+    *accountIndex = findAccountByNumber((int)number);
+    return *accountIndex == -1 ? TXN_NOT_FOUND : TXN_OK;
+}
+
+int parseBatchAmount(const char* token, double* amount) {
+    if (token == NULL) return TXN_BAD_COMMAND;
+    char *end;
+    *amount = strtod(token, &end);
+    if (*end != '\0') return TXN_BAD_COMMAND;
+    return *amount > 0 && *amount < 1e15 ? TXN_OK : TXN_INVALID_AMOUNT;
+}
+
+int applyBatchLine(char* line) {
+    char *cursor = line;
+    char *command = nextBatchToken(&cursor);
+    if (command == NULL || command[0] == '#') return TXN_SKIPPED;
+
+    int from = -1, to = -1, result;
+    double amount = 0;
+    enum { BATCH_DEPOSIT, BATCH_WITHDRAW, BATCH_TRANSFER, BATCH_INTEREST } kind;
+    if (strcmp(command, "deposit") == 0 || strcmp(command, "withdraw") == 0) {
+        kind = command[0] == 'd' ? BATCH_DEPOSIT : BATCH_WITHDRAW;
+        if ((result = parseBatchAccount(nextBatchToken(&cursor), &from)) != TXN_OK) return result;
+        if ((result = parseBatchAmount(nextBatchToken(&cursor), &amount)) != TXN_OK) return result;
+    } else if (strcmp(command, "transfer") == 0) {
+        kind = BATCH_TRANSFER;
+        if ((result = parseBatchAccount(nextBatchToken(&cursor), &from)) != TXN_OK) return result;
+        if ((result = parseBatchAccount(nextBatchToken(&cursor), &to)) != TXN_OK) return result;
+        if ((result = parseBatchAmount(nextBatchToken(&cursor), &amount)) != TXN_OK) return result;
+    } else if (strcmp(command, "interest") == 0) {
+        kind = BATCH_INTEREST;
+        char *target = nextBatchToken(&cursor);
+        if (target != NULL && (result = parseBatchAccount(target, &from)) != TXN_OK) return result;
+    } else {
+        return TXN_BAD_COMMAND;
+    }
+    if (nextBatchToken(&cursor) != NULL) return TXN_BAD_COMMAND;
+
+    switch (kind) {
+        case BATCH_DEPOSIT: return applyDeposit(from, amount);
+        case BATCH_WITHDRAW: return applyWithdrawal(from, amount);
+        case BATCH_TRANSFER: return applyTransfer(from, to, amount);
+        case BATCH_INTEREST:
+            if (from != -1) return applyInterest(from, time(NULL), NULL);
+            runDueInterest(time(NULL), 0);
+            return TXN_OK;
+    }
+    return TXN_BAD_COMMAND;
+}
+
+void* stressWorker(void* arg) {
+    StressWorker *w = arg;
+    for (long i = 0; i < w->operations; i++) {
+        uint64_t r = nextRandom(&w->seed);
+        int from = (int)(r % (uint64_t)accountCount);
+        double amount = (double)(1 + (r >> 32) % 100);
+        int kind = (int)((r >> 48) % 10);
+        int result;
+
+        if (kind < 6) {
+            int to = (int)((r >> 16) % (uint64_t)accountCount);
+            result = from == to ? TXN_SAME_ACCOUNT : applyTransfer(from, to, amount);
+        } else if (kind < 8) {
+            result = applyDeposit(from, amount);
+            if (result == TXN_OK) w->deposited += amount;
+        } else {
+            result = applyWithdrawal(from, amount);
+            if (result == TXN_OK) w->withdrawn += amount;
+        }
 
-    printf("Enter amount to deposit: ");
-    double amount;
-    while (scanf("%lf", &amount) != 1 || amount <= 0) {
-        printf(" Invalid amount! Please enter a positive number: ");
+        if (result == TXN_OK) w->applied++;
+        else w->rejected++;
+    }
+    return NULL;
+}
+
+void* stressAuditor(void* arg) {
+    StressAuditor *auditor = arg;
+    int audited = auditor->ledgerStart;
+    double expected = auditor->opening;
+    while (__atomic_load_n(&auditor->running, __ATOMIC_ACQUIRE)) {
+        BalanceSnapshot snapshot;
+        pinBalanceSnapshot(&snapshot);
+        double total = 0;
+        for (int i = 0; i < snapshot.accounts; i++) total += snapshotBalance(&snapshot, i);
+        for (; audited < snapshot.transactions; audited++) {
+            const Transaction *t = transactionAt(audited);
+            if (t->type == TXN_TYPE_DEPOSIT) expected += t->amount;
+            else if (t->type == TXN_TYPE_WITHDRAWAL) expected -= t->amount;
+        }
+        releaseBalanceSnapshot(&snapshot);
+        auditor->snapshots++;
+        if (total != expected) auditor->torn++;
+    }
+    return NULL;
+}
+
+// Drives the transaction engine from 1, 2, 4 ... maxThreads threads over an
+// in-memory set of synthetic accounts, and checks that no money was created
+// or destroyed, both at the end and in snapshots taken while it runs.
+// Nothing is journaled or saved.
+void runStressTest(int maxThreads, long operations, int accounts) {
+    if (maxThreads < 1 || operations < 1 || accounts < 2) {
+        printf(" Usage: --stress THREADS OPS [ACCOUNTS]\n");
+        return;
+    }
+
+    for (int i = 0; i < accounts; i++) {
+        Account a;
+        AccountProfile profile;
+        memset(&a, 0, sizeof(a));
+        a.accountNumber = i + 1;
+        snprintf(profile.firstName, sizeof(profile.firstName), "Stress");
+        snprintf(profile.lastName, sizeof(profile.lastName), "User%d", i + 1);
+        snprintf(profile.password, sizeof(profile.password), "stress1");
+        a.balance = 1000;
+        a.isActive = 1;
+        a.lastInterestDate = time(NULL);
+        if (appendAccount(&a, &profile) == -1) {
+            printf(" Not enough memory for %d accounts.\n", accounts);
+            return;
+        }
+    }
+
+    printf("%-8s %-12s %-12s %-14s %-10s %-10s\n", "Threads", "Applied", "Rejected", "Ops/sec", "Balanced", "Snapshots");
+    for (int threads = 1; ; threads = threads * 2 > maxThreads && threads < maxThreads ? maxThreads : threads * 2) {
+        StressWorker *workers = calloc(threads, sizeof(StressWorker));
+        pthread_t *ids = calloc(threads, sizeof(pthread_t));
+        if (workers == NULL || ids == NULL) {
+            free(workers);
+            free(ids);
+            printf(" Not enough memory for %d threads.\n", threads);
+            return;
+        }
+
+        double before = 0;
+        for (int i = 0; i < accountCount; i++) before += accountAt(i)->balance;
+
+        StressAuditor auditor = {1, transactionCount, before, 0, 0};
+        pthread_t auditorId;
+        int auditing = pthread_create(&auditorId, NULL, stressAuditor, &auditor) == 0;
+
+        double start = nowSeconds();
+        for (int t = 0; t < threads; t++) {
+            workers[t].operations = operations / threads;
+            workers[t].seed = 0x9E3779B97F4A7C15ULL * (uint64_t)(t + 1) + (uint64_t)threads;
+            pthread_create(&ids[t], NULL, stressWorker, &workers[t]);
+        }
+        for (int t = 0; t < threads; t++) pthread_join(ids[t], NULL);
+        double elapsed = nowSeconds() - start;
+        __atomic_store_n(&auditor.running, 0, __ATOMIC_RELEASE);
+        if (auditing) pthread_join(auditorId, NULL);
+
+        double after = 0, expected = before;
+        long applied = 0, rejected = 0;
+        for (int i = 0; i < accountCount; i++) after += accountAt(i)->balance;
+        for (int t = 0; t < threads; t++) {
+            expected += workers[t].deposited - workers[t].withdrawn;
+            applied += workers[t].applied;
+            rejected += workers[t].rejected;
+        }
+
+        char audit[32];
+        if (auditor.torn == 0) snprintf(audit, sizeof(audit), "%ld ok", auditor.snapshots);
+        else snprintf(audit, sizeof(audit), "%ld of %ld torn", auditor.torn, auditor.snapshots);
+        printf("%-8d %-12ld %-12ld %-14.0f %-10s %-10s\n", threads, applied, rejected,
+               elapsed > 0 ? (applied + rejected) / elapsed : 0,
+               after == expected ? "yes" : "NO", audit);
+        free(workers);
+        free(ids);
+        if (threads >= maxThreads) break;
+    }
+}
+
+// Parses a mix such as "deposit=30,withdraw=20,transfer=30,history=15,search=5"
+// into per-operation weights. Operations left out get weight 0.
+int parseBenchMix(const char* text, int weights[BENCH_OP_COUNT]) {
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", text);
+    for (int op = 0; op < BENCH_OP_COUNT; op++) weights[op] = 0;
+
+    int total = 0;
+    for (char *item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")) {
+        char *equals = strchr(item, '=');
+        if (equals == NULL) return 0;
+        *equals = '\0';
+        int op = 0;
+        while (op < BENCH_OP_COUNT && strcmp(item, benchOperationNames[op]) != 0) op++;
+        int weight = atoi(equals + 1);
+        if (op == BENCH_OP_COUNT || weight < 0) return 0;
+        weights[op] = weight;
+        total += weight;
+    }
+    return total > 0;
+}
+
+// Runs one operation against a random account through the same paths the
+// menus use, minus the prompts and the screen output.
+int runBenchOperation(BenchOperation op, uint64_t* rng) {
+    uint64_t r = nextRandom(rng);
+    int from = (int)(r % (uint64_t)accountCount);
+    double amount = (double)(1 + (r >> 32) % 100);
+
+    switch (op) {
+        case BENCH_DEPOSIT:
+            return applyDeposit(from, amount) == TXN_OK;
+        case BENCH_WITHDRAW:
+            return applyWithdrawal(from, amount) == TXN_OK;
+        case BENCH_TRANSFER: {
+            int to = (int)((r >> 16) % (uint64_t)accountCount);
+            return from != to && applyTransfer(from, to, amount) == TXN_OK;
+        }
+        case BENCH_HISTORY: {
+            char line[256];
+            int accountNumber = accountAt(from)->accountNumber;
+            int cursor = accountAt(from)->lastTransaction;
+            for (int shown = 0; cursor != -1 && shown < HISTORY_PAGE_SIZE; shown++) {
+                const Transaction *t = transactionAt(cursor);
+                if (t->accountNumber != accountNumber) break;
+                formatHistoryEntry(line, sizeof(line), t);
+                cursor = t->previousForAccount;
+            }
+            return 1;
+        }
+        case BENCH_SEARCH: {
+            NameMatch *matches = NULL;
+            beginSharedAccess();
+            int found = findAccountsByName(profileAt(from)->lastName, &matches);
+            endSharedAccess();
+            free(matches);
+            return found > 0;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Registers synthetic accounts until there are target of them, each with an
+// opening deposit, the way a server REGISTER does.
+void addBenchAccounts(int target) {
+    static const char* firstNames[] = {"James", "Mary", "Robert", "Patricia", "John", "Jennifer", "Michael", "Linda",
+                                       "David", "Elizabeth", "William", "Barbara", "Richard", "Susan", "Joseph", "Jessica"};
+    static const char* lastNames[] = {"Smith", "Johnson", "Williams", "Brown", "Jones", "Garcia", "Miller", "Davis",
+                                      "Rodriguez", "Martinez", "Hernandez", "Lopez", "Gonzalez", "Wilson", "Anderson", "Thomas",
+                                      "Taylor", "Moore", "Jackson", "Martin", "Lee", "Perez", "Thompson", "White",
+                                      "Harris", "Sanchez", "Clark", "Ramirez", "Lewis", "Robinson", "Walker", "Young"};
+
+    beginExclusiveAccess();
+    while (accountCount < target) {
+        Account a;
+        AccountProfile profile;
+        memset(&a, 0, sizeof(a));
+        int n = accountCount;
+        a.accountNumber = n + 1;
+        snprintf(profile.firstName, sizeof(profile.firstName), "%s", firstNames[n % 16]);
+        snprintf(profile.lastName, sizeof(profile.lastName), "%s%d", lastNames[(n / 16) % 32], n / 512);
+        snprintf(profile.password, sizeof(profile.password), "bench%d", n % 10);
+        a.balance = 1000;
+        a.isActive = 1;
+        a.isSavings = n % 3 == 0;
+        a.lastInterestDate = time(NULL);
+        if (appendAccount(&a, &profile) == -1) break;
+        createTransaction(a.accountNumber, TXN_TYPE_ACCOUNT_OPEN, a.balance, 0, "Initial deposit");
+    }
+    endExclusiveAccess();
+}
+
+int compareFloats(const void* a, const void* b) {
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+// Grows a synthetic bank to accounts accounts while running operations picked
+// from mix, in BENCH_STAGES steps of 1%, 10% and 100%. After each step the
+// data is saved and loaded back, so persistence is timed at three sizes. It
+// all happens in a scratch BENCH_DIR directory, leaving the real data alone.
+// Results go to jsonPath as JSON; a summary is printed.
+int runBenchmark(int accounts, long operations, const char* mix, const char* jsonPath) {
+    int weights[BENCH_OP_COUNT];
+    if (accounts < 2 || operations < 1 ||
+        !parseBenchMix(mix != NULL ? mix : "deposit=30,withdraw=20,transfer=30,history=15,search=5", weights)) {
+        printf(" Usage: --bench ACCOUNTS OPS [MIX] [JSON_FILE]\n");
+        printf(" MIX is e.g. deposit=30,withdraw=20,transfer=30,history=15,search=5\n");
+        return 0;
+    }
+    int totalWeight = 0;
+    for (int op = 0; op < BENCH_OP_COUNT; op++) totalWeight += weights[op];
+
+    float *latencies = malloc(operations * sizeof(float));
+    float *sorted = malloc(operations * sizeof(float));
+    unsigned char *kinds = malloc(operations);
+    if (latencies == NULL || sorted == NULL || kinds == NULL) {
+        free(latencies);
+        free(sorted);
+        free(kinds);
+        printf(" Not enough memory for %ld operations.\n", operations);
+        return 0;
+    }
+
+    // The results file is opened first so a relative path means the caller's directory.
+    FILE *json = fopen(jsonPath, "w");
+    if (json == NULL) {
+        printf(" Error: Cannot create '%s'.\n", jsonPath);
+        free(latencies);
+        free(sorted);
+        free(kinds);
+        return 0;
+    }
+    if ((mkdir(BENCH_DIR, 0700) != 0 && errno != EEXIST) || chdir(BENCH_DIR) != 0) {
+        printf(" Error: Cannot use scratch directory '%s'.\n", BENCH_DIR);
+        fclose(json);
+        free(latencies);
+        free(sorted);
+        free(kinds);
+        return 0;
+    }
+    remove(SNAPSHOT_FILE);
+    remove(JOURNAL_FILE);
+
+    BenchStage stages[BENCH_STAGES];
+    const int divisors[BENCH_STAGES] = {100, 10, 1};
+    uint64_t rng = 88172645463325252ULL;
+    long done = 0, succeeded = 0;
+    double workloadSeconds = 0;
+
+    for (int s = 0; s < BENCH_STAGES; s++) {
+        int stageAccounts = accounts / divisors[s] < 2 ? 2 : accounts / divisors[s];
+        long stageOperations = operations / divisors[s];
+        addBenchAccounts(stageAccounts);
+
+        double stageStart = nowSeconds();
+        for (; done < stageOperations; done++) {
+            uint64_t pick = nextRandom(&rng) % (uint64_t)totalWeight;
+            int op = 0;
+            while (pick >= (uint64_t)weights[op]) pick -= weights[op++];
+
+            double start = nowSeconds();
+            succeeded += runBenchOperation(op, &rng);
+            latencies[done] = (float)((nowSeconds() - start) * 1e9);
+            kinds[done] = (unsigned char)op;
+        }
+        workloadSeconds += nowSeconds() - stageStart;
+
+        stages[s].accounts = accountCount;
+        stages[s].transactions = transactionCount;
+        double start = nowSeconds();
+        saveData();
+        stages[s].saveSeconds = nowSeconds() - start;
+        start = nowSeconds();
+        loadData();
+        stages[s].loadSeconds = nowSeconds() - start;
+
+        stages[s].snapshotBytes = checkpointBytes();
+    }
+
+    removeCheckpointFiles();
+    remove(JOURNAL_FILE);
+    if (chdir("..") == 0) rmdir(BENCH_DIR);
+
+    fprintf(json, "{\n  \"started\": %ld,\n  \"accounts\": %d,\n  \"operations\": %ld,\n",
+            (long)time(NULL), accounts, operations);
+    fprintf(json, "  \"succeeded\": %ld,\n  \"seconds\": %.6f,\n  \"opsPerSec\": %.1f,\n  \"mix\": {",
+            succeeded, workloadSeconds, workloadSeconds > 0 ? operations / workloadSeconds : 0);
+    for (int op = 0; op < BENCH_OP_COUNT; op++) {
+        fprintf(json, "%s\"%s\": %d", op ? ", " : "", benchOperationNames[op], weights[op]);
+    }
+    fprintf(json, "},\n  \"latency\": [");
+
+    printf("\n%-10s %-10s %-12s %-10s %-10s %-10s %-10s\n", "Operation", "Count", "Ops/sec", "p50 (us)", "p99 (us)", "p999 (us)", "Max (us)");
+    int first = 1;
+    for (int op = 0; op < BENCH_OP_COUNT; op++) {
+        long count = 0;
+        double total = 0;
+        for (long i = 0; i < operations; i++) {
+            if (kinds[i] != op) continue;
+            total += latencies[i];
+            sorted[count++] = latencies[i];
+        }
+        if (count == 0) continue;
+        qsort(sorted, count, sizeof(float), compareFloats);
+
+        double p50 = sorted[(long)(count * 0.50)] / 1e3;
+        double p99 = sorted[(long)(count * 0.99)] / 1e3;
+        double p999 = sorted[(long)(count * 0.999)] / 1e3;
+        double max = sorted[count - 1] / 1e3;
+        double rate = total > 0 ? count * 1e9 / total : 0;
+        fprintf(json, "%s\n    {\"operation\": \"%s\", \"count\": %ld, \"opsPerSec\": %.1f, "
+                "\"p50Us\": %.3f, \"p99Us\": %.3f, \"p999Us\": %.3f, \"maxUs\": %.3f}",
+                first ? "" : ",", benchOperationNames[op], count, rate, p50, p99, p999, max);
+        printf("%-10s %-10ld %-12.0f %-10.2f %-10.2f %-10.2f %-10.2f\n",
+               benchOperationNames[op], count, rate, p50, p99, p999, max);
+        first = 0;
+    }
+    fprintf(json, "\n  ],\n  \"persistence\": [");
+
+    printf("\n%-10s %-14s %-14s %-10s %-10s\n", "Accounts", "Transactions", "Snapshot (B)", "Save (s)", "Load (s)");
+    for (int s = 0; s < BENCH_STAGES; s++) {
+        fprintf(json, "%s\n    {\"accounts\": %d, \"transactions\": %d, \"snapshotBytes\": %ld, "
+                "\"saveSeconds\": %.6f, \"loadSeconds\": %.6f}",
+                s ? "," : "", stages[s].accounts, stages[s].transactions, stages[s].snapshotBytes,
+                stages[s].saveSeconds, stages[s].loadSeconds);
+        printf("%-10d %-14d %-14ld %-10.3f %-10.3f\n", stages[s].accounts, stages[s].transactions,
+               stages[s].snapshotBytes, stages[s].saveSeconds, stages[s].loadSeconds);
+    }
+    fprintf(json, "\n  ]\n}\n");
+
+    int ok = fclose(json) == 0;
+    printf("\n %ld operations in %.3f s (%.0f ops/sec). Results written to '%s'.\n",
+           done, workloadSeconds, workloadSeconds > 0 ? done / workloadSeconds : 0, jsonPath);
+    free(latencies);
+    free(sorted);
+    free(kinds);
+    return ok;
+}
+
+// Applies a file of deposit/withdraw/transfer/interest commands in order with
+// the same rules as the menus, then commits once with a single checkpoint.
+int applyBatchFile(const char* path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf(" Error: Cannot open batch file '%s'.\n", path);
+        return 0;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+
+    char line[512];
+    long lineNumber = 0, applied = 0, rejected = 0;
+    double start = nowSeconds();
+    while (fgets(line, sizeof(line), file)) {
+        lineNumber++;
+        int result = applyBatchLine(line);
+        if (result == TXN_OK) {
+            applied++;
+        } else if (result != TXN_SKIPPED) {
+            rejected++;
+            fprintf(stderr, "line %ld: rejected (%s)\n", lineNumber, transactionResultMessage(result));
+        }
+    }
+    fclose(file);
+    double applyTime = nowSeconds() - start;
+
+    saveData();
+    double totalTime = nowSeconds() - start;
+
+    printf(" Batch '%s': %ld applied, %ld rejected, %ld lines\n", path, applied, rejected, lineNumber);
+    printf(" Apply: %.3f s (%.0f ops/sec), including commit: %.3f s (%.0f ops/sec)\n",
+           applyTime, applyTime > 0 ? (applied + rejected) / applyTime : 0,
+           totalTime, totalTime > 0 ? (applied + rejected) / totalTime : 0);
+    return 1;
+}
+
+void printAccountDetails(int accountIndex) {
+    printf("\n==========================================\n");
+    printf("Account Number: %d\n", accountAt(accountIndex)->accountNumber);
+    printf("Account Holder: %s %s\n", profileAt(accountIndex)->firstName, profileAt(accountIndex)->lastName);
+    printf("Balance: %.2f\n", accountAt(accountIndex)->balance);
+    printf("Type: %s\n", accountAt(accountIndex)->isSavings ? "Savings" : "Current");
+    printf("Status: %s\n", accountAt(accountIndex)->isActive ? "Active" : "Inactive");
+    printf("Locked: %s\n", accountAt(accountIndex)->isLocked ? "Yes" : "No");
+    printf("==========================================\n");
+}
+
+
+
+void generateReports() {
+    int choice;
+    do {
+        printf("\n--- Generate Reports ---\n");
+        printf("1. Account Balance Report\n");
+        printf("2. Balance Ranking\n");
+        printf("3. Transaction Report\n");
+        printf("4. Account Statement\n");
+        printf("5. Export Accounts to CSV\n");
+        printf("6. Export Transactions to CSV\n");
+        printf("7. Export Transactions to Columnar File\n");
+        printf("8. Back to Admin Menu\n");
+        printf("Enter your choice: ");
+
+        if (scanf("%d", &choice) != 1) {
+            printf(" Invalid input! Please enter a number.\n");
+            clearInputBuffer();
+            continue;
+        }
+        clearInputBuffer();
+
+        switch(choice) {
+            case 1:
+                listAllAccounts();
+                break;
+            case 2:
+                balanceRankingReport();
+                break;
+            case 3: {
+                printf("Enter account number (0 for all accounts): ");
+                int accNum;
+                if (scanf("%d", &accNum) != 1) {
+                    printf(" Invalid input!\n");
+                    clearInputBuffer();
+                    break;
+                }
+                clearInputBuffer();
+
+                char dateText[32];
+                time_t from, to;
+                printf("From date (YYYY-MM-DD, Enter for no limit): ");
+                fgets(dateText, sizeof(dateText), stdin);
+                if (!parseReportDate(dateText, 0, &from)) {
+                    printf(" Invalid date!\n");
+                    break;
+                }
+                printf("To date (YYYY-MM-DD, Enter for no limit): ");
+                fgets(dateText, sizeof(dateText), stdin);
+                if (!parseReportDate(dateText, 1, &to)) {
+                    printf(" Invalid date!\n");
+                    break;
+                }
+
+                if (accNum != 0 && from == INT64_MIN && to == INT64_MAX) {
+                    displayTransactionHistory(accNum);
+                } else {
+                    printTransactionReport(accNum, from, to);
+                }
+                break;
+            }
+            case 4: {
+                printf("Enter account number: ");
+                int accNum;
+                if (scanf("%d", &accNum) != 1) {
+                    printf(" Invalid input!\n");
+                    clearInputBuffer();
+                    break;
+                }
+                clearInputBuffer();
+                accountStatement(accNum);
+                break;
+            }
+            case 5:
+            case 6:
+            case 7: {
+                time_t now = time(NULL);
+                struct tm *tm = localtime(&now);
+                char filename[100];
+                snprintf(filename, sizeof(filename), "%s_%04d%02d%02d_%02d%02d%02d.%s",
+                        choice == 5 ? "report" : "ledger",
+                        tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+                        tm->tm_hour, tm->tm_min, tm->tm_sec, choice == 7 ? "cols" : "csv");
+
+                if (choice == 7) exportColumnar(filename);
+                else exportCsv(choice == 5 ? EXPORT_ACCOUNTS : EXPORT_TRANSACTIONS, filename, defaultExportThreads());
+                break;
+            }
+            case 8:
+                break;
+            default:
+                printf(" Invalid choice. Please try again.\n");
+        }
+    } while (choice != 8);
+}
+
+// Lists the highest or lowest N balances, or every balance in a range, from
+// the balance index.
+void balanceRankingReport() {
+    printf("1. Highest balances\n");
+    printf("2. Lowest balances\n");
+    printf("3. Balances in a range\n");
+    printf("Enter your choice: ");
+    int choice, limit = INT32_MAX;
+    double low = -INFINITY, high = INFINITY;
+    if (scanf("%d", &choice) != 1 || choice < 1 || choice > 3) {
+        printf(" Invalid choice!\n");
         clearInputBuffer();
+        return;
+    }
+    if (choice == 3) {
+        printf("Lowest balance: ");
+        int ok = scanf("%lf", &low) == 1;
+        if (ok) {
+            printf("Highest balance: ");
+            ok = scanf("%lf", &high) == 1;
+        }
+        if (!ok || !(low <= high)) {
+            printf(" Invalid range!\n");
+            clearInputBuffer();
+            return;
+        }
+    } else {
+        printf("How many accounts? ");
+        if (scanf("%d", &limit) != 1 || limit < 1) {
+            printf(" Invalid number!\n");
+            clearInputBuffer();
+            return;
+        }
+    }
+    clearInputBuffer();
+
+    BalanceEntry *rows;
+    int count = queryBalanceIndex(low, high, choice == 1, limit, &rows);
+    if (count == -1) {
+        printf(" Not enough memory for the report.\n");
+        return;
+    }
+
+    if (choice == 3) printf("\n--- Balances from %.2f to %.2f ---\n", low, high);
+    else printf("\n--- %s %d Balances ---\n", choice == 1 ? "Highest" : "Lowest", limit);
+    printf("%-6s %-10s %-20s %-12s %-10s\n", "Rank", "Account", "Name", "Balance", "Type");
+    printf("----------------------------------------------------------------\n");
+    for (int i = 0; i < count; i++) {
+        int slot = rows[i].slot;
+        char fullName[MAX_NAME_LENGTH * 2];
+        formatFullName(fullName, sizeof(fullName), slot);
+        printf("%-6d %-10d %-20s %-12.2f %-10s\n", i + 1, accountAt(slot)->accountNumber, fullName,
+               rows[i].balance, accountAt(slot)->isSavings ? "Savings" : "Current");
+    }
+    printf(" %d account(s) listed.\n", count);
+    if (balanceIndexIncomplete) printf(" WARNING: The balance index ran out of memory and may be missing accounts.\n");
+    free(rows);
+}
+
+// Reads a YYYY-MM-DD date as local midnight, or as the last second of that day
+// when endOfDay is set. An empty line means no limit.
+int parseReportDate(const char* text, int endOfDay, time_t* out) {
+    if (text[strspn(text, " \t\r\n")] == '\0') {
+        *out = endOfDay ? (time_t)INT64_MAX : (time_t)INT64_MIN;
+        return 1;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(text, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3 ||
+        tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31) {
+        return 0;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    if (endOfDay) {
+        tm.tm_hour = 23;
+        tm.tm_min = 59;
+        tm.tm_sec = 59;
+    }
+    *out = mktime(&tm);
+    return *out != (time_t)-1;
+}
+
+int printReportRow(int slot, time_t from, time_t to) {
+    Transaction *t = transactionAt(slot);
+    if (t->timestamp < from || t->timestamp > to) return 0;
+
+    char dateStr[50];
+    strftime(dateStr, sizeof(dateStr), "%Y-%m-%d %H:%M:%S", localtime(&t->timestamp));
+    printf("[%s] Acc:%d %s: %.2f - %s\n", dateStr, t->accountNumber,
+           transactionTypeName(t->type), t->amount, stringAt(t->description));
+    return 1;
+}
+
+// Prints the transactions stamped within [from, to], for one account or for
+// all when accountNumber is 0. Only the ledger slice the time index narrows
+// to is scanned; an account's rows are followed along its history chain.
+void printTransactionReport(int accountNumber, time_t from, time_t to) {
+    int first, last;
+    findTransactionRange(from, to, &first, &last);
+
+    int cursor = -1;
+    if (accountNumber != 0) {
+        int accIndex = findAccountByNumber(accountNumber);
+        if (accIndex == -1) {
+            printf(" Account not found.\n");
+            return;
+        }
+        lockAccount(accIndex);
+        cursor = accountAt(accIndex)->lastTransaction;
+        unlockAccount(accIndex);
+        printf("\n--- Transactions for Account %d ---\n", accountNumber);
+    } else {
+        printf("\n--- All Transactions ---\n");
+    }
+
+    int shown = 0;
+    if (accountNumber == 0) {
+        for (int i = first; i < last; i++) shown += printReportRow(i, from, to);
+    } else {
+        // The chain runs newest first, so it stops once it leaves the slice.
+        for (int i = cursor; i >= first; i = transactionAt(i)->previousForAccount) {
+            if (i < last) shown += printReportRow(i, from, to);
+        }
+    }
+    printf(" %d transaction(s) found.\n", shown);
+}
+
+void accountStatement(int accountNumber) {
+    char text[32];
+    printf("Monthly or daily statement? (m/d): ");
+    if (fgets(text, sizeof(text), stdin) == NULL) return;
+    int monthly = text[0] != 'd' && text[0] != 'D';
+
+    time_t from, to;
+    printf("From date (YYYY-MM-DD, Enter for no limit): ");
+    fgets(text, sizeof(text), stdin);
+    if (!parseReportDate(text, 0, &from)) {
+        printf(" Invalid date!\n");
+        return;
+    }
+    printf("To date (YYYY-MM-DD, Enter for no limit): ");
+    fgets(text, sizeof(text), stdin);
+    if (!parseReportDate(text, 1, &to)) {
+        printf(" Invalid date!\n");
+        return;
+    }
+    printStatement(accountNumber, monthly, from, to);
+}
+
+// Prints one row per period with activity in [from, to] and the totals over
+// them, from the account's rollups rather than its ledger rows.
+void printStatement(int accountNumber, int monthly, time_t from, time_t to) {
+    uint64_t start = nowNanoseconds();
+    int accIndex = findAccountByNumber(accountNumber);
+    if (accIndex == -1) {
+        printf(" Account not found.\n");
+        return;
+    }
+
+    int first = from == (time_t)INT64_MIN ? INT32_MIN : rollupDay(from);
+    int last = to == (time_t)INT64_MAX ? INT32_MAX : rollupDay(to);
+    if (monthly) {
+        if (first != INT32_MIN) first /= 100;
+        if (last != INT32_MAX) last /= 100;
+    }
+    int count;
+    double opening;
+    Rollup *rows = collectRollups(accIndex, monthly, first, last, INT32_MAX, &count, &opening);
+    if (rows == NULL) {
+        printf(" Not enough memory for the statement.\n");
+        return;
+    }
+
+    printf("\n--- %s Statement for Account %d ---\n", monthly ? "Monthly" : "Daily", accountNumber);
+    printf("%-10s %12s %12s %12s %12s %12s %10s %12s\n", "Period", "Opening", "Deposits",
+           "Withdrawals", "Transfer In", "Transfer Out", "Interest", "Closing");
+    printf("--------------------------------------------------------------------------------------------------\n");
+
+    Rollup total;
+    memset(&total, 0, sizeof(total));
+    for (int i = count - 1; i >= 0; i--) {
+        Rollup *r = &rows[i];
+        char period[16];
+        formatRollupPeriod(period, sizeof(period), r->period, monthly);
+        printf("%-10s %12.2f %12.2f %12.2f %12.2f %12.2f %10.2f %12.2f\n", period, r->opening, r->deposits,
+               r->withdrawals, r->transfersIn, r->transfersOut, r->interest, rollupClosing(r));
+        total.deposits += r->deposits;
+        total.withdrawals += r->withdrawals;
+        total.transfersIn += r->transfersIn;
+        total.transfersOut += r->transfersOut;
+        total.interest += r->interest;
+        total.entries += r->entries;
+        total.depositCount += r->depositCount;
+        total.withdrawalCount += r->withdrawalCount;
+        total.transferInCount += r->transferInCount;
+        total.transferOutCount += r->transferOutCount;
+        total.interestCount += r->interestCount;
+    }
+    total.opening = opening;
+    free(rows);
+
+    if (count == 0) printf("No activity in this period.\n");
+    printf("\nOpening balance: %.2f\n", total.opening);
+    printf("Deposits:        %.2f (%d)\n", total.deposits, total.depositCount);
+    printf("Withdrawals:     %.2f (%d)\n", total.withdrawals, total.withdrawalCount);
+    printf("Transfers in:    %.2f (%d)\n", total.transfersIn, total.transferInCount);
+    printf("Transfers out:   %.2f (%d)\n", total.transfersOut, total.transferOutCount);
+    printf("Interest:        %.2f (%d)\n", total.interest, total.interestCount);
+    printf("Closing balance: %.2f\n", rollupClosing(&total));
+    printf(" %d ledger entries over %d %s.\n", total.entries, count, monthly ? "month(s)" : "day(s)");
+    recordOperation(METRIC_STATEMENT, TXN_OK, start);
+}
+
+// Streams a table to CSV. Rows are formatted by worker threads into large
+// buffers with hand-rolled number and date formatting, and written in order
+// by the calling thread, so the export runs at the speed of the disk. Ledger
+// rows never change and account balances are read from a pinned snapshot, so
+// neither export holds a lock while it runs.
+int exportCsv(ExportTable table, const char* path, int threads) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        printf(" Error creating export file '%s'.\n", path);
+        return 0;
+    }
+    setvbuf(file, NULL, _IONBF, 0);
+
+    CsvExport job;
+    job.table = table;
+    pinBalanceSnapshot(&job.snapshot);
+    job.rows = table == EXPORT_ACCOUNTS ? job.snapshot.accounts : job.snapshot.transactions;
+    job.blocks = (job.rows + EXPORT_BLOCK_ROWS - 1) / EXPORT_BLOCK_ROWS;
+    job.threads = threads < 1 ? 1 : threads > 64 ? 64 : threads;
+    if (job.threads > job.blocks && job.blocks > 0) job.threads = job.blocks;
+    job.buffers = calloc(job.threads * 2, sizeof(ExportBuffer));
+    job.failed = job.buffers == NULL;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.changed, NULL);
+
+    const char *heading = table == EXPORT_ACCOUNTS
+        ? "AccountNumber,FirstName,LastName,Balance,Type,Status,Locked\n"
+        : "TransactionId,AccountNumber,Type,Amount,Timestamp,RelatedAccount,Description\n";
+    int ok = !job.failed && fwrite(heading, 1, strlen(heading), file) == strlen(heading);
+
+    double start = nowSeconds();
+    CsvExportWorker workers[64];
+    pthread_t ids[64];
+    int started = 0;
+    if (ok) {
+        for (int i = 0; i < job.threads * 2; i++) job.buffers[i].block = -1;
+        for (; started < job.threads; started++) {
+            workers[started].job = &job;
+            workers[started].index = started;
+            if (pthread_create(&ids[started], NULL, csvExportWorker, &workers[started]) != 0) break;
+        }
+        ok = started == job.threads;
+    }
+
+    long long written = 0, bytes = strlen(heading);
+    for (int block = 0; ok && block < job.blocks; block++) {
+        ExportBuffer *buffer = &job.buffers[(block % job.threads) * 2 + (block / job.threads) % 2];
+        pthread_mutex_lock(&job.lock);
+        while (buffer->block != block && !job.failed) pthread_cond_wait(&job.changed, &job.lock);
+        ok = !job.failed;
+        pthread_mutex_unlock(&job.lock);
+        if (!ok) break;
+
+        ok = fwrite(buffer->data, 1, buffer->length, file) == buffer->length;
+        written += buffer->rows;
+        bytes += buffer->length;
+
+        pthread_mutex_lock(&job.lock);
+        buffer->block = -1;
+        pthread_cond_broadcast(&job.changed);
+        pthread_mutex_unlock(&job.lock);
+    }
+
+    pthread_mutex_lock(&job.lock);
+    if (!ok) job.failed = 1;
+    pthread_cond_broadcast(&job.changed);
+    pthread_mutex_unlock(&job.lock);
+    for (int i = 0; i < started; i++) pthread_join(ids[i], NULL);
+    releaseBalanceSnapshot(&job.snapshot);
+
+    for (int i = 0; job.buffers != NULL && i < job.threads * 2; i++) free(job.buffers[i].data);
+    free(job.buffers);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.changed);
+    if (fclose(file) != 0) ok = 0;
+    if (!ok) {
+        printf(" Error writing export file '%s'.\n", path);
+        return 0;
+    }
+
+    double elapsed = nowSeconds() - start;
+    printf(" Exported %lld %s to %s (%.1f MB in %.2f s, %.0f rows/sec, %d thread(s))\n",
+           written, table == EXPORT_ACCOUNTS ? "accounts" : "transactions", path,
+           bytes / 1e6, elapsed, elapsed > 0 ? written / elapsed : 0, job.threads);
+    return 1;
+}
+
+void* csvExportWorker(void* arg) {
+    CsvExportWorker *worker = arg;
+    CsvExport *job = worker->job;
+    TimestampCache cache;
+    cache.valid = 0;
+
+    for (int block = worker->index, round = 0; block < job->blocks; block += job->threads, round++) {
+        ExportBuffer *buffer = &job->buffers[worker->index * 2 + round % 2];
+        pthread_mutex_lock(&job->lock);
+        while (buffer->block != -1 && !job->failed) pthread_cond_wait(&job->changed, &job->lock);
+        int failed = job->failed;
+        pthread_mutex_unlock(&job->lock);
+        if (failed) break;
+
+        int first = block * EXPORT_BLOCK_ROWS;
+        int last = first + EXPORT_BLOCK_ROWS < job->rows ? first + EXPORT_BLOCK_ROWS : job->rows;
+        int ok = formatCsvBlock(job, first, last, buffer, &cache);
+
+        pthread_mutex_lock(&job->lock);
+        if (ok) buffer->block = block;
+        else job->failed = 1;
+        pthread_cond_broadcast(&job->changed);
+        pthread_mutex_unlock(&job->lock);
+        if (!ok) break;
+    }
+    return NULL;
+}
+
+int formatCsvBlock(CsvExport* job, int first, int last, ExportBuffer* out, TimestampCache* cache) {
+    out->length = 0;
+    out->rows = 0;
+    for (int i = first; i < last; i++) {
+        if (out->capacity - out->length < EXPORT_ROW_MAX) {
+            size_t capacity = out->capacity ? out->capacity * 2 : 1 << 20;
+            char *grown = realloc(out->data, capacity);
+            if (grown == NULL) return 0;
+            out->data = grown;
+            out->capacity = capacity;
+        }
+
+        char *p = out->data + out->length;
+        if (job->table == EXPORT_ACCOUNTS) {
+            const Account *a = accountAt(i);
+            if (!a->isActive) continue;
+            p = formatInteger(p, a->accountNumber);
+            *p++ = ',';
+            p = formatCsvText(p, profileAt(i)->firstName);
+            *p++ = ',';
+            p = formatCsvText(p, profileAt(i)->lastName);
+            *p++ = ',';
+            p = formatMoney(p, snapshotBalance(&job->snapshot, i));
+            memcpy(p, a->isSavings ? ",Savings,Active," : ",Current,Active,", 16);
+            p += 16;
+            memcpy(p, a->isLocked ? "Yes" : "No", a->isLocked ? 3 : 2);
+            p += a->isLocked ? 3 : 2;
+        } else {
+            const Transaction *t = transactionAt(i);
+            p = formatInteger(p, t->transactionId);
+            *p++ = ',';
+            p = formatInteger(p, t->accountNumber);
+            *p++ = ',';
+            p = formatCsvText(p, transactionTypeName(t->type));
+            *p++ = ',';
+            p = formatMoney(p, t->amount);
+            *p++ = ',';
+            p = formatTimestamp(p, t->timestamp, cache);
+            *p++ = ',';
+            p = formatInteger(p, t->relatedAccount);
+            *p++ = ',';
+            p = formatCsvText(p, stringAt(t->description));
+        }
+        *p++ = '\n';
+        out->length = p - out->data;
+        out->rows++;
+    }
+    return 1;
+}
+
+char* formatInteger(char* out, long long value) {
+    char digits[24];
+    int n = 0;
+    unsigned long long v = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    if (value < 0) *out++ = '-';
+    while (n) *out++ = digits[--n];
+    return out;
+}
+
+// Prints two decimals, rounding half away from zero. Amounts too large for
+// exact cents fall back to printf.
+char* formatMoney(char* out, double value) {
+    if (!(value < 1e15 && value > -1e15)) return out + snprintf(out, 32, "%.17g", value);
+    long long cents = (long long)(value * 100 + (value < 0 ? -0.5 : 0.5));
+    if (cents < 0) {
+        *out++ = '-';
+        cents = -cents;
+    }
+    out = formatInteger(out, cents / 100);
+    *out++ = '.';
+    *out++ = '0' + cents % 100 / 10;
+    *out++ = '0' + cents % 10;
+    return out;
+}
+
+// Local time as YYYY-MM-DD HH:MM:SS, like the reports. Zone offsets are whole
+// minutes, so only the seconds change within a cached minute.
+char* formatTimestamp(char* out, time_t value, TimestampCache* cache) {
+    time_t minute = value - ((value % 60) + 60) % 60;
+    if (!cache->valid || cache->minute != minute) {
+        struct tm tm;
+#ifdef _WIN32
+        localtime_s(&tm, &minute);
+#else
+        localtime_r(&minute, &tm);
+#endif
+        cache->length = strftime(cache->prefix, sizeof(cache->prefix), "%Y-%m-%d %H:%M:", &tm);
+        cache->minute = minute;
+        cache->valid = 1;
+    }
+    memcpy(out, cache->prefix, cache->length);
+    out += cache->length;
+    int seconds = (int)(value - minute);
+    *out++ = '0' + seconds / 10;
+    *out++ = '0' + seconds % 10;
+    return out;
+}
+
+// Quotes a field only when it contains a comma, quote or line break.
+char* formatCsvText(char* out, const char* text) {
+    if (strpbrk(text, ",\"\r\n") == NULL) {
+        size_t length = strlen(text);
+        memcpy(out, text, length);
+        return out + length;
+    }
+    *out++ = '"';
+    for (; *text; text++) {
+        if (*text == '"') *out++ = '"';
+        *out++ = *text;
+    }
+    *out++ = '"';
+    return out;
+}
+
+int defaultExportThreads() {
+#ifdef _SC_NPROCESSORS_ONLN
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus < 1 ? 1 : cpus > 8 ? 8 : (int)cpus;
+#else
+    return 4;
+#endif
+}
+
+static const ColumnarColumn ledgerColumns[] = {
+    {"transactionId", 4, 0, 0, 0},
+    {"accountNumber", 4, 0, 0, 0},
+    {"type", 1, 2, 0, 0},
+    {"amount", 8, 1, 0, 0},
+    {"timestamp", 8, 0, 0, 0},
+    {"relatedAccount", 4, 0, 0, 0},
+    {"description", 4, 2, 0, 0},
+    {"typeNames", 0, 3, 0, 0},
+    {"descriptionTexts", 0, 3, 0, 0},
+};
+
+// Writes the ledger as a columnar file for analytics tools: kind 0 columns are
+// little-endian integers, kind 1 doubles, kind 2 dictionary ids and kind 3
+// the dictionaries themselves. Rows are read unlocked as they never change.
+int exportColumnar(const char* path) {
+    enum { COLUMNS = sizeof(ledgerColumns) / sizeof(ledgerColumns[0]) };
+    int rows = __atomic_load_n(&transactionCount, __ATOMIC_ACQUIRE);
+    int strings = __atomic_load_n(&stringCount, __ATOMIC_ACQUIRE);
+
+    ColumnarHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COLUMNAR_MAGIC, sizeof(header.magic));
+    header.version = 1;
+    header.columnCount = COLUMNS;
+    header.rowCount = rows;
+
+    ColumnarColumn columns[COLUMNS];
+    uint64_t offset = sizeof(header) + sizeof(columns);
+    for (int c = 0; c < COLUMNS; c++) {
+        columns[c] = ledgerColumns[c];
+        if (c == COLUMNS - 2) {
+            for (int i = 0; i < TXN_TYPE_COUNT; i++) columns[c].length += strlen(transactionTypeNames[i]) + 1;
+        } else if (c == COLUMNS - 1) {
+            for (int i = 0; i < strings; i++) columns[c].length += strlen(stringAt(i)) + 1;
+        } else {
+            columns[c].length = (uint64_t)rows * columns[c].width;
+        }
+        columns[c].offset = offset;
+        offset += (columns[c].length + 7) & ~7ULL;
+    }
+
+    FILE *file = fopen(path, "wb");
+    unsigned char *buffer = malloc((size_t)EXPORT_BLOCK_ROWS * 8 + 8);
+    if (file == NULL || buffer == NULL) {
+        printf(" Error creating export file '%s'.\n", path);
+        if (file != NULL) fclose(file);
+        free(buffer);
+        return 0;
+    }
+
+    double start = nowSeconds();
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(columns, sizeof(columns), 1, file) == 1;
+    static const char padding[8] = {0};
+    for (int c = 0; ok && c < COLUMNS; c++) {
+        if (c < COLUMNS - 2) {
+            for (int first = 0; ok && first < rows; first += EXPORT_BLOCK_ROWS) {
+                int count = rows - first < EXPORT_BLOCK_ROWS ? rows - first : EXPORT_BLOCK_ROWS;
+                size_t length = fillLedgerColumn(c, first, count, buffer);
+                ok = fwrite(buffer, 1, length, file) == length;
+            }
+        } else {
+            int count = c == COLUMNS - 2 ? TXN_TYPE_COUNT : strings;
+            for (int i = 0; ok && i < count; i++) {
+                const char *text = c == COLUMNS - 2 ? transactionTypeNames[i] : stringAt(i);
+                ok = fwrite(text, 1, strlen(text) + 1, file) == strlen(text) + 1;
+            }
+        }
+        size_t pad = (8 - columns[c].length % 8) % 8;
+        if (ok && pad) ok = fwrite(padding, 1, pad, file) == pad;
+    }
+    free(buffer);
+    if (fclose(file) != 0) ok = 0;
+    if (!ok) {
+        printf(" Error writing export file '%s'.\n", path);
+        return 0;
+    }
+
+    double elapsed = nowSeconds() - start;
+    printf(" Exported %d transactions to %s (%.1f MB in %.2f s, columnar)\n",
+           rows, path, offset / 1e6, elapsed);
+    return 1;
+}
+
+size_t fillLedgerColumn(int column, int first, int count, unsigned char* out) {
+    for (int i = 0; i < count; i++) {
+        const Transaction *t = transactionAt(first + i);
+        switch (column) {
+            case 0: { int32_t v = t->transactionId; memcpy(out + i * 4, &v, 4); break; }
+            case 1: { int32_t v = t->accountNumber; memcpy(out + i * 4, &v, 4); break; }
+            case 2: out[i] = t->type; break;
+            case 3: memcpy(out + i * 8, &t->amount, 8); break;
+            case 4: { int64_t v = t->timestamp; memcpy(out + i * 8, &v, 8); break; }
+            case 5: { int32_t v = t->relatedAccount; memcpy(out + i * 4, &v, 4); break; }
+            case 6: { int32_t v = t->description; memcpy(out + i * 4, &v, 4); break; }
+        }
+    }
+    return (size_t)count * ledgerColumns[column].width;
+}
+
+#ifdef __linux__
+
+volatile sig_atomic_t serverRunning = 1;
+
+void handleServerSignal(int sig) {
+    (void)sig;
+    serverRunning = 0;
+}
+
+// Parses "PORT" as a loopback TCP port and anything else as a Unix socket path.
+int resolveServerAddress(const char* address, struct sockaddr_storage* storage, socklen_t* length) {
+    memset(storage, 0, sizeof(*storage));
+    char *end;
+    long port = strtol(address, &end, 10);
+    if (*end == '\0' && port > 0 && port < 65536) {
+        struct sockaddr_in *in = (struct sockaddr_in*)storage;
+        in->sin_family = AF_INET;
+        in->sin_port = htons((uint16_t)port);
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        *length = sizeof(*in);
+        return 1;
     }
-    clearInputBuffer();
 
-    accounts[currentUserAccount].balance += amount;
-    printf(" Deposit successful. New Balance: %.2f\n", accounts[currentUserAccount].balance);
-    createTransaction(accounts[currentUserAccount].accountNumber, "Deposit", amount, 0, "Cash deposit");
-    saveData();
+    struct sockaddr_un *un = (struct sockaddr_un*)storage;
+    if (strlen(address) >= sizeof(un->sun_path)) return 0;
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, address);
+    *length = sizeof(*un);
+    return 1;
 }
 
-void withdraw() {
-    printf("\n--- Withdraw ---\n");
-    printf("Current Balance: %.2f\n", accounts[currentUserAccount].balance);
+void sessionReply(ServerSession* session, const char* format, ...) {
+    char line[SESSION_BUFFER_SIZE];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length < 0) return;
+    if (length >= (int)sizeof(line)) length = sizeof(line) - 1;
+
+    if (session->outputLength + length > session->outputCapacity) {
+        size_t capacity = session->outputCapacity ? session->outputCapacity : SESSION_BUFFER_SIZE;
+        while (capacity < session->outputLength + length) capacity *= 2;
+        char *output = realloc(session->output, capacity);
+        if (output == NULL) return;
+        session->output = output;
+        session->outputCapacity = capacity;
+    }
+    memcpy(session->output + session->outputLength, line, length);
+    session->outputLength += length;
+}
 
-    printf("Enter amount to withdraw: ");
+// Executes one protocol line against the shared business logic.
+void handleSessionCommand(ServerSession* session, char* line) {
+    char *cursor = line;
+    char *command = nextBatchToken(&cursor);
+    if (command == NULL) return;
+    for (char *c = command; *c; c++) *c = toupper((unsigned char)*c);
+
+    int accIndex, result;
     double amount;
-    while (scanf("%lf", &amount) != 1 || amount <= 0) {
-        printf(" Invalid amount! Please enter a positive number: ");
-        clearInputBuffer();
+
+    if (strcmp(command, "QUIT") == 0) {
+        sessionReply(session, "OK bye\n");
+        session->closing = 1;
+        return;
     }
-    clearInputBuffer();
 
-    if (!validateTransaction(currentUserAccount, amount)) {
-        printf(" Insufficient funds or account locked.\n");
+    // A follower's state comes only from its primary.
+    if (followerMode && (strcmp(command, "REGISTER") == 0 || strcmp(command, "DEPOSIT") == 0 ||
+                         strcmp(command, "WITHDRAW") == 0 || strcmp(command, "TRANSFER") == 0)) {
+        sessionReply(session, "ERR read-only follower\n");
         return;
     }
 
-    accounts[currentUserAccount].balance -= amount;
-    printf(" Withdrawal successful. New Balance: %.2f\n", accounts[currentUserAccount].balance);
-    createTransaction(accounts[currentUserAccount].accountNumber, "Withdrawal", amount, 0, "Cash withdrawal");
-    saveData();
-}
+    if (strcmp(command, "REGISTER") == 0) {
+        char *number = nextBatchToken(&cursor), *password = nextBatchToken(&cursor);
+        char *firstName = nextBatchToken(&cursor), *lastName = nextBatchToken(&cursor);
+        char *deposit = nextBatchToken(&cursor);
+        long accountNumber = number ? strtol(number, NULL, 10) : 0;
+        if (accountNumber <= 0 || accountNumber > 2147483647L || lastName == NULL ||
+            strlen(firstName) >= MAX_NAME_LENGTH || strlen(lastName) >= MAX_NAME_LENGTH ||
+            strlen(password) >= 50 || strchr(firstName, '|') || strchr(lastName, '|') || strchr(password, '|')) {
+            sessionReply(session, "ERR usage: REGISTER ACCOUNT PASSWORD FIRST LAST [DEPOSIT]\n");
+            return;
+        }
+        if (!validatePassword(password)) {
+            sessionReply(session, "ERR password must be at least 6 characters with a number\n");
+            return;
+        }
+        // The opening deposit must parse as a batch amount would, except that
+        // it may be zero.
+        double opening = 0;
+        int amountResult = deposit ? parseBatchAmount(deposit, &opening) : TXN_OK;
+        if (amountResult == TXN_INVALID_AMOUNT && opening == 0) {
+            amountResult = TXN_OK;
+            opening = 0;
+        }
+        if (amountResult != TXN_OK) {
+            sessionReply(session, "ERR %s\n", transactionResultMessage(TXN_INVALID_AMOUNT));
+            return;
+        }
 
-void transfer() {
-    printf("\n--- Transfer ---\n");
-    printf("Current Balance: %.2f\n", accounts[currentUserAccount].balance);
+        Account a;
+        AccountProfile profile;
+        memset(&a, 0, sizeof(a));
+        a.accountNumber = (int)accountNumber;
+        strcpy(profile.firstName, firstName);
+        strcpy(profile.lastName, lastName);
+        strcpy(profile.password, password);
+        a.balance = opening;
+        a.isActive = 1;
+        a.lastInterestDate = time(NULL);
+
+        beginExclusiveAccess();
+        accIndex = findAccountByNumber(a.accountNumber) == -1 ? appendAccount(&a, &profile) : -2;
+        if (accIndex >= 0) {
+            journalAccount(accIndex);
+            createTransaction(a.accountNumber, TXN_TYPE_ACCOUNT_OPEN, a.balance, 0, "Initial deposit");
+        }
+        endExclusiveAccess();
 
-    printf("Enter destination account number: ");
-    int destAccNum;
-    if (scanf("%d", &destAccNum) != 1) {
-        printf(" Invalid account number!\n");
-        clearInputBuffer();
+        if (accIndex == -2) sessionReply(session, "ERR account exists\n");
+        else if (accIndex == -1) sessionReply(session, "ERR out of memory\n");
+        else if (!commitChanges()) sessionReply(session, "ERR not durable\n");
+        else sessionReply(session, "OK %d\n", a.accountNumber);
         return;
     }
-    clearInputBuffer();
 
-    int destAccIndex = findAccountByNumber(destAccNum);
-    if (destAccIndex == -1 || !accounts[destAccIndex].isActive) {
-        printf(" Destination account not found or inactive.\n");
-        return;
-    }
+    if (strcmp(command, "LOGIN") == 0) {
+        char *number = nextBatchToken(&cursor), *password = nextBatchToken(&cursor);
+        if (password == NULL) {
+            sessionReply(session, "ERR usage: LOGIN ACCOUNT PASSWORD\n");
+            return;
+        }
+        uint64_t start = nowNanoseconds();
+        beginSharedAccess();
+        accIndex = findAccountByNumber((int)strtol(number, NULL, 10));
+        if (accIndex == -1) {
+            result = TXN_NOT_FOUND;
+        } else {
+            lockAccount(accIndex);
+            Account *a = accountAt(accIndex);
+            AccountProfile *profile = profileAt(accIndex);
+            if (!a->isActive) result = TXN_INACTIVE;
+            else if (a->isLocked) result = TXN_LOCKED;
+            else if (strcmp(profile->password, password) != 0) result = TXN_BAD_PASSWORD;
+            else {
+                result = TXN_OK;
+                sessionReply(session, "OK %s %s\n", profile->firstName, profile->lastName);
+            }
+            unlockAccount(accIndex);
+        }
+        endSharedAccess();
+        recordOperation(METRIC_LOGIN, result, start);
 
-    if (destAccIndex == currentUserAccount) {
-        printf(" Cannot transfer to same account.\n");
+        if (result != TXN_OK) sessionReply(session, "ERR %s\n", transactionResultMessage(result));
+        else session->accountIndex = accIndex;
         return;
     }
 
-    printf("Destination: %s %s\n", accounts[destAccIndex].firstName, accounts[destAccIndex].lastName);
-
-    printf("Enter amount to transfer: ");
-    double amount;
-    while (scanf("%lf", &amount) != 1 || amount <= 0) {
-        printf(" Invalid amount! Please enter a positive number: ");
-        clearInputBuffer();
+    if (strcmp(command, "METRICS") == 0) {
+        char *text = NULL;
+        size_t size = 0;
+        FILE *out = open_memstream(&text, &size);
+        if (out == NULL) {
+            sessionReply(session, "ERR out of memory\n");
+            return;
+        }
+        writeMetrics(out);
+        fclose(out);
+
+        int lines = 0;
+        for (size_t i = 0; i < size; i++) lines += text[i] == '\n';
+        sessionReply(session, "OK %d\n", lines);
+        for (char *line = text, *end; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+            sessionReply(session, "%.*s\n", (int)(end - line), line);
+        }
+        free(text);
+        return;
     }
-    clearInputBuffer();
 
-    if (!validateTransaction(currentUserAccount, amount)) {
-        printf(" Insufficient funds or account locked.\n");
+    if (session->accountIndex == -1) {
+        sessionReply(session, "ERR not logged in\n");
         return;
     }
+    accIndex = session->accountIndex;
+
+    if (strcmp(command, "LOGOUT") == 0) {
+        session->accountIndex = -1;
+        sessionReply(session, "OK\n");
+    } else if (strcmp(command, "BALANCE") == 0) {
+        uint64_t start = nowNanoseconds();
+        lockAccount(accIndex);
+        amount = accountAt(accIndex)->balance;
+        unlockAccount(accIndex);
+        recordOperation(METRIC_BALANCE, TXN_OK, start);
+        sessionReply(session, "OK %.2f\n", amount);
+    } else if (strcmp(command, "DEPOSIT") == 0 || strcmp(command, "WITHDRAW") == 0) {
+        if ((result = parseBatchAmount(nextBatchToken(&cursor), &amount)) == TXN_OK) {
+            result = command[0] == 'D' ? applyDeposit(accIndex, amount) : applyWithdrawal(accIndex, amount);
+        }
+        if (result != TXN_OK) {
+            sessionReply(session, "ERR %s\n", transactionResultMessage(result));
+            return;
+        }
+        if (!commitChanges()) {
+            sessionReply(session, "ERR not durable\n");
+            return;
+        }
+        lockAccount(accIndex);
+        amount = accountAt(accIndex)->balance;
+        unlockAccount(accIndex);
+        sessionReply(session, "OK %.2f\n", amount);
+    } else if (strcmp(command, "TRANSFER") == 0) {
+        int destIndex;
+        beginSharedAccess();
+        if ((result = parseBatchAccount(nextBatchToken(&cursor), &destIndex)) == TXN_OK &&
+            (result = parseBatchAmount(nextBatchToken(&cursor), &amount)) == TXN_OK) {
+            result = applyTransfer(accIndex, destIndex, amount);
+        }
+        endSharedAccess();
+        if (result != TXN_OK) {
+            sessionReply(session, "ERR %s\n", transactionResultMessage(result));
+            return;
+        }
+        if (!commitChanges()) {
+            sessionReply(session, "ERR not durable\n");
+            return;
+        }
+        lockAccount(accIndex);
+        amount = accountAt(accIndex)->balance;
+        unlockAccount(accIndex);
+        sessionReply(session, "OK %.2f\n", amount);
+    } else if (strcmp(command, "HISTORY") == 0) {
+        char *count = nextBatchToken(&cursor);
+        int limit = count ? atoi(count) : HISTORY_PAGE_SIZE;
+        if (limit <= 0 || limit > 100) limit = HISTORY_PAGE_SIZE;
+
+        uint64_t start = nowNanoseconds();
+        int rows[100], found = 0;
+        lockAccount(accIndex);
+        for (int cursorIndex = accountAt(accIndex)->lastTransaction;
+             cursorIndex != -1 && found < limit;
+             cursorIndex = transactionAt(cursorIndex)->previousForAccount) {
+            rows[found++] = cursorIndex;
+        }
+        unlockAccount(accIndex);
+
+        // Ledger entries never change once written, so they can be read unlocked.
+        sessionReply(session, "OK %d\n", found);
+        for (int i = 0; i < found; i++) {
+            Transaction *t = transactionAt(rows[i]);
+            sessionReply(session, "%d|%ld|%s|%.2f|%d|%s\n", t->transactionId, (long)t->timestamp,
+                         transactionTypeName(t->type), t->amount, t->relatedAccount, stringAt(t->description));
+        }
+        recordOperation(METRIC_HISTORY, TXN_OK, start);
+    } else if (strcmp(command, "STATEMENT") == 0) {
+        char *period = nextBatchToken(&cursor), *count = nextBatchToken(&cursor);
+        int monthly = period == NULL || toupper((unsigned char)period[0]) != 'D';
+        int limit = count ? atoi(count) : HISTORY_PAGE_SIZE;
+        if (limit <= 0 || limit > 100) limit = HISTORY_PAGE_SIZE;
+
+        uint64_t start = nowNanoseconds();
+        int found;
+        double opening;
+        Rollup *rows = collectRollups(accIndex, monthly, INT32_MIN, INT32_MAX, limit, &found, &opening);
+        if (rows == NULL) {
+            sessionReply(session, "ERR out of memory\n");
+            return;
+        }
+        sessionReply(session, "OK %d\n", found);
+        for (int i = 0; i < found; i++) {
+            Rollup *r = &rows[i];
+            char text[16];
+            formatRollupPeriod(text, sizeof(text), r->period, monthly);
+            sessionReply(session, "%s|%.2f|%.2f|%.2f|%.2f|%.2f|%.2f|%.2f|%d\n", text, r->opening, r->deposits,
+                         r->withdrawals, r->transfersIn, r->transfersOut, r->interest, rollupClosing(r), r->entries);
+        }
+        free(rows);
+        recordOperation(METRIC_STATEMENT, TXN_OK, start);
+    } else {
+        sessionReply(session, "ERR unknown command\n");
+    }
+}
 
-    accounts[currentUserAccount].balance -= amount;
-    accounts[destAccIndex].balance += amount;
+void closeSession(int epollFd, ServerSession* session) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, session->fd, NULL);
+    close(session->fd);
+    free(session->output);
+    free(session);
+}
 
-    printf(" Transfer successful. New Balance: %.2f\n", accounts[currentUserAccount].balance);
+// Returns 0 once the session should be closed.
+int flushSession(int epollFd, ServerSession* session) {
+    while (session->outputSent < session->outputLength) {
+        ssize_t n = send(session->fd, session->output + session->outputSent,
+                         session->outputLength - session->outputSent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        session->outputSent += (size_t)n;
+    }
+    if (session->outputSent == session->outputLength) {
+        session->outputSent = session->outputLength = 0;
+    }
 
-    char desc[100];
-    snprintf(desc, sizeof(desc), "Transfer to %s %s", accounts[destAccIndex].firstName, accounts[destAccIndex].lastName);
-    createTransaction(accounts[currentUserAccount].accountNumber, "Transfer", amount, destAccNum, desc);
-    saveData();
+    // Only ask for writability while there is output queued.
+    int wantWrite = session->outputLength > 0;
+    if (wantWrite != session->wantsWrite) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | (wantWrite ? EPOLLOUT : 0);
+        ev.data.ptr = session;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, session->fd, &ev);
+        session->wantsWrite = wantWrite;
+    }
+    return !(session->closing && session->outputLength == 0);
 }
 
-int validateTransaction(int accountIndex, double amount) {
-    return accounts[accountIndex].isActive &&
-           !accounts[accountIndex].isLocked &&
-           accounts[accountIndex].balance >= amount;
-}
+// Returns 0 once the session should be closed.
+int readSession(ServerSession* session) {
+    for (;;) {
+        ssize_t n = recv(session->fd, session->input + session->inputLength,
+                         sizeof(session->input) - session->inputLength, 0);
+        if (n == 0) return 0;
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        session->inputLength += (size_t)n;
+
+        size_t start = 0;
+        for (size_t i = 0; i < session->inputLength; i++) {
+            if (session->input[i] != '\n') continue;
+            session->input[i] = '\0';
+            handleSessionCommand(session, session->input + start);
+            start = i + 1;
+        }
+        memmove(session->input, session->input + start, session->inputLength - start);
+        session->inputLength -= start;
 
-void balanceInquiry() {
-    printf("\n--- Balance Inquiry ---\n");
-    printf("==========================================\n");
-    printf("Account Number: %d\n", accounts[currentUserAccount].accountNumber);
-    printf("Account Holder: %s %s\n", accounts[currentUserAccount].firstName, accounts[currentUserAccount].lastName);
-    printf("Account Type: %s\n", accounts[currentUserAccount].isSavings ? "Savings" : "Current");
-    printf("Current Balance: %.2f\n", accounts[currentUserAccount].balance);
-    printf("==========================================\n");
-    createTransaction(accounts[currentUserAccount].accountNumber, "Balance Check", 0, 0, "Balance inquiry");
+        if (session->inputLength == sizeof(session->input)) {
+            sessionReply(session, "ERR line too long\n");
+            session->closing = 1;
+            return 1;
+        }
+    }
 }
 
-void calculateInterest() {
-    printf("\n--- Calculate Interest ---\n");
-    time_t now = time(NULL);
-    int count = 0;
+void* serverLoop(void* arg) {
+    int listenFd = *(int*)arg;
+    int epollFd = epoll_create1(0);
+    if (epollFd < 0) {
+        perror(" epoll_create1");
+        return NULL;
+    }
 
-    for (int i = 0; i < accountCount; i++) {
-        if (accounts[i].isSavings && accounts[i].isActive && !accounts[i].isLocked &&
-            difftime(now, accounts[i].lastInterestDate) >= 30 * 24 * 3600) {
+    // Every loop watches the listening socket; EPOLLEXCLUSIVE wakes only one
+    // of them per incoming connection, and that loop owns the session.
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (serverRunning) {
+        int ready = epoll_wait(epollFd, events, SERVER_MAX_EVENTS, 500);
+        for (int i = 0; i < ready; i++) {
+            ServerSession *session = events[i].data.ptr;
+            if (session == NULL) {
+                int fd;
+                while ((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    ServerSession *newSession = calloc(1, sizeof(ServerSession));
+                    if (newSession == NULL) {
+                        close(fd);
+                        continue;
+                    }
+                    newSession->fd = fd;
+                    newSession->accountIndex = -1;
+                    struct epoll_event sessionEvent;
+                    sessionEvent.events = EPOLLIN | EPOLLRDHUP;
+                    sessionEvent.data.ptr = newSession;
+                    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &sessionEvent);
+                }
+                continue;
+            }
 
-            double interest = accounts[i].balance * INTEREST_RATE;
-            accounts[i].balance += interest;
-            accounts[i].lastInterestDate = now;
+            int alive = 1;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                alive = readSession(session);
+            }
+            if (alive) alive = flushSession(epollFd, session);
+            if (!alive) closeSession(epollFd, session);
+        }
+    }
 
-            printf("Account %d: Interest %.2f added\n", accounts[i].accountNumber, interest);
+    close(epollFd);
+    return NULL;
+}
 
-            char desc[100];
-            snprintf(desc, sizeof(desc), "Monthly interest @ %.1f%%", INTEREST_RATE * 100);
-            createTransaction(accounts[i].accountNumber, "Interest", interest, 0, desc);
-            count++;
-        }
+// Serves the line protocol on ADDRESS with a handful of event loop threads:
+//   REGISTER ACCOUNT PASSWORD FIRST LAST [DEPOSIT], LOGIN ACCOUNT PASSWORD,
+//   BALANCE, DEPOSIT AMOUNT, WITHDRAW AMOUNT, TRANSFER ACCOUNT AMOUNT,
+//   HISTORY [N], STATEMENT [MONTHLY|DAILY] [N], LOGOUT, QUIT
+// Replies are "OK ..." or "ERR reason"; the "OK N" of HISTORY and STATEMENT is
+// followed by N rows, newest first.
+int runServer(const char* address, int threads) {
+    struct sockaddr_storage storage;
+    socklen_t length;
+    if (threads < 1 || !resolveServerAddress(address, &storage, &length)) {
+        printf(" Invalid server address '%s'.\n", address);
+        return 0;
     }
 
-    printf(" Interest calculated for %d savings accounts.\n", count);
-    saveData();
+    int listenFd = socket(storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (storage.ss_family == AF_UNIX) unlink(((struct sockaddr_un*)&storage)->sun_path);
+    else setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (listenFd < 0 || bind(listenFd, (struct sockaddr*)&storage, length) != 0 ||
+        listen(listenFd, SOMAXCONN) != 0) {
+        perror(" Cannot listen");
+        if (listenFd >= 0) close(listenFd);
+        return 0;
+    }
+
+    signal(SIGINT, handleServerSignal);
+    signal(SIGTERM, handleServerSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_t *loops = calloc(threads, sizeof(pthread_t));
+    if (loops == NULL) {
+        close(listenFd);
+        return 0;
+    }
+    for (int i = 0; i < threads; i++) pthread_create(&loops[i], NULL, serverLoop, &listenFd);
+    printf(" Serving on %s with %d event loop thread(s). Press Ctrl+C to stop.\n", address, threads);
+    fflush(stdout);
+
+    for (int i = 0; i < threads; i++) pthread_join(loops[i], NULL);
+    free(loops);
+    close(listenFd);
+    if (storage.ss_family == AF_UNIX) unlink(((struct sockaddr_un*)&storage)->sun_path);
+    printf(" Server stopped.\n");
+    return 1;
 }
 
-void printAccountDetails(int accountIndex) {
-    printf("\n==========================================\n");
-    printf("Account Number: %d\n", accounts[accountIndex].accountNumber);
-    printf("Account Holder: %s %s\n", accounts[accountIndex].firstName, accounts[accountIndex].lastName);
-    printf("Balance: %.2f\n", accounts[accountIndex].balance);
-    printf("Type: %s\n", accounts[accountIndex].isSavings ? "Savings" : "Current");
-    printf("Status: %s\n", accounts[accountIndex].isActive ? "Active" : "Inactive");
-    printf("Locked: %s\n", accounts[accountIndex].isLocked ? "Yes" : "No");
-    printf("==========================================\n");
+int connectToServer(const char* address) {
+    struct sockaddr_storage storage;
+    socklen_t length;
+    if (!resolveServerAddress(address, &storage, &length)) return -1;
+
+    int fd = socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&storage, length) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
 }
 
+// Sends one request and reads one reply line on a blocking socket.
+int loadRequest(int fd, const char* request, char* reply, size_t size) {
+    size_t length = strlen(request);
+    if (send(fd, request, length, MSG_NOSIGNAL) != (ssize_t)length) return 0;
 
+    size_t used = 0;
+    while (used + 1 < size) {
+        ssize_t n = recv(fd, reply + used, 1, 0);
+        if (n <= 0) return 0;
+        if (reply[used++] == '\n') break;
+    }
+    reply[used] = '\0';
+    return 1;
+}
 
-void generateReports() {
-    int choice;
-    do {
-        printf("\n--- Generate Reports ---\n");
-        printf("1. Account Balance Report\n");
-        printf("2. Transaction Report\n");
-        printf("3. Export to CSV\n");
-        printf("4. Back to Admin Menu\n");
-        printf("Enter your choice: ");
+void* loadWorker(void* arg) {
+    LoadWorker *w = arg;
+    int epollFd = epoll_create1(0);
+    LoadConnection *connections = calloc(w->connectionCount, sizeof(LoadConnection));
+    if (epollFd < 0 || connections == NULL) {
+        free(connections);
+        if (epollFd >= 0) close(epollFd);
+        return NULL;
+    }
 
-        if (scanf("%d", &choice) != 1) {
-            printf(" Invalid input! Please enter a number.\n");
-            clearInputBuffer();
+    // Set up each connection synchronously, then drive them all from epoll.
+    char reply[256], request[256];
+    int openConnections = 0;
+    for (int i = 0; i < w->connectionCount; i++) {
+        LoadConnection *c = &connections[i];
+        c->fd = connectToServer(w->address);
+        c->accountNumber = LOADGEN_BASE_ACCOUNT + w->firstConnection + i;
+        if (c->fd < 0) {
+            w->failures++;
             continue;
         }
-        clearInputBuffer();
+        snprintf(request, sizeof(request), "REGISTER %d load123 Load Client%d 1000\n", c->accountNumber, c->accountNumber);
+        loadRequest(c->fd, request, reply, sizeof(reply));
+        snprintf(request, sizeof(request), "LOGIN %d load123\n", c->accountNumber);
+        if (!loadRequest(c->fd, request, reply, sizeof(reply)) || strncmp(reply, "OK", 2) != 0) {
+            w->failures++;
+            close(c->fd);
+            c->fd = -1;
+            continue;
+        }
+        fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, c->fd, &ev);
+        c->seed = 0x9E3779B97F4A7C15ULL * (uint64_t)(c->accountNumber);
+        openConnections++;
+    }
 
-        switch(choice) {
-            case 1:
-                listAllAccounts();
-                break;
-            case 2: {
-                printf("Enter account number (0 for all accounts): ");
-                int accNum;
-                if (scanf("%d", &accNum) != 1) {
-                    printf(" Invalid input!\n");
-                    clearInputBuffer();
-                    break;
-                }
-                clearInputBuffer();
+    for (int i = 0; i < w->connectionCount; i++) {
+        if (connections[i].fd >= 0) loadSendNext(w, &connections[i]);
+    }
 
-                if (accNum == 0) {
-                    printf("\n--- All Transactions ---\n");
-                    for (int i = 0; i < transactionCount; i++) {
-                        char dateStr[50];
-                        strftime(dateStr, sizeof(dateStr), "%Y-%m-%d %H:%M:%S", localtime(&transactions[i].timestamp));
-                        printf("[%s] Acc:%d %s: %.2f - %s\n", dateStr, transactions[i].accountNumber,
-                               transactions[i].type, transactions[i].amount, transactions[i].description);
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (openConnections > 0) {
+        int ready = epoll_wait(epollFd, events, SERVER_MAX_EVENTS, 5000);
+        if (ready <= 0) break;
+        for (int i = 0; i < ready; i++) {
+            LoadConnection *c = events[i].data.ptr;
+            ssize_t n = recv(c->fd, c->input + c->inputLength, sizeof(c->input) - c->inputLength, 0);
+            if (n <= 0) {
+                if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+                w->failures++;
+                close(c->fd);
+                c->fd = -1;
+                openConnections--;
+                continue;
+            }
+            c->inputLength += (size_t)n;
+
+            size_t start = 0;
+            for (size_t j = 0; j < c->inputLength && c->fd >= 0; j++) {
+                if (c->input[j] != '\n') continue;
+                // A HISTORY reply announces how many rows follow its status line.
+                if (c->awaitingStatus) {
+                    c->awaitingStatus = 0;
+                    if (strncmp(c->input + start, "OK", 2) != 0) w->rejected++;
+                    if (c->lastWasHistory && strncmp(c->input + start, "OK ", 3) == 0) {
+                        c->pendingLines = atoi(c->input + start + 3);
                     }
                 } else {
-                    displayTransactionHistory(accNum);
+                    c->pendingLines--;
                 }
-                break;
-            }
-            case 3: {
-                time_t now = time(NULL);
-                struct tm *tm = localtime(&now);
-                char filename[100];
-                snprintf(filename, sizeof(filename), "report_%04d%02d%02d_%02d%02d%02d.csv",
-                        tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
-                        tm->tm_hour, tm->tm_min, tm->tm_sec);
-
-                FILE *file = fopen(filename, "w");
-                if (file) {
-                    fprintf(file, "AccountNumber,FirstName,LastName,Balance,Type,Status,Locked\n");
-                    for (int i = 0; i < accountCount; i++) {
-                        if (accounts[i].isActive) {
-                            fprintf(file, "%d,%s,%s,%.2f,%s,%s,%s\n",
-                                   accounts[i].accountNumber,
-                                   accounts[i].firstName,
-                                   accounts[i].lastName,
-                                   accounts[i].balance,
-                                   accounts[i].isSavings ? "Savings" : "Current",
-                                   "Active",
-                                   accounts[i].isLocked ? "Yes" : "No");
-                        }
+                start = j + 1;
+
+                if (!c->awaitingStatus && c->pendingLines <= 0) {
+                    double latency = nowSeconds() - c->sentAt;
+                    w->totalLatency += latency;
+                    if (latency > w->maxLatency) w->maxLatency = latency;
+                    w->completed++;
+                    if (++c->completed >= w->requestsPerConnection) {
+                        send(c->fd, "QUIT\n", 5, MSG_NOSIGNAL);
+                        close(c->fd);
+                        c->fd = -1;
+                        openConnections--;
+                    } else {
+                        loadSendNext(w, c);
                     }
-                    fclose(file);
-                    printf(" Report exported to %s\n", filename);
-                } else {
-                    printf(" Error creating report file.\n");
                 }
-                break;
             }
-            case 4:
-                break;
-            default:
-                printf(" Invalid choice. Please try again.\n");
+            if (c->fd >= 0) {
+                memmove(c->input, c->input + start, c->inputLength - start);
+                c->inputLength -= start;
+            }
+        }
+    }
+
+    for (int i = 0; i < w->connectionCount; i++) {
+        if (connections[i].fd >= 0) close(connections[i].fd);
+    }
+    free(connections);
+    close(epollFd);
+    return NULL;
+}
+
+void loadSendNext(LoadWorker* w, LoadConnection* c) {
+    char request[128];
+    uint64_t r = nextRandom(&c->seed);
+    int kind = (int)(r % 10);
+    int amount = 1 + (int)((r >> 8) % 50);
+    int other = LOADGEN_BASE_ACCOUNT + (int)((r >> 24) % (uint64_t)w->totalConnections);
+
+    c->lastWasHistory = 0;
+    if (kind < 3) snprintf(request, sizeof(request), "BALANCE\n");
+    else if (kind < 5) snprintf(request, sizeof(request), "DEPOSIT %d\n", amount);
+    else if (kind < 7) snprintf(request, sizeof(request), "WITHDRAW %d\n", amount);
+    else if (kind < 9) snprintf(request, sizeof(request), "TRANSFER %d %d\n", other, amount);
+    else {
+        snprintf(request, sizeof(request), "HISTORY 5\n");
+        c->lastWasHistory = 1;
+    }
+
+    c->awaitingStatus = 1;
+    c->pendingLines = 0;
+    c->sentAt = nowSeconds();
+    size_t length = strlen(request);
+    if (send(c->fd, request, length, MSG_NOSIGNAL) != (ssize_t)length) {
+        w->failures++;
+    }
+}
+
+// Opens CONNECTIONS sessions spread over THREADS epoll loops, registers and
+// logs each into its own account, then issues a random request mix.
+void runLoadGenerator(const char* address, int connections, int requests, int threads) {
+    if (connections < 1 || requests < 1 || threads < 1) {
+        printf(" Usage: --loadgen ADDRESS CONNECTIONS REQUESTS [THREADS]\n");
+        return;
+    }
+    if (threads > connections) threads = connections;
+
+    LoadWorker *workers = calloc(threads, sizeof(LoadWorker));
+    pthread_t *ids = calloc(threads, sizeof(pthread_t));
+    if (workers == NULL || ids == NULL) {
+        free(workers);
+        free(ids);
+        return;
+    }
+
+    double start = nowSeconds();
+    for (int t = 0, first = 0; t < threads; t++) {
+        workers[t].address = address;
+        workers[t].firstConnection = first;
+        workers[t].connectionCount = connections / threads + (t < connections % threads);
+        workers[t].totalConnections = connections;
+        workers[t].requestsPerConnection = requests;
+        first += workers[t].connectionCount;
+        pthread_create(&ids[t], NULL, loadWorker, &workers[t]);
+    }
+
+    long completed = 0, rejected = 0, failures = 0;
+    double totalLatency = 0, maxLatency = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+        completed += workers[t].completed;
+        rejected += workers[t].rejected;
+        failures += workers[t].failures;
+        totalLatency += workers[t].totalLatency;
+        if (workers[t].maxLatency > maxLatency) maxLatency = workers[t].maxLatency;
+    }
+    double elapsed = nowSeconds() - start;
+
+    printf(" Connections: %d, requests completed: %ld (%ld rejected by server), failures: %ld\n",
+           connections, completed, rejected, failures);
+    printf(" Elapsed: %.3f s, throughput: %.0f req/sec, mean latency: %.1f us, max: %.1f us\n",
+           elapsed, elapsed > 0 ? completed / elapsed : 0,
+           completed ? totalLatency / completed * 1e6 : 0, maxLatency * 1e6);
+    free(workers);
+    free(ids);
+}
+
+// Opens the replication socket. Followers attach to it from the primary's data
+// directory; see runFollower().
+int startReplication(const char* address) {
+    if (journalFile == NULL) {
+        printf(" WARNING: Replication needs the journal. Not replicating.\n");
+        return 0;
+    }
+    struct sockaddr_storage storage;
+    socklen_t length;
+    if (!resolveServerAddress(address, &storage, &length)) {
+        printf(" Invalid replication address '%s'.\n", address);
+        return 0;
+    }
+
+    checkpointLockFd = open(CHECKPOINT_LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    int fd = socket(storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (storage.ss_family == AF_UNIX) unlink(((struct sockaddr_un*)&storage)->sun_path);
+    else setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (checkpointLockFd < 0 || fd < 0 || bind(fd, (struct sockaddr*)&storage, length) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        perror(" Cannot start replication");
+        if (fd >= 0) close(fd);
+        if (checkpointLockFd >= 0) close(checkpointLockFd);
+        checkpointLockFd = -1;
+        return 0;
+    }
+    replicationFd = fd;
+    replicationRunning = 1;
+    if (pthread_create(&replicationThread, NULL, replicationMain, NULL) != 0) {
+        printf(" WARNING: Cannot start the replication thread. Not replicating.\n");
+        replicationRunning = 0;
+        close(fd);
+        replicationFd = -1;
+        return 0;
+    }
+    printf(" Replicating to followers on %s\n", address);
+    return 1;
+}
+
+void* replicationMain(void* arg) {
+    (void)arg;
+    struct pollfd fds[REPLICATION_MAX_FOLLOWERS + 1];
+    while (__atomic_load_n(&replicationRunning, __ATOMIC_ACQUIRE)) {
+        fds[0].fd = replicationFd;
+        fds[0].events = POLLIN;
+        int count = replicationFollowerCount;
+        for (int i = 0; i < count; i++) {
+            fds[i + 1].fd = replicationFollowers[i].fd;
+            fds[i + 1].events = replicationFollowers[i].length > 0 ? POLLOUT : 0;
+        }
+        poll(fds, count + 1, REPLICATION_INTERVAL_MS);
+        shipReplication();
+    }
+    return NULL;
+}
+
+// Ships what was journaled since the last round to every follower, then takes
+// on followers that connected meanwhile.
+// A new follower is greeted only after the journal is flushed, so anything it
+// is not sent is already on disk for it to load.
+void shipReplication() {
+    if (replicationFd < 0) return;
+
+    pthread_mutex_lock(&journalLock);
+    char *data = replicationPending;
+    size_t length = replicationPendingLength;
+    size_t capacity = replicationPendingCapacity;
+    replicationPending = replicationShipping;
+    replicationPendingCapacity = replicationShippingCapacity;
+    replicationPendingLength = 0;
+    replicationShipping = data;
+    replicationShippingCapacity = capacity;
+    int lost = replicationLost;
+    replicationLost = 0;
+    pthread_mutex_unlock(&journalLock);
+
+    char heartbeat[32];
+    int heartbeatLength = snprintf(heartbeat, sizeof(heartbeat), "H|%lld\n", (long long)wallMicroseconds());
+    for (int i = 0; i < replicationFollowerCount; ) {
+        ReplicationFollower *f = &replicationFollowers[i];
+        if (lost || !replicationAppend(&f->data, &f->length, &f->capacity, data, length) ||
+            !replicationAppend(&f->data, &f->length, &f->capacity, heartbeat, heartbeatLength)) {
+            dropFollower(i, "out of memory for its stream");
+        } else if (!sendReplication(f)) {
+            dropFollower(i, "disconnected or too far behind");
+        } else {
+            i++;
+        }
+    }
+
+    int first = replicationFollowerCount, fd;
+    while ((fd = accept4(replicationFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (replicationFollowerCount == REPLICATION_MAX_FOLLOWERS) {
+            close(fd);
+            continue;
+        }
+        memset(&replicationFollowers[replicationFollowerCount], 0, sizeof(ReplicationFollower));
+        replicationFollowers[replicationFollowerCount].fd = fd;
+        pthread_mutex_lock(&journalLock);
+        __atomic_store_n(&replicationFollowerCount, replicationFollowerCount + 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&journalLock);
+    }
+    if (replicationFollowerCount == first) return;
+
+    flushJournal();
+    for (int i = first; i < replicationFollowerCount; ) {
+        ReplicationFollower *f = &replicationFollowers[i];
+        if (!replicationAppend(&f->data, &f->length, &f->capacity, "OK\n", 3) ||
+            !replicationAppend(&f->data, &f->length, &f->capacity, heartbeat, heartbeatLength) ||
+            !sendReplication(f)) {
+            dropFollower(i, "could not be greeted");
+        } else {
+            printf(" Replication follower attached.\n");
+            i++;
+        }
+    }
+}
+
+// Sends as much of the follower's backlog as its socket takes. Returns 0 once
+// the follower is gone or its backlog passes REPLICATION_BUFFER_LIMIT.
+int sendReplication(ReplicationFollower* follower) {
+    while (follower->sent < follower->length) {
+        ssize_t sent = send(follower->fd, follower->data + follower->sent,
+                            follower->length - follower->sent, MSG_NOSIGNAL);
+        if (sent > 0) follower->sent += sent;
+        else if (sent < 0 && errno == EINTR) continue;
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        else return 0;
+    }
+    if (follower->sent > 0) {
+        memmove(follower->data, follower->data + follower->sent, follower->length - follower->sent);
+        follower->length -= follower->sent;
+        follower->sent = 0;
+    }
+    return follower->length <= REPLICATION_BUFFER_LIMIT;
+}
+
+void dropFollower(int index, const char* reason) {
+    if (reason != NULL) printf(" WARNING: Dropped a replication follower: %s.\n", reason);
+    close(replicationFollowers[index].fd);
+    free(replicationFollowers[index].data);
+
+    pthread_mutex_lock(&journalLock);
+    int last = replicationFollowerCount - 1;
+    replicationFollowers[index] = replicationFollowers[last];
+    __atomic_store_n(&replicationFollowerCount, last, __ATOMIC_RELAXED);
+    if (last == 0) replicationPendingLength = 0;
+    pthread_mutex_unlock(&journalLock);
+}
+
+// Gives each follower up to a second to take the rest of its stream, then
+// closes the socket. Followers keep serving what they have.
+void stopReplication() {
+    if (replicationFd < 0) return;
+
+    __atomic_store_n(&replicationRunning, 0, __ATOMIC_RELEASE);
+    pthread_join(replicationThread, NULL);
+    shipReplication();
+    while (replicationFollowerCount > 0) {
+        ReplicationFollower *f = &replicationFollowers[replicationFollowerCount - 1];
+        struct timeval timeout = {1, 0};
+        setsockopt(f->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        fcntl(f->fd, F_SETFL, fcntl(f->fd, F_GETFL) & ~O_NONBLOCK);
+        sendReplication(f);
+        dropFollower(replicationFollowerCount - 1, NULL);
+    }
+    close(replicationFd);
+    replicationFd = -1;
+
+    struct sockaddr_storage storage;
+    socklen_t length;
+    if (resolveServerAddress(replicationAddress, &storage, &length) && storage.ss_family == AF_UNIX) {
+        unlink(((struct sockaddr_un*)&storage)->sun_path);
+    }
+}
+
+// Runs a read-only copy of the primary whose replication socket is at primary,
+// serving the usual protocol on address. It must run in the primary's data
+// directory: once the primary has flushed everything it will not stream, the
+// checkpoint and journal are loaded from there under the shared checkpoint
+// lock, and the stream is applied on top. Records the load already covered
+// come again in the stream and are applied a second time, which is harmless.
+int runFollower(const char* primary, const char* address, int threads) {
+    followerMode = 1;
+    int fd = connectToServer(primary);
+    char greeting[3];
+    size_t got = 0;
+    while (fd >= 0 && got < sizeof(greeting) && read(fd, greeting + got, 1) == 1) got++;
+    if (got != sizeof(greeting) || memcmp(greeting, "OK\n", 3) != 0) {
+        printf(" Cannot attach to the primary at '%s'.\n", primary);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+
+    int lockFd = open(CHECKPOINT_LOCK_FILE, O_RDONLY | O_CLOEXEC);
+    if (lockFd >= 0) flock(lockFd, LOCK_SH);
+    loadData();
+    if (lockFd >= 0) close(lockFd);
+    trimFollowedLedger();
+
+    pthread_t follower;
+    followConnected = 1;
+    if (pthread_create(&follower, NULL, followMain, &fd) != 0) {
+        printf(" Cannot start the replication thread.\n");
+        close(fd);
+        return 0;
+    }
+    printf(" Following the primary at %s\n", primary);
+    int ok = runServer(address, threads);
+    __atomic_store_n(&followConnected, -1, __ATOMIC_RELAXED);
+    shutdown(fd, SHUT_RDWR);
+    pthread_join(follower, NULL);
+    close(fd);
+    return ok;
+}
+
+void* followMain(void* arg) {
+    int fd = *(int*)arg;
+    char *buffer = malloc(FOLLOW_BUFFER_SIZE);
+    size_t length = 0;
+    while (buffer != NULL) {
+        ssize_t got = read(fd, buffer + length, FOLLOW_BUFFER_SIZE - length);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        length += got;
+
+        char *end = memrchr(buffer, '\n', length);
+        if (end == NULL) {
+            if (length == FOLLOW_BUFFER_SIZE) break;
+            continue;
+        }
+        size_t complete = end + 1 - buffer;
+        applyFollowBatch(buffer, complete);
+        memmove(buffer, buffer + complete, length - complete);
+        length -= complete;
+    }
+    free(buffer);
+
+    // followConnected is -1 once the follower itself is shutting down.
+    int expected = 1;
+    if (__atomic_compare_exchange_n(&followConnected, &expected, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        printf(" WARNING: Lost the primary's stream. Serving reads from the last state received.\n");
+    }
+    return NULL;
+}
+
+// Applies a run of whole records under exclusive access and one balance
+// epoch, so snapshots never see part of it.
+void applyFollowBatch(char* data, size_t length) {
+    int64_t heartbeat = 0;
+    uint64_t applied = 0;
+
+    beginExclusiveAccess();
+    uint64_t epoch = nextBalanceEpoch();
+    for (char *line = data, *end; line < data + length; line = end + 1) {
+        end = memchr(line, '\n', data + length - line);
+        *end = '\0';
+        if (line[0] == 'H') {
+            heartbeat = strtoll(line + 2, NULL, 10);
+            continue;
+        }
+        int result = applyReplicatedRecord(line, epoch);
+        if (result == 1) applied++;
+        else if (result == 0) printf(" WARNING: Ignored a corrupt record from the primary.\n");
+        else printf(" WARNING: Out of memory while applying the primary's stream.\n");
+    }
+    advanceFollowedLedger();
+    endExclusiveAccess();
+
+    __atomic_add_fetch(&followAppliedRecords, applied, __ATOMIC_RELAXED);
+    if (heartbeat > 0) __atomic_store_n(&followHeartbeat, heartbeat, __ATOMIC_RELAXED);
+}
+
+// Account records overwrite the account as the primary journaled it. Ledger
+// records are placed by id, and counted by advanceFollowedLedger() once every
+// row before them has arrived. Returns 1 once applied, 0 for a malformed
+// record and -1 when out of memory.
+int applyReplicatedRecord(const char* line, uint64_t epoch) {
+    if (line[0] == 'A') {
+        Account a;
+        AccountProfile profile;
+        if (!parseAccountRecord(line, &a, &profile)) return 0;
+        int accIndex = findAccountByNumber(a.accountNumber);
+        if (accIndex == -1) return appendAccount(&a, &profile) == -1 ? -1 : 1;
+
+        AccountProfile *known = profileAt(accIndex);
+        int renamed = strcmp(known->firstName, profile.firstName) != 0 ||
+                      strcmp(known->lastName, profile.lastName) != 0;
+        lockAccount(accIndex);
+        if (renamed) nameIndexRemove(accIndex);
+        Account *current = accountAt(accIndex);
+        adjustAggregates(accIndex, -1);
+        current->isActive = a.isActive;
+        current->isLocked = a.isLocked;
+        current->isSavings = a.isSavings;
+        current->lastInterestDate = a.lastInterestDate;
+        setBalance(accIndex, a.balance, epoch);
+        adjustAggregates(accIndex, 1);
+        *known = profile;
+        if (renamed) nameIndexAdd(accIndex);
+        unlockAccount(accIndex);
+        return 1;
+    }
+
+    if (line[0] == 'T') {
+        Transaction t;
+        char description[MAX_DESCRIPTION_LENGTH];
+        if (!parseTransactionRecord(line, &t, description) || t.transactionId < 1) return 0;
+        if (t.transactionId <= transactionCount) return 1;
+        t.description = internString(description);
+        if (t.description == -1 || !ensureTransactionCapacity(t.transactionId)) return -1;
+        t.previousForAccount = -1;
+        *transactionAt(t.transactionId - 1) = t;
+        return 1;
+    }
+    return 0;
+}
+
+// Counts the rows that have arrived in an unbroken run past the end of the
+// ledger, threading each onto its account's history chain.
+void advanceFollowedLedger() {
+    int slot = transactionCount;
+    while (slot < transactionChunkCount * CHUNK_SIZE && transactionAt(slot)->transactionId == slot + 1) {
+        Transaction *t = transactionAt(slot);
+        int accIndex = findAccountByNumber(t->accountNumber);
+        if (accIndex != -1) {
+            lockAccount(accIndex);
+            t->previousForAccount = accountAt(accIndex)->lastTransaction;
+            accountAt(accIndex)->lastTransaction = slot;
+            unlockAccount(accIndex);
+        }
+        if (!rollupTransaction(accIndex, t, 1)) printf(" WARNING: Out of memory for statement rollups.\n");
+        noteTransactionTime(slot, t->timestamp);
+        __atomic_store_n(&transactionCount, ++slot, __ATOMIC_RELEASE);
+    }
+}
+
+// Journal replay places rows by id, so a row whose record had not reached the
+// disk at load leaves a hole. The ledger is cut back to the first one; rows
+// past it stay in place and are counted again once the stream fills it, so
+// they are taken out of the rollups until then.
+void trimFollowedLedger() {
+    for (int i = archivedTransactions; i < transactionCount; i++) {
+        if (transactionAt(i)->transactionId != i + 1) {
+            for (int j = i + 1; j < transactionCount; j++) {
+                Transaction *t = transactionAt(j);
+                if (t->transactionId == j + 1) rollupTransaction(findAccountByNumber(t->accountNumber), t, -1);
+            }
+            transactionCount = i;
+            rebuildTransactionChains();
+            rebuildTimeIndex();
+            return;
         }
-    } while (choice != 4);
+    }
+}
+
+#else
+
+int runServer(const char* address, int threads) {
+    (void)address;
+    (void)threads;
+    printf(" Server mode requires Linux (epoll).\n");
+    return 0;
+}
+
+void runLoadGenerator(const char* address, int connections, int requests, int threads) {
+    (void)address;
+    (void)connections;
+    (void)requests;
+    (void)threads;
+    printf(" The load generator requires Linux (epoll).\n");
+}
+
+int startReplication(const char* address) {
+    (void)address;
+    printf(" Replication requires Linux.\n");
+    return 0;
 }
 
+void shipReplication() {
+}
+
+void stopReplication() {
+}
+
+int runFollower(const char* primary, const char* address, int threads) {
+    (void)primary;
+    (void)address;
+    (void)threads;
+    printf(" Follower mode requires Linux.\n");
+    return 0;
+}
+
+#endif